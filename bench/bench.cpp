@@ -0,0 +1,480 @@
+// Aurel Strigáč <xstrig00>
+
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include <ncurses.h>
+
+#include "generator.h"
+#include "batch.h"
+#include "capture.h"
+#include "display.h"
+#include "flow.h"
+#include "history.h"
+#include "worker.h"
+#include "net-top.h"
+
+// Globals of net-top.cpp, which is not linked because of its main
+std::string interface;
+std::vector<std::string> interfaces;
+std::string filter_expr;
+std::string headless_format;
+std::string output_path;
+std::string stats_path;
+std::string history_path;
+size_t history_max_size = HISTORY_DEFAULT_SIZE;
+std::string playback_path;
+std::string read_file;
+std::string replay_speed = "max";
+char sort_order = 'b';
+int refresh_ms = 1000;
+std::string rate_mode = "2s";
+std::string aggregation = "flow";
+int prefix_v4 = 24;
+int prefix_v6 = 64;
+std::string resolve = "off";
+unsigned resolve_threads = 2;
+size_t top_count = 10;
+int idle_timeout = 30;
+size_t max_flows = 1 << 18;
+size_t max_mem = 0;
+std::string overload_policy = "evict";
+std::string sketch_mode = "off";
+size_t sketch_size = 4096;
+size_t sketch_threshold = 0;
+std::string backend = "ring";
+unsigned ring_block_size = 1 << 20;
+unsigned ring_block_count = 64;
+unsigned worker_count = 1;
+char errbuf[PCAP_ERRBUF_SIZE];
+
+using Clock = std::chrono::steady_clock;
+
+static int passes = 5;          // Repetitions of each benchmark over the trace
+static std::string only;        // Run only the benchmark of this name
+
+/**
+ * @brief Function for printing one result line, peak RSS is the one of the benchmark's own process.
+ * @param name Name of the benchmark.
+ * @param unit What one operation is.
+ * @param ops Number of operations.
+ * @param elapsed Time spent in nanoseconds.
+ */
+static void report(const char *name, const char *unit, uint64_t ops, double elapsed) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%-22s %12llu %-8s %14.0f %12.1f %10ld\n", name, static_cast<unsigned long long>(ops), unit,
+           ops / (elapsed / 1e9), elapsed / ops, usage.ru_maxrss);
+    fflush(stdout);
+}
+
+/**
+ * @brief Function for getting nanoseconds elapsed since a point in time.
+ * @param start Start of the measurement.
+ * @return Elapsed nanoseconds.
+ */
+static double since(Clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+/**
+ * @brief Function for preparing a worker the way open_workers does.
+ * @param worker Worker to prepare.
+ * @param config Parameters of the traffic.
+ */
+static void init_worker(Worker &worker, const GeneratorConfig &config) {
+    uint32_t capacity = static_cast<uint32_t>(std::min(max_flows, config.flows * 2));
+    init_flow_shard(worker.flows, capacity, static_cast<uint64_t>(idle_timeout) * 1000, OverloadPolicy::EVICT, 1700000000000ULL);
+    init_flow_rollups(worker.flows, capacity, static_cast<uint8_t>(prefix_v4), static_cast<uint8_t>(prefix_v6));
+    for (auto &snapshot : worker.snapshots) snapshot.flows.reserve(capacity);
+}
+
+/**
+ * @brief Benchmark of parsing and counting whole frames.
+ */
+static void bench_packet_handler(const Trace &trace, const GeneratorConfig &config) {
+    Worker worker;
+    init_worker(worker, config);
+
+    auto start = Clock::now();
+    for (int pass = 0; pass < passes; pass++) {
+        for (size_t i = 0; i < trace.headers.size(); i++) {
+            packet_handler(reinterpret_cast<u_char *>(&worker), &trace.headers[i], trace.data.data() + trace.offsets[i]);
+        }
+    }
+    report("packet_handler", "packet", trace.headers.size() * passes, since(start));
+}
+
+/**
+ * @brief Benchmark of parsing and counting frames in batches referenced in place, as the ring backend does.
+ */
+static void bench_batch(const Trace &trace, const GeneratorConfig &config) {
+    Worker worker;
+    init_worker(worker, config);
+    u_char *user = reinterpret_cast<u_char *>(&worker);
+
+    auto start = Clock::now();
+    for (int pass = 0; pass < passes; pass++) {
+        for (size_t i = 0; i < trace.headers.size(); i++) {
+            if (worker.batch.count == BATCH_SIZE) flush_batch(user);
+            batch_push(worker.batch, trace.headers[i], trace.data.data() + trace.offsets[i]);
+        }
+        if (worker.batch.count > 0) flush_batch(user);
+    }
+    report((std::string("batch (") + batch_isa() + ")").c_str(), "packet", trace.headers.size() * passes, since(start));
+}
+
+/**
+ * @brief Benchmark of parsing frames on arrival and counting their keys in batches, as libpcap and replay do.
+ */
+static void bench_batch_handler(const Trace &trace, const GeneratorConfig &config) {
+    Worker worker;
+    init_worker(worker, config);
+    u_char *user = reinterpret_cast<u_char *>(&worker);
+
+    auto start = Clock::now();
+    for (int pass = 0; pass < passes; pass++) {
+        for (size_t i = 0; i < trace.headers.size(); i++) {
+            batch_handler(user, &trace.headers[i], trace.data.data() + trace.offsets[i]);
+        }
+        if (worker.batch.count > 0) count_batch(user);
+    }
+    report("batch_handler", "packet", trace.headers.size() * passes, since(start));
+}
+
+/**
+ * @brief Benchmark of extracting flow keys without counting them, frame by frame and in batches.
+ */
+static void bench_parse(const Trace &trace, const GeneratorConfig &config) {
+    Worker worker;
+    init_worker(worker, config);
+    u_char *user = reinterpret_cast<u_char *>(&worker);
+
+    // The batch hashes its keys, the single frames are hashed too so both produce the same
+    uint32_t hashes = 0;
+    auto start = Clock::now();
+    for (int pass = 0; pass < passes; pass++) {
+        for (size_t i = 0; i < trace.headers.size(); i++) {
+            FlowID key;
+            uint16_t total_len;
+            if (parse_packet(user, &trace.headers[i], trace.data.data() + trace.offsets[i], key, total_len)) hashes ^= flow_hash(key);
+        }
+    }
+    report("parse_packet", "packet", trace.headers.size() * passes, since(start));
+
+    PacketBatch &batch = worker.batch;
+    start = Clock::now();
+    for (int pass = 0; pass < passes; pass++) {
+        for (size_t i = 0; i < trace.headers.size(); i++) {
+            batch_push(batch, trace.headers[i], trace.data.data() + trace.offsets[i]);
+            if (batch.count < BATCH_SIZE && i + 1 < trace.headers.size()) continue;
+            parse_batch(batch);
+            for (uint64_t mask = batch.parsed; mask != 0; mask &= mask - 1) hashes ^= batch.hashes[__builtin_ctzll(mask)];
+            batch.count = 0;
+        }
+    }
+    report((std::string("parse_batch (") + batch_isa() + ")").c_str(), "packet", trace.headers.size() * passes, since(start));
+    if (hashes == 0) printf("\n");
+}
+
+/**
+ * @brief Benchmark of the flow table alone, keys are parsed in advance.
+ */
+static void bench_update(const Trace &trace, const GeneratorConfig &config) {
+    Worker worker;
+    init_worker(worker, config);
+
+    auto start = Clock::now();
+    for (int pass = 0; pass < passes; pass++) {
+        for (size_t i = 0; i < trace.keys.size(); i++) {
+            update_flow_statistics(worker.flows, trace.keys[i], static_cast<uint16_t>(trace.headers[i].len), 1700000000000ULL);
+        }
+    }
+    report("update_flow_statistics", "packet", trace.keys.size() * passes, since(start));
+}
+
+/**
+ * @brief Benchmark of closing intervals, every flow of the trace is active in each of them.
+ */
+static void bench_interval(const Trace &trace, const GeneratorConfig &config) {
+    Worker worker;
+    init_worker(worker, config);
+
+    const int intervals = passes * 20;
+    uint64_t now = 1700000000000ULL;
+    double elapsed = 0;
+    for (int interval = 0; interval < intervals; interval++) {
+        for (size_t i = 0; i < trace.keys.size(); i += 16) {
+            update_flow_statistics(worker.flows, trace.keys[i], 100, now);
+        }
+
+        now += 1000;
+        auto start = Clock::now();
+        reset_flow_statistics(worker.flows);
+        trim_flows(worker.flows, now);
+        elapsed += since(start);
+    }
+    report("reset+trim_flows", "interval", intervals, elapsed);
+}
+
+/**
+ * @brief Benchmark of drawing one refresh into a screen backed by /dev/null.
+ */
+static void bench_display(const Trace &trace, const GeneratorConfig &config) {
+    workers.push_back(std::make_unique<Worker>());
+    Worker &worker = *workers.front();
+    init_worker(worker, config);
+    for (size_t i = 0; i < trace.keys.size(); i++) {
+        update_flow_statistics(worker.flows, trace.keys[i], static_cast<uint16_t>(trace.headers[i].len), 1700000000000ULL);
+    }
+    close_interval(worker, 1, 1700000001000ULL);
+
+    FILE *null = fopen("/dev/null", "w");
+    SCREEN *screen = newterm("xterm", null, stdin);
+    if (screen == nullptr) {
+        std::cerr << "[ ERROR ] Cannot create the dummy screen\n";
+        exit(EXIT_FAILURE);
+    }
+    resizeterm(60, 140);
+
+    const int frames = passes * 100;
+    auto start = Clock::now();
+    for (int frame = 0; frame < frames; frame++) display_statistics(1);
+    double elapsed = since(start);
+
+    endwin();
+    delscreen(screen);
+    fclose(null);
+    report("display_statistics", "frame", frames, elapsed);
+}
+
+/**
+ * @brief Benchmark of logging intervals to the history, every flow of the trace is logged in each of them.
+ */
+static void bench_history(const Trace &trace, const GeneratorConfig &config) {
+    workers.push_back(std::make_unique<Worker>());
+    Worker &worker = *workers.front();
+    init_worker(worker, config);
+    for (size_t i = 0; i < trace.keys.size(); i++) {
+        update_flow_statistics(worker.flows, trace.keys[i], static_cast<uint16_t>(trace.headers[i].len), 1700000000000ULL);
+    }
+    close_interval(worker, 1, 1700000001000ULL);
+
+    // The first interval fills the dictionary, the rest are the steady state of a stable flow set
+    std::string path = "/tmp/net-top-bench-" + std::to_string(getpid()) + ".history";
+    if (!open_history(path, SIZE_MAX, errbuf)) {
+        std::cerr << "[ ERROR ] Cannot open history " << errbuf << "\n";
+        exit(EXIT_FAILURE);
+    }
+
+    const int intervals = passes * 20;
+    auto start = Clock::now();
+    for (int interval = 1; interval <= intervals; interval++) log_interval(1);
+    double elapsed = since(start);
+
+    close_history();
+    unlink(path.c_str());
+    report("log_interval", "flow", worker.snapshots[1].flows.size() * intervals, elapsed);
+}
+
+/**
+ * @brief Benchmark of the whole pipeline, intervals are closed and drawn by packet timestamps.
+ */
+static void bench_pipeline(const Trace &trace, const GeneratorConfig &config) {
+    workers.push_back(std::make_unique<Worker>());
+    Worker &worker = *workers.front();
+    init_worker(worker, config);
+
+    FILE *null = fopen("/dev/null", "w");
+    SCREEN *screen = newterm("xterm", null, stdin);
+    if (screen == nullptr) {
+        std::cerr << "[ ERROR ] Cannot create the dummy screen\n";
+        exit(EXIT_FAILURE);
+    }
+    resizeterm(60, 140);
+
+    // Timestamps continue across passes, so every pass adds intervals instead of replaying old ones
+    const uint64_t interval = static_cast<uint64_t>(refresh_ms);
+    uint64_t span = trace.headers.size() * 1000 / config.rate + interval;
+    uint64_t boundary = 0;
+    uint32_t epoch = 0;
+
+    auto start = Clock::now();
+    for (int pass = 0; pass < passes; pass++) {
+        for (size_t i = 0; i < trace.headers.size(); i++) {
+            struct pcap_pkthdr header = trace.headers[i];
+            header.ts.tv_sec += static_cast<time_t>(pass * (span / 1000 + 1));
+            uint64_t now = static_cast<uint64_t>(header.ts.tv_sec) * 1000 + header.ts.tv_usec / 1000;
+            if (boundary == 0) boundary = now + interval;
+            if (now >= boundary && worker.batch.count > 0) count_batch(reinterpret_cast<u_char *>(&worker));
+            while (now >= boundary) {
+                close_interval(worker, ++epoch, boundary);
+                display_statistics(epoch);
+                boundary += interval;
+            }
+            batch_handler(reinterpret_cast<u_char *>(&worker), &header, trace.data.data() + trace.offsets[i]);
+        }
+    }
+    if (worker.batch.count > 0) count_batch(reinterpret_cast<u_char *>(&worker));
+    double elapsed = since(start);
+
+    endwin();
+    delscreen(screen);
+    fclose(null);
+    report("pipeline", "packet", trace.headers.size() * passes, elapsed);
+}
+
+/**
+ * @brief Function for running a benchmark in its own process, so its peak RSS is not mixed with the others.
+ * @param name Name used by --only.
+ * @param bench Benchmark function.
+ */
+static void run(const char *name, void (*bench)(const Trace &, const GeneratorConfig &), const Trace &trace,
+                const GeneratorConfig &config) {
+    if (!only.empty() && only != name) return;
+
+    // Buffered output would be printed by the child again
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        bench(trace, config);
+        _exit(EXIT_SUCCESS);
+    }
+
+    int status;
+    if (pid == -1 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "[ ERROR ] Benchmark " << name << " failed\n";
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for printing help of the benchmark.
+ */
+static void print_bench_help() {
+    std::cout << "\nUSAGE:\n"
+              << "./net-top-bench [--flows n] [--zipf s] [--ipv6 ratio] [--sizes a,b,...] [--packets n] [--passes n]\n"
+              << "                [--seed n] [--only name] [--write file]\n\n"
+              << "Options:\n"
+              << "  --flows   :  Number of distinct flows (default: 10000).\n"
+              << "  --zipf    :  Skew of flow popularity, 0 for uniform (default: 1.1).\n"
+              << "  --ipv6    :  Share of IPv6 flows between 0 and 1 (default: 0.2).\n"
+              << "  --sizes   :  Packet sizes on the wire picked uniformly (default: 64,576,1500).\n"
+              << "  --packets :  Number of generated packets (default: 1048576).\n"
+              << "  --passes  :  Repetitions of each benchmark (default: 5).\n"
+              << "  --seed    :  Seed of the generator (default: 1).\n"
+              << "  --only    :  Run one benchmark: packet_handler, batch, batch_handler, parse, update, interval, display, history or pipeline.\n"
+              << "  --write   :  Write the generated trace into a pcap file for net-top -r and exit.\n"
+              << "  -h, --help :  Display this help message and exit.\n\n";
+}
+
+int main(int argc, char *argv[]) {
+    GeneratorConfig config;
+    std::string write_file;
+
+    enum { OPT_FLOWS = 256, OPT_ZIPF, OPT_IPV6, OPT_SIZES, OPT_PACKETS, OPT_PASSES, OPT_SEED, OPT_ONLY, OPT_WRITE };
+    struct option long_options[] = {
+        {"help", no_argument, nullptr, 'h'},
+        {"flows", required_argument, nullptr, OPT_FLOWS},
+        {"zipf", required_argument, nullptr, OPT_ZIPF},
+        {"ipv6", required_argument, nullptr, OPT_IPV6},
+        {"sizes", required_argument, nullptr, OPT_SIZES},
+        {"packets", required_argument, nullptr, OPT_PACKETS},
+        {"passes", required_argument, nullptr, OPT_PASSES},
+        {"seed", required_argument, nullptr, OPT_SEED},
+        {"only", required_argument, nullptr, OPT_ONLY},
+        {"write", required_argument, nullptr, OPT_WRITE},
+        {nullptr, 0, nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case OPT_FLOWS:
+                config.flows = static_cast<size_t>(std::atol(optarg));
+                break;
+            case OPT_ZIPF:
+                config.zipf = std::atof(optarg);
+                break;
+            case OPT_IPV6:
+                config.ipv6_ratio = std::atof(optarg);
+                break;
+            case OPT_SIZES: {
+                config.sizes.clear();
+                std::stringstream list(optarg);
+                std::string size;
+                while (std::getline(list, size, ',')) config.sizes.push_back(static_cast<uint16_t>(std::atoi(size.c_str())));
+                break;
+            }
+            case OPT_PACKETS:
+                config.packets = static_cast<size_t>(std::atol(optarg));
+                break;
+            case OPT_PASSES:
+                passes = std::atoi(optarg);
+                break;
+            case OPT_SEED:
+                config.seed = static_cast<uint32_t>(std::atol(optarg));
+                break;
+            case OPT_ONLY:
+                only = optarg;
+                break;
+            case OPT_WRITE:
+                write_file = optarg;
+                break;
+            case 'h':
+                print_bench_help();
+                return EXIT_SUCCESS;
+            default:
+                print_bench_help();
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (config.flows == 0 || config.packets == 0 || passes <= 0 || config.sizes.empty() ||
+        *std::min_element(config.sizes.begin(), config.sizes.end()) < 64) {
+        std::cerr << "[ ERROR ] Invalid benchmark parameters, sizes must be at least 64 bytes.\n";
+        print_bench_help();
+        return EXIT_FAILURE;
+    }
+
+    Trace trace;
+    generate_trace(config, trace);
+
+    if (!write_file.empty()) {
+        if (!write_pcap(trace, write_file)) {
+            std::cerr << "[ ERROR ] Cannot write " << write_file << ": " << strerror(errno) << "\n";
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    // Benchmarks are forked after generating, so their peak RSS includes the trace
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("flows %zu, zipf %.2f, ipv6 %.2f, packets %zu, passes %d, RSS with the trace %ld KiB\n\n", config.flows,
+           config.zipf, config.ipv6_ratio, config.packets, passes, usage.ru_maxrss);
+    printf("%-22s %12s %-8s %14s %12s %10s\n", "benchmark", "operations", "unit", "per second", "ns per op", "peak KiB");
+    run("packet_handler", bench_packet_handler, trace, config);
+    run("batch", bench_batch, trace, config);
+    run("batch_handler", bench_batch_handler, trace, config);
+    run("parse", bench_parse, trace, config);
+    run("update", bench_update, trace, config);
+    run("interval", bench_interval, trace, config);
+    run("display", bench_display, trace, config);
+    run("history", bench_history, trace, config);
+    run("pipeline", bench_pipeline, trace, config);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,195 @@
+// Aurel Strigáč <xstrig00>
+
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <net/ethernet.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+#include "generator.h"
+
+/**
+ * @brief Endpoints of one generated flow.
+ */
+struct Endpoints {
+    FlowID key;      // Client->server direction
+    bool tcp;        // TCP or UDP
+};
+
+/**
+ * @brief Function for creating the endpoints of a flow.
+ * @param index Index of the flow.
+ * @param ipv6 Whether the flow uses IPv6.
+ * @param rng Random generator.
+ * @return Endpoints of the flow.
+ */
+static Endpoints make_flow(size_t index, bool ipv6, std::mt19937 &rng) {
+    Endpoints flow = {};
+    flow.tcp = rng() % 5 != 0;
+    flow.key.proto = flow.tcp ? IPPROTO_TCP : IPPROTO_UDP;
+    flow.key.port1 = static_cast<uint16_t>(1024 + rng() % 60000);
+    flow.key.port2 = static_cast<uint16_t>(flow.tcp ? (rng() % 2 ? 443 : 80) : 53);
+
+    uint32_t client = static_cast<uint32_t>(index);
+    uint32_t server = static_cast<uint32_t>(rng() % 4096);
+    if (ipv6) {
+        // 2001:db8::/32 documentation prefix
+        flow.key.family = AF_INET6;
+        uint8_t prefix[4] = {0x20, 0x01, 0x0d, 0xb8};
+        std::memcpy(flow.key.ip1, prefix, 4);
+        std::memcpy(flow.key.ip2, prefix, 4);
+        flow.key.ip2[4] = 1;
+        for (int i = 0; i < 4; i++) {
+            flow.key.ip1[12 + i] = static_cast<uint8_t>(client >> (24 - 8 * i));
+            flow.key.ip2[12 + i] = static_cast<uint8_t>(server >> (24 - 8 * i));
+        }
+    } else {
+        // Clients in 10.0.0.0/8, servers in 192.168.0.0/16
+        flow.key.family = AF_INET;
+        uint32_t src = htonl(0x0a000000 | (client & 0xffffff));
+        uint32_t dst = htonl(0xc0a80000 | (server & 0xffff));
+        std::memcpy(flow.key.ip1, &src, 4);
+        std::memcpy(flow.key.ip2, &dst, 4);
+    }
+    return flow;
+}
+
+/**
+ * @brief Function for writing Ethernet, IP and transport headers of one packet.
+ * @param key FlowID of the packet (src->dst).
+ * @param tcp Whether the transport is TCP.
+ * @param size Size of the packet on the wire.
+ * @param out Buffer for the headers.
+ * @return Number of written bytes.
+ */
+static uint32_t build_headers(const FlowID &key, bool tcp, uint16_t size, uint8_t *out) {
+    struct ether_header eth = {};
+    eth.ether_type = htons(key.family == AF_INET6 ? ETHERTYPE_IPV6 : ETHERTYPE_IP);
+    std::memcpy(out, &eth, sizeof(eth));
+    uint32_t len = sizeof(eth);
+
+    uint16_t l4_len = tcp ? sizeof(struct tcphdr) : sizeof(struct udphdr);
+    if (key.family == AF_INET6) {
+        struct ip6_hdr ip6 = {};
+        ip6.ip6_vfc = 6 << 4;
+        ip6.ip6_plen = htons(static_cast<uint16_t>(size - sizeof(eth) - sizeof(ip6)));
+        ip6.ip6_nxt = key.proto;
+        ip6.ip6_hlim = 64;
+        std::memcpy(&ip6.ip6_src, key.ip1, 16);
+        std::memcpy(&ip6.ip6_dst, key.ip2, 16);
+        std::memcpy(out + len, &ip6, sizeof(ip6));
+        len += sizeof(ip6);
+    } else {
+        struct ip ip = {};
+        ip.ip_v = 4;
+        ip.ip_hl = 5;
+        ip.ip_len = htons(static_cast<uint16_t>(size - sizeof(eth)));
+        ip.ip_ttl = 64;
+        ip.ip_p = key.proto;
+        std::memcpy(&ip.ip_src, key.ip1, 4);
+        std::memcpy(&ip.ip_dst, key.ip2, 4);
+        std::memcpy(out + len, &ip, sizeof(ip));
+        len += sizeof(ip);
+    }
+
+    if (tcp) {
+        struct tcphdr th = {};
+        th.th_sport = htons(key.port1);
+        th.th_dport = htons(key.port2);
+        th.th_off = 5;
+        th.th_flags = TH_ACK;
+        std::memcpy(out + len, &th, sizeof(th));
+    } else {
+        struct udphdr uh = {};
+        uh.uh_sport = htons(key.port1);
+        uh.uh_dport = htons(key.port2);
+        uh.uh_ulen = htons(static_cast<uint16_t>(size - len));
+        std::memcpy(out + len, &uh, sizeof(uh));
+    }
+    return len + l4_len;
+}
+
+/**
+ * @brief Function for generating synthetic traffic.
+ * @param config Parameters of the traffic.
+ * @param trace Trace to fill.
+ */
+void generate_trace(const GeneratorConfig &config, Trace &trace) {
+    std::mt19937 rng(config.seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    std::vector<Endpoints> flows;
+    flows.reserve(config.flows);
+    for (size_t i = 0; i < config.flows; i++) flows.push_back(make_flow(i, uniform(rng) < config.ipv6_ratio, rng));
+
+    // Zipf popularity, flow i is picked with probability proportional to 1 / (i + 1)^s
+    std::vector<double> cdf(config.flows);
+    double sum = 0;
+    for (size_t i = 0; i < config.flows; i++) {
+        sum += 1.0 / std::pow(static_cast<double>(i + 1), config.zipf);
+        cdf[i] = sum;
+    }
+
+    trace.data.clear();
+    trace.offsets.clear();
+    trace.headers.clear();
+    trace.keys.clear();
+    trace.data.reserve(config.packets * 80);
+    trace.offsets.reserve(config.packets);
+    trace.headers.reserve(config.packets);
+    trace.keys.reserve(config.packets);
+
+    uint8_t frame[128];
+    for (size_t i = 0; i < config.packets; i++) {
+        size_t index = std::lower_bound(cdf.begin(), cdf.end(), uniform(rng) * sum) - cdf.begin();
+        const Endpoints &flow = flows[std::min(index, config.flows - 1)];
+        FlowID key = uniform(rng) < config.reply_ratio ? reverse_flow(flow.key) : flow.key;
+
+        uint16_t size = config.sizes[rng() % config.sizes.size()];
+        uint32_t caplen = build_headers(key, flow.tcp, size, frame);
+
+        struct pcap_pkthdr header = {};
+        uint64_t usec = i * 1000000 / config.rate;
+        header.ts.tv_sec = static_cast<time_t>(1700000000 + usec / 1000000);
+        header.ts.tv_usec = static_cast<suseconds_t>(usec % 1000000);
+        header.caplen = caplen;
+        header.len = std::max<uint32_t>(size, caplen);
+
+        trace.offsets.push_back(static_cast<uint32_t>(trace.data.size()));
+        trace.data.insert(trace.data.end(), frame, frame + caplen);
+        trace.headers.push_back(header);
+        trace.keys.push_back(key);
+    }
+}
+
+/**
+ * @brief Function for writing a trace into a pcap file, it can be replayed with net-top -r.
+ * @param trace Generated trace.
+ * @param path Path of the file.
+ * @return True on success, false otherwise.
+ */
+bool write_pcap(const Trace &trace, const std::string &path) {
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr) return false;
+
+    // Classic pcap file header, microsecond timestamps, Ethernet link type
+    uint32_t global[6] = {0xa1b2c3d4, 0x00040002, 0, 0, 65535, DLT_EN10MB};
+    bool ok = fwrite(global, sizeof(global), 1, file) == 1;
+
+    for (size_t i = 0; ok && i < trace.headers.size(); i++) {
+        const struct pcap_pkthdr &header = trace.headers[i];
+        uint32_t record[4] = {static_cast<uint32_t>(header.ts.tv_sec), static_cast<uint32_t>(header.ts.tv_usec),
+                              header.caplen, header.len};
+        ok = fwrite(record, sizeof(record), 1, file) == 1 &&
+             fwrite(trace.data.data() + trace.offsets[i], header.caplen, 1, file) == 1;
+    }
+
+    return fclose(file) == 0 && ok;
+}
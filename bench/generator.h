@@ -0,0 +1,52 @@
+// Aurel Strigáč <xstrig00>
+
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <pcap.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "flow.h"
+
+/**
+ * @brief Parameters of the synthetic traffic.
+ */
+struct GeneratorConfig {
+    size_t flows = 10000;                          // Number of distinct flows
+    double zipf = 1.1;                             // Skew of flow popularity, 0 for uniform
+    double ipv6_ratio = 0.2;                       // Share of IPv6 flows
+    double reply_ratio = 0.3;                      // Share of packets going in the reverse direction
+    std::vector<uint16_t> sizes = {64, 576, 1500}; // Packet sizes on the wire, picked uniformly
+    size_t packets = 1 << 20;                      // Number of generated packets
+    uint64_t rate = 1000000;                       // Packets per second of the timestamps
+    uint32_t seed = 1;                             // Seed of the random generator
+};
+
+/**
+ * @brief Generated packets stored back to back, only headers are kept like in a real capture.
+ */
+struct Trace {
+    std::vector<uint8_t> data;              // Captured bytes of all packets
+    std::vector<uint32_t> offsets;          // Start of each packet in data
+    std::vector<struct pcap_pkthdr> headers; // Pcap header of each packet
+    std::vector<FlowID> keys;               // FlowID of each packet (src->dst)
+};
+
+/**
+ * @brief Function for generating synthetic traffic.
+ * @param config Parameters of the traffic.
+ * @param trace Trace to fill.
+ */
+void generate_trace(const GeneratorConfig &config, Trace &trace);
+
+/**
+ * @brief Function for writing a trace into a pcap file, it can be replayed with net-top -r.
+ * @param trace Generated trace.
+ * @param path Path of the file.
+ * @return True on success, false otherwise.
+ */
+bool write_pcap(const Trace &trace, const std::string &path);
+
+#endif // GENERATOR_H
@@ -0,0 +1,89 @@
+// Aurel Strigáč <xstrig00>
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <pcap.h>
+#include <cstdint>
+
+#include "flow.h"
+#include "link.h"
+
+/**
+ * @brief Number of frames parsed together, one bit of a 64-bit mask each.
+ */
+constexpr uint32_t BATCH_SIZE = 64;
+
+/**
+ * @brief Frames parsed together, stored as a structure of arrays.
+ *
+ * Classification reads the ethertype and IP protocol of every frame into dense arrays and
+ * compares them with SIMD instructions when the CPU has them. Link header (with up to two VLAN
+ * tags) + IPv4/IPv6 + TCP/UDP/ICMP frames are then turned into binary flow keys without
+ * branching on strings or calling libc, frames with anything else, such as fragments or IPv6
+ * extension headers, are left to the per-packet parser.
+ *
+ * Backends which reuse their buffer after the callback can't leave frames in the batch, their
+ * frames are parsed on arrival and only the keys wait in the batch. Either way the flow records
+ * of the whole batch are looked up together, so the misses of the table overlap.
+ */
+struct PacketBatch {
+    const u_char *frames[BATCH_SIZE];                // Start of each frame
+    struct pcap_pkthdr headers[BATCH_SIZE];          // Pcap header of each frame
+    uint32_t count = 0;                              // Number of frames in the batch
+    uint16_t ingress = 0;                            // Interface the frames were captured on
+
+    alignas(32) uint16_t ethertypes[BATCH_SIZE];     // Ethertype behind the VLAN tags in network byte order, 0 if truncated
+    alignas(32) uint8_t protos[BATCH_SIZE];          // IP protocol assuming no extension headers, 0 if truncated
+    uint8_t l3_offsets[BATCH_SIZE];                  // Start of the IP header behind the VLAN tags
+
+    uint64_t parsed = 0;                             // Bit i is set when keys[i] and lengths[i] are valid
+    FlowID keys[BATCH_SIZE];                         // FlowID of each parsed frame (src->dst)
+    uint16_t lengths[BATCH_SIZE];                    // IP length of each parsed frame
+    uint32_t hashes[BATCH_SIZE];                     // flow_hash of each parsed frame
+};
+
+/**
+ * @brief Function for adding a frame which stays valid until the batch is processed.
+ * @param batch Batch with free room.
+ * @param header Pcap packet header.
+ * @param packet Packet data.
+ */
+inline void batch_push(PacketBatch &batch, const struct pcap_pkthdr &header, const u_char *packet) {
+    batch.headers[batch.count] = header;
+    batch.frames[batch.count] = packet;
+    batch.count++;
+}
+
+/**
+ * @brief Function for adding the key of a frame parsed on arrival, the frame itself is not kept.
+ * @param batch Batch with free room.
+ * @param header Pcap packet header.
+ * @param key FlowID of the frame (src->dst).
+ * @param total_len IP length of the frame.
+ */
+inline void batch_push_key(PacketBatch &batch, const struct pcap_pkthdr &header, const FlowID &key, uint16_t total_len) {
+    uint32_t i = batch.count++;
+    batch.headers[i] = header;
+    batch.frames[i] = nullptr;
+    batch.keys[i] = key;
+    batch.lengths[i] = total_len;
+    batch.hashes[i] = flow_hash(key);
+    batch.parsed |= 1ULL << i;
+}
+
+/**
+ * @brief Function for classifying all frames of the batch and extracting keys of the common ones.
+ * @tparam L Link-layer header of the frames.
+ * @param batch Batch to parse, its parsed mask is filled.
+ */
+template <LinkType L = LinkType::ETHERNET>
+void parse_batch(PacketBatch &batch);
+
+/**
+ * @brief Function for getting the name of the classification code selected for this CPU.
+ * @return "avx2", "sse2" or "scalar".
+ */
+const char *batch_isa();
+
+#endif // BATCH_H
@@ -4,44 +4,213 @@
 #define CAPTURE_H
 
 #include <pcap.h>
+#include <cstdint>
 #include <string>
 
+#include "flow.h"
+#include "link.h"
+#include "ring.h"
+
+/**
+ * @brief Lengths of the deepest header chain we parse: the longest link header, two VLAN tags,
+ *        IPv6 with extension headers and the first 8 bytes of the L4 header (ports).
+ */
+constexpr int IPV6_HEADER_LEN = 40;
+constexpr int MAX_IPV6_EXT_LEN = 128;
+constexpr int L4_PORTS_LEN = 8;
+
+/**
+ * @brief Maximum number of IPv6 extension headers walked before the packet is given up.
+ */
+constexpr int MAX_IPV6_EXT_HEADERS = 8;
+
+/**
+ * @brief Number of fragment cache slots and how long a first fragment's ports are remembered.
+ */
+constexpr uint32_t FRAGMENT_CACHE_SIZE = 1024;
+constexpr uint64_t FRAGMENT_TIMEOUT_MS = 30000;
+
+/**
+ * @brief Snapshot length covering every header we read, payload is never copied to user space.
+ */
+constexpr int CAPTURE_SNAPLEN = MAX_LINK_HEADER_LEN + MAX_VLAN_TAGS * VLAN_TAG_LEN + IPV6_HEADER_LEN + MAX_IPV6_EXT_LEN + L4_PORTS_LEN;
+
+/**
+ * @brief Default filter, drops traffic which packet_handler would discard anyway.
+ */
+extern const char *DEFAULT_FILTER;
+
+/**
+ * @brief Fragmentation state of an IP packet.
+ */
+struct FragmentInfo {
+    bool fragment = false; // Whether the packet is a fragment
+    bool first = false;    // Whether it is the fragment at offset 0, the only one with the L4 header
+    uint32_t id = 0;       // Identification of the original packet
+};
+
+/**
+ * @brief Ports of recently seen first fragments, so later fragments are counted to the same flow.
+ *
+ * Slots are direct-mapped by the hash of addresses, protocol and fragment ID, a colliding
+ * first fragment simply replaces the older one. Fragments arriving before their first one are
+ * counted without ports.
+ */
+struct FragmentCache {
+    struct Slot {
+        FlowID key;             // Addresses, protocol and fragment ID in the port fields
+        uint16_t port1 = 0;     // Source port of the original packet
+        uint16_t port2 = 0;     // Destination port of the original packet
+        uint64_t seen = 0;      // Time of the first fragment in milliseconds, 0 for an empty slot
+    };
+    Slot slots[FRAGMENT_CACHE_SIZE];
+};
+
+/**
+ * @brief Function for remembering the ports of a first fragment.
+ * @param cache Fragment cache of the worker.
+ * @param key FlowID of the fragment (src->dst) with its ports.
+ * @param id Fragment identification.
+ * @param now Packet timestamp in milliseconds.
+ */
+void remember_fragment(FragmentCache &cache, const FlowID &key, uint32_t id, uint64_t now);
+
+/**
+ * @brief Function for filling in the ports of a later fragment from its first fragment.
+ * @param cache Fragment cache of the worker.
+ * @param key FlowID of the fragment (src->dst), its ports are set on a hit.
+ * @param id Fragment identification.
+ * @param now Packet timestamp in milliseconds.
+ * @return True if the first fragment was found, false otherwise.
+ */
+bool lookup_fragment(const FragmentCache &cache, FlowID &key, uint32_t id, uint64_t now);
+
+/**
+ * @brief Function for walking the IPv6 extension header chain up to the transport header.
+ * @param header First header after the fixed IPv6 header.
+ * @param packet_end End of the captured data.
+ * @param prot_num Next Header of the fixed header, set to the transport protocol.
+ * @param fragment Set if a Fragment header is found.
+ * @return Start of the transport header (or of the fragment data), nullptr if the chain is truncated or too long.
+ */
+const u_char *parse_ipv6_extensions(const u_char *header, const u_char *packet_end, uint16_t &prot_num, FragmentInfo &fragment);
+
+/**
+ * @brief Function for extracting the flow key of a separate packet, later fragments take the ports of their first one.
+ * @tparam L Link-layer header of the packet.
+ * @param args Worker which captured the packet, it counts packets which can't be parsed.
+ * @param header Pcap packet header.
+ * @param packet Packet data.
+ * @param key Set to FlowID of the packet (src->dst).
+ * @param total_len Set to the IP length of the packet.
+ * @return True if the packet is counted, false if it is truncated or unsupported.
+ */
+template <LinkType L = LinkType::ETHERNET>
+bool parse_packet(u_char *args, const struct pcap_pkthdr *header, const u_char *packet, FlowID &key, uint16_t &total_len);
+
 /**
  * @brief Function for handling separate packets.
- * @param args Argument.
+ * @tparam L Link-layer header of the packets.
+ * @param args Worker which captured the packet.
  * @param header Pcap packet header.
  * @param packet Packet data.
  */
+template <LinkType L = LinkType::ETHERNET>
 void packet_handler(u_char *args, const struct pcap_pkthdr *header, const u_char *packet);
 
+/**
+ * @brief Function for parsing a packet into the worker's batch, for backends which reuse their buffer after the callback.
+ * @tparam L Link-layer header of the packets.
+ * @param args Worker which captured the packet.
+ * @param header Pcap packet header.
+ * @param packet Packet data.
+ */
+template <LinkType L = LinkType::ETHERNET>
+void batch_handler(u_char *args, const struct pcap_pkthdr *header, const u_char *packet);
+
+/**
+ * @brief Function for counting the packets of the worker's batch whose keys were parsed on arrival, the batch is emptied.
+ * @param args Worker owning the batch.
+ */
+void count_batch(u_char *args);
+
+/**
+ * @brief Function for parsing the frames of the worker's batch in place and counting them, the batch is emptied.
+ * @tparam L Link-layer header of the packets.
+ * @param args Worker owning the batch.
+ */
+template <LinkType L = LinkType::ETHERNET>
+void flush_batch(u_char *args);
+
+/**
+ * @brief Parsing functions instantiated for one link type.
+ */
+struct LinkHandlers {
+    pcap_handler packet = packet_handler<>;     // Parses a single packet
+    pcap_handler batch = batch_handler<>;       // Parses a packet into the batch, counted by count_batch
+    void (*flush)(u_char *) = flush_batch<>;    // Parses and counts a batch of frames referenced in place
+};
+
+/**
+ * @brief Function for selecting the parsing functions of a link type.
+ * @param link Link-layer header of the capture.
+ * @return Functions instantiated for the link type.
+ */
+LinkHandlers link_handlers(LinkType link);
+
 /**
  * @brief Function for parsing IPv4 packet fields.
  * @param ip_header Pointer to the IPv4 header.
- * @param src_ip Source IP address as a string.
- * @param dst_ip Destination IP address as a string.
+ * @param src_ip Source IP address in binary form (16 bytes, zero padded).
+ * @param dst_ip Destination IP address in binary form (16 bytes, zero padded).
  * @param prot_num Protocol number.
  * @param total_len Total length of the packet.
  */
-void parse_L3_ipv4(const struct ip *ip_header, std::string &src_ip, std::string &dst_ip, uint16_t &prot_num, uint16_t &total_len);
+void parse_L3_ipv4(const struct ip *ip_header, uint8_t *src_ip, uint8_t *dst_ip, uint16_t &prot_num, uint16_t &total_len);
 
 /**
  * @brief Function for parsing IPv6 packet fields.
  * @param ip6_header Pointer to the IPv6 header.
- * @param src_ip Source IP address as a string.
- * @param dst_ip Destination IP address as a string.
+ * @param src_ip Source IP address in binary form (16 bytes).
+ * @param dst_ip Destination IP address in binary form (16 bytes).
  * @param prot_num Protocol number.
  * @param total_len Total length of the packet.
  */
-void parse_L3_ipv6(const struct ip6_hdr *ip6_header, std::string &src_ip, std::string &dst_ip, uint16_t &prot_num, uint16_t &total_len);
+void parse_L3_ipv6(const struct ip6_hdr *ip6_header, uint8_t *src_ip, uint8_t *dst_ip, uint16_t &prot_num, uint16_t &total_len);
 
 /**
  * @brief Function for parsing L4 protocol fields.
  * @param prot_num Protocol number.
  * @param transport_header Pointer to the transport layer header.
- * @param proto_str Protocol name.
  * @param src_port Source port.
  * @param dst_port Destination port.
+ * @return True if the protocol is supported, false otherwise.
+ */
+bool parse_L4(uint16_t prot_num, const u_char *transport_header, uint16_t &src_port, uint16_t &dst_port);
+
+/**
+ * @brief Function for checking whether flows of a transport protocol are tracked.
+ * @param prot_num Protocol number.
+ * @return True for TCP, UDP, ICMP and ICMPv6.
+ */
+bool supported_L4(uint16_t prot_num);
+
+/**
+ * @brief Function for building the final filter expression.
+ * @param user_filter Filter expression given by the user, may be empty.
+ * @param link Link-layer header of the capture, VLAN tags only exist on Ethernet.
+ * @return Default filter combined with the user's one.
+ */
+std::string build_filter(const std::string &user_filter, LinkType link);
+
+/**
+ * @brief Function for compiling the filter and installing it on the opened capture backend.
+ * @param handle Pcap handle, nullptr when the ring is used.
+ * @param ring Ring used when there is no pcap handle.
+ * @param expression Filter expression.
+ * @param errbuf Buffer for the error message.
+ * @return True on success, false otherwise.
  */
-void parse_L4(uint16_t prot_num, const u_char *transport_header, std::string &proto_str, std::string &src_port, std::string &dst_port);
+bool apply_filter(pcap_t *handle, Ring &ring, const std::string &expression, char *errbuf);
 
 #endif // CAPTURE_H
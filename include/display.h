@@ -4,35 +4,244 @@
 #define DISPLAY_H
 
 #include "flow.h"
+#include "stats.h"
+#include <atomic>
+#include <cstdint>
 #include <vector>
 
 /**
- * @brief Function for displaying the collected statistics using ncurses.
+ * @brief Reference to a flow of a worker's snapshot, sorting moves only these pointers.
  */
-void display_statistics();
+using FlowRef = const std::pair<FlowID, FlowStats> *;
+
+/**
+ * @brief Set by the main thread on SIGWINCH, the render thread resizes the screen.
+ */
+extern std::atomic<bool> resize_pending;
+
+/**
+ * @brief Set when the last interval has to be drawn again, e.g. after the view changed.
+ */
+extern std::atomic<bool> redraw_pending;
+
+/**
+ * @brief Displayed interface as an index into interfaces, -1 for all interfaces merged.
+ */
+extern std::atomic<int> view_interface;
+
+/**
+ * @brief Displayed aggregation level, an Aggregation value.
+ */
+extern std::atomic<int> view_aggregation;
+
+/**
+ * @brief Keys the rows can be sorted by, the s key cycles through them.
+ */
+enum SortKey {
+    SORT_BYTES,     // Shown byte rate, or bytes of the interval, of both directions
+    SORT_PACKETS,   // Packets of the interval of both directions
+    SORT_TX,        // Shown byte rate, or bytes of the interval, transmitted
+    SORT_RX,        // Shown byte rate, or bytes of the interval, received
+    SORT_PEAK,      // Highest 2 s average of both directions
+    SORT_KEYS
+};
+
+/**
+ * @brief Names of the sort keys shown on the screen.
+ */
+constexpr const char *SORT_NAMES[SORT_KEYS] = {"bytes", "packets", "tx", "rx", "peak"};
+
+/**
+ * @brief Key the rows are sorted by, a SortKey value.
+ */
+extern std::atomic<int> view_sort;
+
+/**
+ * @brief Number of rows shown at once, set by -n and changed by the + and - keys.
+ */
+extern std::atomic<size_t> view_count;
+
+/**
+ * @brief Names shown instead of numbers, a ResolveMode value set by --resolve and cycled by the n key.
+ */
+extern std::atomic<int> view_resolve;
+
+/**
+ * @brief Steps of Home and End, more intervals than any history holds.
+ */
+constexpr int HISTORY_JUMP = 1 << 30;
+
+/**
+ * @brief Function for drawing the interval on the screen again, wakes the render thread from any thread.
+ */
+void request_redraw();
+
+/**
+ * @brief Function for switching to the next interface view, the merged view follows the last interface.
+ */
+void switch_view();
+
+/**
+ * @brief Function for switching to the next aggregation level, the flows follow the last one.
+ */
+void switch_aggregation();
+
+/**
+ * @brief Function for scrolling through the logged intervals, stepping past the newest one returns to the live view.
+ * @param steps Intervals to step, negative towards older ones.
+ */
+void scroll_history(int steps);
+
+/**
+ * @brief Function for scrolling the list of flows, the position is clamped to the list when it is drawn.
+ * @param rows Rows to scroll, negative towards the top.
+ * @param pages Pages to scroll, negative towards the top.
+ */
+void scroll_list(int rows, int pages);
+
+/**
+ * @brief Function for switching to the next sort key, bytes follow the last one.
+ */
+void switch_sort();
+
+/**
+ * @brief Function for switching to the next resolve mode, numbers follow showing every name.
+ */
+void switch_resolve();
+
+/**
+ * @brief Function for showing one row more or less, steps start from the rows the screen has room for.
+ * @param delta Positive for one row more, negative for one less.
+ */
+void change_rows(int delta);
+
+/**
+ * @brief Function for stopping or resuming the refresh of the screen, capture and logging go on meanwhile.
+ */
+void toggle_pause();
+
+/**
+ * @brief Function for holding the interval on the screen or returning to the live one, the held one can still be sorted and filtered.
+ */
+void toggle_freeze();
+
+/**
+ * @brief Function for telling whether keys are being typed into the filter.
+ * @return True while the filter is edited.
+ */
+bool editing_filter();
+
+/**
+ * @brief Function for starting to type a filter, the previous one is shown for editing.
+ */
+void start_filter();
+
+/**
+ * @brief Function for editing the filter, Enter applies it, Esc drops the changes, an empty filter shows every row.
+ * @param key Key typed.
+ */
+void edit_filter(char key);
+
+/**
+ * @brief Function run by the render thread, draws every interval all workers have published.
+ */
+void render_loop();
+
+/**
+ * @brief Function for starting the render thread.
+ */
+void start_render();
+
+/**
+ * @brief Function for stopping the render thread.
+ */
+void stop_render();
+
+/**
+ * @brief Function for displaying the collected statistics using ncurses, or writing them out in headless mode.
+ * @param epoch Interval whose snapshots are displayed.
+ */
+void display_statistics(uint32_t epoch);
+
+/**
+ * @brief Function for displaying an interval read back from the history.
+ * @param index Interval index in the history.
+ * @param count Number of intervals in the history.
+ */
+void display_history(size_t index, size_t count);
 
 /**
  * @brief Function for printing the header of the statistics table.
+ * @param level Aggregation level of the rows.
  */
-void display_header();
+void display_header(Aggregation level);
 
 /**
  * @brief Function for displaying the startup message.
  */
 void display_startup();
 
+/**
+ * @brief Function for getting the byte rate of one direction of a flow.
+ * @param stats FlowStats.
+ * @param tx Whether the transmit direction is wanted, receive otherwise.
+ * @param metric Window of the rate, RATE_METRICS for the refresh interval.
+ * @return Bytes per second.
+ */
+double byte_rate(const FlowStats &stats, bool tx, RateMetric metric);
+
 /**
  * @brief Function for printing a single flow's statistics.
  * @param key FlowID.
  * @param stats FlowStats.
+ * @param level Aggregation level of the key, merged fields are printed as wildcards.
+ * @param row Current row in the display.
+ */
+void display_flow(const FlowID &key, const FlowStats &stats, Aggregation level, int &row);
+
+/**
+ * @brief Function for printing packet rates of capture workers, shows skew of the fanout.
+ * @param epoch Interval whose snapshots are displayed.
+ * @param row Current row in the display.
+ */
+void display_workers(uint32_t epoch, int &row);
+
+/**
+ * @brief Function for summing the instrumentation of the displayed workers and the render thread.
+ * @param epoch Interval whose snapshots are summed.
+ * @return Instrumentation of the interval, the render thread's timings are reset.
+ */
+IntervalStats collect_stats(uint32_t epoch);
+
+/**
+ * @brief Function for printing the aggregation level of the rows and the part of the list on the screen.
+ * @param level Aggregation level of the rows.
+ * @param groups Number of flows or groups of the interval.
+ * @param first Rank of the first row shown.
+ * @param shown Number of rows shown.
+ * @param row Current row in the display.
+ */
+void display_aggregation(Aggregation level, size_t groups, size_t first, size_t shown, int &row);
+
+/**
+ * @brief Function for printing the status lines, they tell whether the displayed numbers are complete.
+ * @param stats Instrumentation of the interval.
+ * @param row Current row in the display.
+ */
+void display_status(const IntervalStats &stats, int &row);
+
+/**
+ * @brief Function for printing the sort key, the row count, the filter and the state of the screen with their keys.
  * @param row Current row in the display.
  */
-void display_flow(const FlowID &key, const FlowStats &stats, int &row);
+void display_view(int &row);
 
 /**
- * @brief Function to sort flows based on the chosen sort order.
- * @param vec Vector of flow entries to sort.
+ * @brief Function to select and sort the flows of the given ranks based on the chosen sort key.
+ * @param vec Vector of references to flow entries.
+ * @param first Rank of the first flow to place, those before it end up in front of it unordered.
+ * @param count Number of flows to place sorted from first on, the rest stays unordered.
  */
-void sort_flows(std::vector<std::pair<FlowID, FlowStats>> &vec);
+void sort_flows(std::vector<FlowRef> &vec, size_t first, size_t count);
 
 #endif // DISPLAY_H
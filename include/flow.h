@@ -3,29 +3,41 @@
 #ifndef FLOW_H
 #define FLOW_H
 
+#include <cstdint>
 #include <string>
-#include <map>
-#include <tuple>
+#include <vector>
 #include <pcap.h>
 
+#include "rate.h"
+#include "wheel.h"
+
 /**
- * @brief ID of a network connection.
+ * @brief ID of a network connection in packed binary form.
  */
 struct FlowID {
-    std::string ip1;   // First IP address
-    std::string ip2;   // Second IP address
-    std::string port1; // Port associated with ip1
-    std::string port2; // Port associated with ip2
-    std::string proto; // Protocol used
+    uint8_t ip1[16];   // First IP address (IPv4 occupies the first 4 bytes, rest is zero)
+    uint8_t ip2[16];   // Second IP address
+    uint16_t port1;    // Port associated with ip1 (host byte order, 0 for ICMP)
+    uint16_t port2;    // Port associated with ip2
+    uint8_t family;    // Address family (AF_INET/AF_INET6)
+    uint8_t proto;     // IP protocol number
+    uint16_t ingress;  // Index of the interface the flow was captured on
 
     /**
-     * @brief Custom comparison operator for custom FlowID.
+     * @brief Comparison operator for custom FlowID.
      * @param other Another FlowID to compare with.
-     * @return True if this FlowID is less than other, false otherwise.
+     * @return True if both FlowIDs are identical, false otherwise.
      */
-    bool operator<(const FlowID &other) const;
+    bool operator==(const FlowID &other) const;
 };
 
+/**
+ * @brief Function for computing a direction-normalized hash of a flow.
+ * @param key FlowID to hash.
+ * @return Hash value, identical for both directions of the connection.
+ */
+uint32_t flow_hash(const FlowID &key);
+
 /**
  * @brief Structure to hold statistics for each connection throughout the duration of one interval.
  */
@@ -34,36 +46,473 @@ struct FlowStats {
     uint64_t B_rx = 0; // Bytes received
     uint64_t p_tx = 0; // Packets transmitted
     uint64_t p_rx = 0; // Packets received
+    uint64_t error = 0; // Sketch mode only, traffic of the ranking metric possibly missed before the flow was counted
+    RateSummary rates;  // Window rates, filled when the interval is published
+};
+
+/**
+ * @brief Levels flows are grouped by, every level but the flow itself is kept as a rollup table.
+ */
+enum Aggregation {
+    AGGREGATE_FLOW,     // 5-tuple, no grouping
+    AGGREGATE_PAIR,     // Both hosts, ports and protocols merged
+    AGGREGATE_HOST,     // Host that transmitted first, its peers merged
+    AGGREGATE_PREFIX,   // Network prefix of the host that transmitted first
+    AGGREGATE_PORT,     // Protocol and port of the side that answered, the service
+    AGGREGATE_PROTO,    // Protocol
+    AGGREGATIONS
+};
+
+/**
+ * @brief Names of the aggregation levels, as given by --aggregate and used in the headless output.
+ */
+constexpr const char *AGGREGATION_NAMES[AGGREGATIONS] = {"flow", "pair", "host", "prefix", "port", "proto"};
+
+/**
+ * @brief Fields of a key kept at each aggregation level, the others are zeroed and shown as wildcards.
+ */
+enum AggregateField {
+    FIELD_SRC_IP = 1,
+    FIELD_SRC_PORT = 2,
+    FIELD_DST_IP = 4,
+    FIELD_DST_PORT = 8,
+    FIELD_PROTO = 16
+};
+constexpr unsigned AGGREGATION_FIELDS[AGGREGATIONS] = {
+    FIELD_SRC_IP | FIELD_SRC_PORT | FIELD_DST_IP | FIELD_DST_PORT | FIELD_PROTO,
+    FIELD_SRC_IP | FIELD_DST_IP,
+    FIELD_SRC_IP,
+    FIELD_SRC_IP,
+    FIELD_DST_PORT | FIELD_PROTO,
+    FIELD_PROTO
+};
+
+constexpr int ROLLUPS = AGGREGATIONS - 1;       // Rollup tables of a shard, level AGGREGATE_PAIR + i is table i
+constexpr uint32_t ROLLUP_NONE = UINT32_MAX;    // Flow not counted in a rollup whose table was full
+constexpr uint32_t ROLLUP_PORTS = 1 << 17;      // Records of the port rollup, enough for TCP and UDP
+constexpr uint32_t ROLLUP_PROTOS = 1 << 9;      // Records of the protocol rollup
+
+/**
+ * @brief Single record of the flow table, aligned to cache lines.
+ *
+ * Everything a packet reads or writes lies in the first two cache lines: the key, the current
+ * rate bucket, the rollup indices and the counters. The rate windows are kept by the shard in a
+ * separate array by record index, they are only visited when a bucket closes.
+ */
+struct alignas(64) FlowEntry {
+    FlowID key;            // Canonical flow identifier (lower endpoint first)
+    uint32_t hash = 0;     // Cached hash of the key
+    uint32_t epoch = 0;    // Interval the statistics belong to, they are stale in any other one
+    uint64_t last_seen = 0;// Time of the last packet in milliseconds
+    bool used = false;     // Whether the record holds a live flow
+    bool reversed = false; // Whether the first seen (tx) direction was ip2->ip1 of the canonical key
+    bool recent = false;   // Whether the record is listed in recent, in listed for a rollup record
+    uint8_t rollup_swapped = 0;     // Bit per rollup set when its transmit direction is the flow's receive one
+    RateBucket bucket;     // Current fine bucket of the rate windows
+    uint32_t rollups[ROLLUPS] = {}; // Records of the flow in the rollup tables, ROLLUP_NONE if a table was full
+    FlowStats stats;       // Flow statistics
+};
+
+/**
+ * @brief Open-addressing hash table of flows with a fixed capacity.
+ *
+ * Records live in a pool and are referenced from a power-of-two slot array probed
+ * linearly, so a record never moves while it is in the table. Erasing uses backward
+ * shift deletion, which keeps probe sequences short without tombstones. Slots carry the
+ * hash of their record, so a probe passing other keys stays within the slot array even
+ * when a full table makes the sequences long.
+ *
+ * The pool and the slot array are allocated once for the whole capacity, the table never
+ * grows, so its memory is bounded no matter how many flows the traffic creates.
+ */
+class FlowTable {
+public:
+    FlowTable();
+
+    /**
+     * @brief Function for allocating the table for a fixed number of flows, drops all flows.
+     * @param capacity Maximum number of flows.
+     */
+    void reserve(uint32_t capacity);
+
+    /**
+     * @brief Function for removing all flows, keeps the allocated memory.
+     */
+    void clear();
+
+    /**
+     * @brief Function for finding a flow and inserting it with empty statistics if missing.
+     * @param key FlowID to look for.
+     * @param inserted Set to true if the flow was not in the table.
+     * @return Pointer to the flow record, nullptr if the flow is missing and the table is full.
+     */
+    FlowEntry *insert(const FlowID &key, bool &inserted) { return insert(key, flow_hash(key), inserted); }
+
+    /**
+     * @brief Function for finding a flow with an already computed hash and inserting it with empty statistics if missing.
+     * @param key FlowID to look for.
+     * @param hash flow_hash of the key.
+     * @param inserted Set to true if the flow was not in the table.
+     * @return Pointer to the flow record, nullptr if the flow is missing and the table is full.
+     */
+    FlowEntry *insert(const FlowID &key, uint32_t hash, bool &inserted);
+
+    /**
+     * @brief Function for removing a flow record.
+     * @param index Index of the record in the pool.
+     */
+    void erase(uint32_t index);
+
+    /**
+     * @brief Function for prefetching the home slot of a key, the first step of a batched lookup.
+     * @param hash Hash of the key.
+     */
+    void prefetch_slot(uint32_t hash) const { __builtin_prefetch(&slots[hash & mask]); }
+
+    /**
+     * @brief Function for prefetching the record in the home slot of a key, once the slot is cached.
+     * @param hash Hash of the key.
+     */
+    void prefetch_entry(uint32_t hash) const {
+        uint32_t index = slots[hash & mask].index;
+        if (index != EMPTY) __builtin_prefetch(&pool[index]);
+    }
+
+    /**
+     * @brief Function for prefetching the fields of a record a packet updates.
+     * @param index Index of the record in the pool.
+     */
+    void prefetch_record(uint32_t index) const {
+        __builtin_prefetch(&pool[index], 1);
+        __builtin_prefetch(&pool[index].stats.p_rx, 1);
+    }
+
+    /**
+     * @brief Function for getting the number of flows in the table.
+     * @return Number of flows.
+     */
+    size_t size() const { return count; }
+
+    /**
+     * @brief Function for getting the maximum number of flows.
+     * @return Capacity of the table.
+     */
+    size_t capacity() const { return limit; }
+
+    /**
+     * @brief Function for accessing the record pool, unused records have used set to false.
+     * @return Vector of flow records.
+     */
+    std::vector<FlowEntry> &entries() { return pool; }
+
+    /**
+     * @brief Function for getting the pool index of a record.
+     * @param entry Record of this table.
+     * @return Index of the record.
+     */
+    uint32_t index_of(const FlowEntry &entry) const { return static_cast<uint32_t>(&entry - pool.data()); }
+
+private:
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+
+    /**
+     * @brief Slot of the probed array, the hash is kept next to the index so probes only read
+     *        records whose hash matches.
+     */
+    struct Slot {
+        uint32_t index = EMPTY;     // Index into pool, EMPTY for a free slot
+        uint32_t hash = 0;          // Hash of the record's key
+    };
+
+    std::vector<Slot> slots;        // Probed linearly from the home slot of a hash
+    std::vector<FlowEntry> pool;    // Flow records
+    std::vector<uint32_t> free_ids; // Unused records in pool
+    size_t count = 0;               // Number of live flows
+    size_t limit = 0;               // Maximum number of live flows
+    uint32_t mask = 0;              // slots.size() - 1
+
+    uint32_t find_slot(const FlowID &key, uint32_t hash) const;
+};
+
+/**
+ * @brief Space-Saving sketch of the heaviest flows of one interval.
+ *
+ * A fixed number of counters is monitored. A flow without a counter takes over the one with
+ * the lowest count and inherits that count as its error, so a flow's true traffic lies between
+ * its counted statistics and the statistics plus the error, and every flow heavier than the
+ * lowest count is guaranteed to be monitored. A min-heap over the counts finds the counter to
+ * replace in O(1) and keeps updates O(log n).
+ */
+class SpaceSaving {
+public:
+    /**
+     * @brief Function for allocating a fixed number of counters, drops all flows.
+     * @param capacity Number of counters.
+     * @param by_bytes Whether flows are ranked by bytes, by packets otherwise.
+     */
+    void reserve(uint32_t capacity, bool by_bytes);
+
+    /**
+     * @brief Function for removing all flows, keeps the allocated memory.
+     */
+    void clear();
+
+    /**
+     * @brief Function for counting a packet of a flow.
+     * @param key Canonical FlowID.
+     * @param swapped Whether the packet goes ip2->ip1 of the canonical key.
+     * @param total_len Total length of the packet.
+     * @return Counter of the flow.
+     */
+    const FlowEntry &update(const FlowID &key, bool swapped, uint16_t total_len);
+
+    /**
+     * @brief Function for accessing the counters, unused records have used set to false.
+     * @return Vector of flow records, stats.error holds the error bound.
+     */
+    std::vector<FlowEntry> &entries() { return table.entries(); }
+
+    /**
+     * @brief Function for getting the number of packets which were not monitored when they arrived.
+     * @return Number of counters taken or replaced since the last clear.
+     */
+    uint64_t admissions() const { return admitted; }
+
+private:
+    FlowTable table;                // Monitored flows
+    std::vector<uint32_t> heap;     // Record indices, min-heap by count
+    std::vector<uint32_t> position; // Heap position of each record
+    std::vector<uint64_t> counts;   // Counted traffic plus inherited error of each record
+    uint64_t admitted = 0;          // Counters taken or replaced since the last clear
+    bool by_bytes = true;           // Ranking metric
+
+    void sift_down(uint32_t pos);
+    void sift_up(uint32_t pos);
+};
+
+/**
+ * @brief When the sketch is used instead of the exact table.
+ */
+enum class SketchMode {
+    OFF,  // Exact table only
+    ON,   // Sketch only
+    AUTO  // Sketch while the number of flows per interval exceeds a threshold
+};
+
+/**
+ * @brief Policy applied to a new flow when the table is full.
+ */
+enum class OverloadPolicy {
+    EVICT, // Evict the least recently seen of a few sampled flows
+    DROP   // Ignore packets of new flows and count them
+};
+
+/**
+ * @brief Secondary table summing the flows of a shard at one aggregation level.
+ *
+ * A flow looks its rollup records up once when it is inserted and keeps their indices, so its
+ * packets update the rollups without hashing again. Packets only add to the counters of a record,
+ * rate windows add up, so the rates of a record are summed from the windows of its flows when an
+ * interval is published. A record lives while flows refer to it, after the last one is removed it
+ * is listed in orphans and erased once it is no longer part of the current interval. Packets
+ * counted by the sketch have no flow record, their rollups are looked up per packet and start as
+ * orphans.
+ */
+struct Rollup {
+    FlowTable table;                // Records with the merged fields of their keys zeroed
+    std::vector<uint32_t> refs;     // Flows referring to each record
+    std::vector<RateSummary> rates; // Rates of each record summed at the last published interval, the peak kept since it appeared
+    std::vector<uint32_t> active;   // Records updated in the current interval
+    std::vector<uint32_t> listed;   // Records published with the interval, the active ones and those of flows with rates
+    std::vector<uint32_t> orphans;  // Records no flow refers to, a record may be listed more than once
 };
 
 /**
- * @brief Global map to store data flows and their stats.
+ * @brief Flow table together with its aging and interval state.
+ *
+ * Statistics are reset lazily: a record stamped with an older epoch is zeroed on its next
+ * packet, and records touched in the current interval are listed in active. Idle flows are
+ * expired by a timer wheel, which only re-checks a flow once per idle timeout.
+ *
+ * A record index stays listed in active for the rest of the interval even if its flow is
+ * evicted, the record reusing the index keeps the epoch stamp so it is not listed twice.
+ * Flows whose rate windows are not empty yet are listed in recent, quiet ones included, so
+ * their rates keep decaying without visiting the whole table.
  */
-extern std::map<FlowID, FlowStats> flows;
+struct FlowShard {
+    FlowTable table;                    // Flows of the shard
+    std::vector<FlowRates> rates;       // Rate windows of the flows by record index, grown with the pool
+    TimerWheel wheel{1000};             // Idle expiry of flows, one second resolution
+    std::vector<uint32_t> active;       // Records updated in the current interval
+    std::vector<uint32_t> recent;       // Records with traffic within RATE_WINDOW_MS, listed once
+    uint32_t epoch = 1;                 // Current interval
+    uint64_t idle_timeout = 30000;      // Time without packets after which a flow is removed, in milliseconds
+    OverloadPolicy policy = OverloadPolicy::EVICT; // What happens to a new flow when the table is full
+    uint32_t evict_cursor = 0;          // Pool index where the next eviction starts sampling
+    uint64_t evicted = 0;               // Flows evicted to make room, since the start
+    uint64_t dropped = 0;               // Packets of new flows dropped by a full table, since the start
+    SpaceSaving sketch;                 // Heavy hitters of the interval in sketch mode
+    SketchMode sketch_mode = SketchMode::OFF; // When the sketch replaces the table
+    bool sketching = false;             // Whether the current interval is counted by the sketch
+    size_t sketch_threshold = 0;        // Flows per interval switching to the sketch in automatic mode
+    Rollup rollups[ROLLUPS];            // Traffic of the shard grouped by every aggregation level
+    uint8_t prefix_v4 = 24;             // Prefix length of IPv4 hosts in the prefix rollup
+    uint8_t prefix_v6 = 64;             // Prefix length of IPv6 hosts in the prefix rollup
+};
 
 /**
- * @brief Function for checking if the connection exists in either direction and updating its statistics.
- * @param tx_key FlowID for transmitted data (ip1->ip2).
- * @param rx_key FlowID for received data (ip1<-ip2).
+ * @brief Memory of the rollups for one flow of the table capacity, the pair, host and prefix
+ *        rollups may need a record for every flow.
+ */
+constexpr size_t ROLLUP_RECORD_SIZE = 3 * (sizeof(FlowEntry) + sizeof(RateSummary) + 5 * sizeof(uint32_t) + 4 * sizeof(uint32_t));
+
+/**
+ * @brief Memory needed for one flow of the table capacity, including the hash slots, the timer,
+ *        the lists and the rollups of the shard.
+ */
+constexpr size_t FLOW_RECORD_SIZE = sizeof(FlowEntry) + sizeof(FlowRates) + 5 * sizeof(uint32_t) + TimerWheel::TIMER_SIZE + 3 * sizeof(uint32_t) + ROLLUP_RECORD_SIZE;
+
+/**
+ * @brief Function for preallocating a shard for a fixed number of flows.
+ * @param flows Shard of flows.
+ * @param capacity Maximum number of flows.
+ * @param idle_timeout Time without packets after which a flow is removed, in milliseconds.
+ * @param policy Policy applied when the shard is full.
+ * @param now Current time in milliseconds.
+ */
+void init_flow_shard(FlowShard &flows, uint32_t capacity, uint64_t idle_timeout, OverloadPolicy policy, uint64_t now);
+
+/**
+ * @brief Function for setting up the heavy-hitter sketch of a shard.
+ * @param flows Shard of flows.
+ * @param mode When the sketch replaces the table.
+ * @param counters Number of sketch counters.
+ * @param threshold Flows per interval switching to the sketch in automatic mode.
+ * @param by_bytes Whether flows are ranked by bytes, by packets otherwise.
+ */
+void init_flow_sketch(FlowShard &flows, SketchMode mode, uint32_t counters, size_t threshold, bool by_bytes);
+
+/**
+ * @brief Function for setting up the rollup tables of a shard.
+ * @param flows Shard of flows.
+ * @param capacity Maximum number of flows of the shard.
+ * @param prefix_v4 Prefix length of IPv4 hosts in the prefix rollup.
+ * @param prefix_v6 Prefix length of IPv6 hosts in the prefix rollup.
+ */
+void init_flow_rollups(FlowShard &flows, uint32_t capacity, uint8_t prefix_v4, uint8_t prefix_v6);
+
+/**
+ * @brief Function for getting the key of the rollup record a flow is counted in.
+ * @param key FlowID oriented in the flow's first seen direction.
+ * @param level Aggregation level, not AGGREGATE_FLOW.
+ * @param prefix_v4 Prefix length of IPv4 hosts for AGGREGATE_PREFIX.
+ * @param prefix_v6 Prefix length of IPv6 hosts for AGGREGATE_PREFIX.
+ * @param swapped Set to true if the record's transmit direction is the flow's receive one.
+ * @return FlowID with the merged fields zeroed.
+ */
+FlowID rollup_key(const FlowID &key, Aggregation level, uint8_t prefix_v4, uint8_t prefix_v6, bool &swapped);
+
+/**
+ * @brief Function for translating the name of an aggregation level.
+ * @param name Name given by --aggregate (flow/pair/host/prefix/port/proto).
+ * @return Level, AGGREGATIONS for an unknown name.
+ */
+Aggregation aggregation_level(const std::string &name);
+
+/**
+ * @brief Function for creating FlowID of the opposite direction.
+ * @param key FlowID to reverse.
+ * @return FlowID with swapped endpoints.
+ */
+FlowID reverse_flow(const FlowID &key);
+
+/**
+ * @brief Function for ordering the endpoints of a flow so that both directions share one key.
+ * @param key FlowID of the packet (src->dst).
+ * @param swapped Set to true if the endpoints had to be swapped.
+ * @return Canonical FlowID.
+ */
+FlowID canonical_flow(const FlowID &key, bool &swapped);
+
+/**
+ * @brief Function for getting FlowID of a record oriented in its first seen direction.
+ * @param entry Flow record.
+ * @return FlowID where ip1 is the side that transmitted first.
+ */
+FlowID oriented_flow(const FlowEntry &entry);
+
+/**
+ * @brief Function for adding a packet to the statistics of its flow.
+ * @param entry Flow record.
+ * @param swapped Whether the packet goes ip2->ip1 of the canonical key.
  * @param total_len Total length of the packet.
  */
-void update_flow_statistics(const FlowID &tx_key, const FlowID &rx_key, uint16_t total_len);
+void count_packet(FlowEntry &entry, bool swapped, uint16_t total_len);
+
+/**
+ * @brief Function for finding the connection with a single lookup and updating its statistics.
+ * @param flows Shard of flows.
+ * @param key FlowID of the packet (src->dst).
+ * @param total_len Total length of the packet.
+ * @param now Packet timestamp in milliseconds.
+ */
+void update_flow_statistics(FlowShard &flows, const FlowID &key, uint16_t total_len, uint64_t now);
+
+/**
+ * @brief Function for updating the statistics of a connection whose hash is already known.
+ * @param flows Shard of flows.
+ * @param key FlowID of the packet (src->dst).
+ * @param hash flow_hash of the key, the same for both directions.
+ * @param total_len Total length of the packet.
+ * @param now Packet timestamp in milliseconds.
+ */
+void update_flow_statistics(FlowShard &flows, const FlowID &key, uint32_t hash, uint16_t total_len, uint64_t now);
+
+/**
+ * @brief Function for resetting flow statistics by starting a new interval, records are zeroed on their next update.
+ * @param flows Shard of flows.
+ */
+void reset_flow_statistics(FlowShard &flows);
+
+/**
+ * @brief Function for closing the rate buckets of recent flows up to now, flows with empty windows are unlisted.
+ * @param flows Shard of flows.
+ * @param now Current time in milliseconds.
+ */
+void advance_flow_rates(FlowShard &flows, uint64_t now);
+
+/**
+ * @brief Function for starting to sum the rates of the rollups, lists the records active in the interval with zero rates.
+ * @param flows Shard of flows.
+ */
+void start_rollup_rates(FlowShard &flows);
+
+/**
+ * @brief Function for adding the rates of a published flow to its rollup records, listing them.
+ * @param flows Shard of flows.
+ * @param index Index of the flow record.
+ * @param rates Rates of the flow in its first seen direction.
+ */
+void add_rollup_rates(FlowShard &flows, uint32_t index, const RateSummary &rates);
 
 /**
- * @brief Function for checking if the flow is not active.
- * @param stats Flow statistics.
- * @return True if the flow is not active, false otherwise.
+ * @brief Function for finishing the rates of the listed rollup records, their peaks are raised to the summed 2 s rates.
+ * @param flows Shard of flows.
+ * @param seconds Length of the interval, the rates of a sketched interval are those of its counters.
  */
-bool flow_not_active(const FlowStats &stats);
+void finish_rollup_rates(FlowShard &flows, double seconds);
 
 /**
- * @brief Function for resetting flow statistics.
+ * @brief Function for evicting the least recently seen of a few sampled flows.
+ * @param flows Shard of flows, must not be empty.
  */
-void reset_flow_statistics();
+void evict_flow(FlowShard &flows);
 
 /**
- * @brief Function for deleting inactive connections.
+ * @brief Function for deleting connections idle for longer than the idle timeout, rollups left without flows go once quiet.
+ * @param flows Shard of flows.
+ * @param now Current time in milliseconds.
  */
-void trim_flows();
+void trim_flows(FlowShard &flows, uint64_t now);
 
 #endif // FLOW_H
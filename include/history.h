@@ -0,0 +1,94 @@
+// Aurel Strigáč <xstrig00>
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "flow.h"
+
+/**
+ * @brief On-disk layout of the history log, native byte order, every block starts 8-byte aligned.
+ *
+ * The file starts with a HistoryFileHeader followed by one block per interval. A block is a
+ * HistoryBlockHeader, the flow keys first seen in it (they get the next dictionary IDs), and
+ * the columns: bytes rx, bytes tx (uint64_t), dictionary ID, packets rx, packets tx (uint32_t).
+ * Each file has its own dictionary, so a rotated file is readable on its own.
+ */
+constexpr char HISTORY_MAGIC[8] = {'N', 'T', 'H', 'I', 'S', 'T', '\0', '\1'};
+constexpr uint32_t HISTORY_BLOCK_MAGIC = 0x5649544e; // "NTIV"
+constexpr size_t HISTORY_INTERFACES_LEN = 256;
+constexpr size_t HISTORY_DEFAULT_SIZE = 64 << 20;
+constexpr size_t HISTORY_FLOW_SIZE = 2 * sizeof(uint64_t) + 3 * sizeof(uint32_t); // Column bytes of one flow
+
+/**
+ * @brief Header at the start of every history file.
+ */
+struct HistoryFileHeader {
+    char magic[8];                              // HISTORY_MAGIC
+    uint32_t interval_ms;                       // Refresh interval of the logged intervals
+    uint32_t reserved;
+    char interfaces[HISTORY_INTERFACES_LEN];    // Interfaces as given by -i, flows refer to them by index
+};
+
+/**
+ * @brief Header of the block of one interval.
+ */
+struct HistoryBlockHeader {
+    uint32_t magic;         // HISTORY_BLOCK_MAGIC
+    uint32_t epoch;         // Interval number of the session
+    uint64_t time_ms;       // End of the interval
+    uint32_t new_keys;      // Dictionary entries added by this block
+    uint32_t flows;         // Flows of the interval
+    uint64_t size;          // Size of the whole block including padding
+};
+
+/**
+ * @brief Function for creating the history log, an existing file is replaced.
+ * @param path Path of the log, the previous file is kept as path.1 on rotation.
+ * @param max_size Size after which the log is rotated.
+ * @param errbuf Buffer for the error message.
+ * @return True on success, false otherwise.
+ */
+bool open_history(const std::string &path, size_t max_size, char *errbuf);
+
+/**
+ * @brief Function for appending the flows of all workers' published snapshots, nothing is done without a log.
+ * @param epoch Interval whose snapshots are logged, they must not be written meanwhile.
+ */
+void log_interval(uint32_t epoch);
+
+/**
+ * @brief Function for closing the history log.
+ */
+void close_history();
+
+/**
+ * @brief Function for opening a history log for reading only, the refresh interval and interfaces are taken from it.
+ * @param path Path of the log.
+ * @param errbuf Buffer for the error message.
+ * @return True on success, false otherwise.
+ */
+bool open_playback(const std::string &path, char *errbuf);
+
+/**
+ * @brief Function for counting the intervals in the log, blocks appended since the last call are indexed.
+ * @return Number of complete intervals.
+ */
+size_t history_count();
+
+/**
+ * @brief Function for reading one interval of the log through its memory mapping.
+ * @param index Interval index, 0 is the oldest one of the file.
+ * @param epoch Set to the interval number.
+ * @param time_ms Set to the end of the interval.
+ * @param flows Filled with the flows of the interval.
+ * @return True on success, false if the interval doesn't exist.
+ */
+bool read_history(size_t index, uint32_t &epoch, uint64_t &time_ms, std::vector<std::pair<FlowID, FlowStats>> &flows);
+
+#endif // HISTORY_H
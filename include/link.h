@@ -0,0 +1,90 @@
+// Aurel Strigáč <xstrig00>
+
+#ifndef LINK_H
+#define LINK_H
+
+#include <pcap.h>
+#include <cstdint>
+#include <net/ethernet.h>
+
+/**
+ * @brief Link-layer headers net-top can decode, selected once when the capture is opened.
+ */
+enum class LinkType {
+    ETHERNET,  // DLT_EN10MB, Ethernet with optional VLAN tags
+    SLL,       // DLT_LINUX_SLL, cooked header of the "any" device
+    SLL2,      // DLT_LINUX_SLL2, cooked header version 2
+    RAW,       // DLT_RAW/DLT_IPV4/DLT_IPV6, bare IP packets of tun/wireguard devices and ring sockets without link headers
+    NULL_LOOP  // DLT_NULL/DLT_LOOP, 4-byte address family of loopback captures
+};
+
+/**
+ * @brief Lengths of the link-layer headers.
+ */
+constexpr int ETHERNET_HEADER_LEN = 14;
+constexpr int SLL_HEADER_LEN = 16;
+constexpr int SLL2_HEADER_LEN = 20;
+constexpr int NULL_HEADER_LEN = 4;
+constexpr int MAX_LINK_HEADER_LEN = SLL2_HEADER_LEN;
+constexpr int VLAN_TAG_LEN = 4;
+constexpr int MAX_VLAN_TAGS = 2;
+
+/**
+ * @brief Function for mapping a pcap data link type to a decoder.
+ * @param dlt Value returned by pcap_datalink.
+ * @param link Set to the decoder of the link type.
+ * @return True if the link type is supported, false otherwise.
+ */
+bool link_type_from_dlt(int dlt, LinkType &link);
+
+/**
+ * @brief Function for getting the pcap data link type of a decoder, used for compiling filters.
+ * @param link Decoder.
+ * @return DLT_* value.
+ */
+int link_type_dlt(LinkType link);
+
+/**
+ * @brief Function for skipping 802.1Q and 802.1ad tags in front of the L3 header.
+ * @param l3_header First byte after the ethertype of the link header.
+ * @param packet_end End of the captured data.
+ * @param eth_type Ethertype of the link header, set to the ethertype of the payload.
+ * @return Start of the L3 header, nullptr if the frame is truncated or has too many tags.
+ */
+inline const u_char *skip_vlan_tags(const u_char *l3_header, const u_char *packet_end, uint16_t &eth_type) {
+    // Each tag is the TCI followed by the ethertype of what comes next
+    for (int tags = 0; eth_type == ETHERTYPE_VLAN || eth_type == 0x88a8 || eth_type == 0x9100; tags++) {
+        if (tags == MAX_VLAN_TAGS || l3_header + VLAN_TAG_LEN > packet_end) return nullptr;
+        eth_type = static_cast<uint16_t>(l3_header[2] << 8 | l3_header[3]);
+        l3_header += VLAN_TAG_LEN;
+    }
+    return l3_header;
+}
+
+/**
+ * @brief Function for decoding the link-layer header, instantiated per link type so no decision is made per packet.
+ * @param packet Start of the captured data.
+ * @param packet_end End of the captured data.
+ * @param eth_type Set to the ethertype of the L3 header, ETHERTYPE_IP or ETHERTYPE_IPV6 for links without one.
+ * @return Start of the L3 header, nullptr if the packet is truncated.
+ */
+template <LinkType L>
+inline const u_char *parse_link(const u_char *packet, const u_char *packet_end, uint16_t &eth_type) {
+    if constexpr (L == LinkType::RAW || L == LinkType::NULL_LOOP) {
+        // No ethertype, the IP version tells IPv4 and IPv6 apart regardless of the address family encoding
+        const u_char *l3_header = packet + (L == LinkType::NULL_LOOP ? NULL_HEADER_LEN : 0);
+        if (l3_header + 1 > packet_end) return nullptr;
+        uint8_t version = l3_header[0] >> 4;
+        eth_type = version == 4 ? ETHERTYPE_IP : version == 6 ? ETHERTYPE_IPV6 : 0;
+        return l3_header;
+    } else {
+        // Ethertype is the last field of Ethernet and SLL, the first one of SLL2
+        constexpr int header_len = L == LinkType::ETHERNET ? ETHERNET_HEADER_LEN : L == LinkType::SLL ? SLL_HEADER_LEN : SLL2_HEADER_LEN;
+        constexpr int type_offset = L == LinkType::SLL2 ? 0 : header_len - 2;
+        if (packet + header_len > packet_end) return nullptr;
+        eth_type = static_cast<uint16_t>(packet[type_offset] << 8 | packet[type_offset + 1]);
+        return skip_vlan_tags(packet + header_len, packet_end, eth_type);
+    }
+}
+
+#endif // LINK_H
@@ -4,21 +4,71 @@
 #define NET_TOP_H
 
 #include <string>
+#include <vector>
 #include <pcap.h>
 
 /**
  * @brief Global variables.
  */
 extern char sort_order;          // Sorting order: 'b' for bytes, 'p' for packets
-extern int refresh_interval;     // Output update interval in seconds
-extern std::string interface;    // Network interface to capture packets from
-extern pcap_t *handle;           // Pcap handle for packet capturing
+extern int refresh_ms;           // Output update interval in milliseconds
+extern std::string rate_mode;    // Rate shown as b/s: "interval", "2s", "10s", "40s", "ewma" or "peak"
+extern size_t top_count;         // Number of displayed flows
+extern std::string aggregation;  // Initial aggregation level: "flow", "pair", "host", "prefix", "port" or "proto"
+extern int prefix_v4;            // Prefix length of IPv4 hosts in the prefix aggregation
+extern int prefix_v6;            // Prefix length of IPv6 hosts in the prefix aggregation
+extern std::string resolve;      // Names shown at start: "off", "hosts", "services" or "all"
+extern unsigned resolve_threads; // Number of resolver threads
+extern int idle_timeout;         // Seconds without packets after which a flow is forgotten
+extern size_t max_flows;         // Maximum number of tracked flows over all workers
+extern size_t max_mem;           // Memory limit of the flow tables in bytes, 0 for none
+extern std::string overload_policy; // Policy for new flows when the table is full: "evict" or "drop"
+extern std::string sketch_mode;  // Heavy-hitter sketch: "off", "on" or "auto"
+extern size_t sketch_size;       // Number of sketch counters per worker
+extern size_t sketch_threshold;  // Flows per interval switching to the sketch in auto mode, 0 for half of max_flows
+extern std::string interface;    // Network interfaces to capture packets from as given by -i
+extern std::vector<std::string> interfaces; // Network interfaces to capture packets from
+extern std::string read_file;    // Capture file to replay instead of a live interface
+extern std::string replay_speed; // Replay speed: "max" as fast as possible, "realtime" following packet timestamps
+extern std::string filter_expr;  // User-supplied BPF filter expression
+extern std::string headless_format; // Headless output format: "ndjson" or "csv", empty for the ncurses screen
+extern std::string output_path;  // File the headless output is written to, empty for standard output
+extern std::string history_path; // File the flows of every interval are logged to, empty for none
+extern size_t history_max_size; // Size after which the history is rotated
+extern std::string playback_path; // History file browsed instead of capturing, empty for a capture
+extern std::string stats_path;   // File the instrumentation of every interval is written to, empty for none
+extern std::string backend;      // Capture backend: "ring" for TPACKET_V3 ring, "pcap" for libpcap
+extern unsigned ring_block_size; // Size of one ring block in bytes
+extern unsigned ring_block_count; // Number of ring blocks
+extern unsigned worker_count;    // Number of capture threads
 extern char errbuf[];            // Buffer for pcap error messages
 
 /**
- * @brief Function for handling the SIGINT signal.
- * @param sig Signal number.
+ * @brief Descriptors the main event loop waits on.
  */
-void signal_handler(int sig);
+struct EventFds {
+    int epoll_fd = -1;   // Epoll instance
+    int timer_fd = -1;   // Refresh interval timer
+    int signal_fd = -1;  // SIGINT and SIGWINCH
+    int input_fd = -1;   // Terminal keys, -1 if stdin can't be polled
+};
+
+/**
+ * @brief Function for stopping the capture workers and render thread and restoring the terminal.
+ */
+void cleanup();
+
+/**
+ * @brief Function for creating the descriptors the event loop waits on.
+ * @param events Descriptors to fill.
+ * @return True on success, false otherwise.
+ */
+bool setup_events(EventFds &events);
+
+/**
+ * @brief Function for processing timer ticks and signals until SIGINT arrives, packets are processed by workers.
+ * @param events Descriptors created by setup_events.
+ */
+void run_event_loop(const EventFds &events);
 
 #endif // NET_TOP_H
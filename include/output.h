@@ -0,0 +1,47 @@
+// Aurel Strigáč <xstrig00>
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "display.h"
+#include "flow.h"
+
+/**
+ * @brief Size of the headless output buffer, records of a live interval which don't fit are dropped.
+ */
+constexpr size_t OUTPUT_BUFFER_SIZE = 8 << 20;
+
+/**
+ * @brief Longest formatted record, two IPv6 addresses and all counters fit comfortably.
+ */
+constexpr size_t OUTPUT_RECORD_LEN = 1024;
+
+/**
+ * @brief Function for opening the headless output and writing the CSV header.
+ * @param path File to write to, empty or "-" for standard output.
+ * @param errbuf Buffer for the error message.
+ * @return True on success, false otherwise.
+ */
+bool open_output(const std::string &path, char *errbuf);
+
+/**
+ * @brief Function for streaming the selected flows of an interval, never blocks on a slow consumer of a live capture.
+ * @param epoch Interval the flows belong to.
+ * @param closed End of the interval in milliseconds.
+ * @param level Aggregation level of the flows, merged fields are left out.
+ * @param flows Merged flows, the first count of them are written.
+ * @param count Number of flows to write.
+ */
+void output_flows(uint32_t epoch, uint64_t closed, Aggregation level, const std::vector<FlowRef> &flows, size_t count);
+
+/**
+ * @brief Function for writing what is still buffered, waiting for the consumer, and restoring the descriptor.
+ */
+void close_output();
+
+#endif // OUTPUT_H
@@ -0,0 +1,131 @@
+// Aurel Strigáč <xstrig00>
+
+#ifndef RATE_H
+#define RATE_H
+
+#include <cstdint>
+#include <string>
+
+constexpr uint64_t RATE_BUCKET_MS = 250;    // Width of a fine bucket
+constexpr uint32_t RATE_BUCKETS = 8;        // Fine buckets of the 2 s window, also the buckets of one slot
+constexpr uint32_t RATE_SLOTS = 20;         // Slots of the 40 s window
+constexpr uint32_t RATE_SLOTS_10S = 5;      // Slots of the 10 s window
+constexpr double RATE_EWMA_MS = 5000;       // Time constant of the moving average
+constexpr uint64_t RATE_WINDOW_MS = RATE_BUCKET_MS * RATE_BUCKETS * (RATE_SLOTS + 2); // Quiet time after which every window is empty
+
+/**
+ * @brief Rates reported for every flow and direction.
+ */
+enum RateMetric {
+    RATE_2S,        // Sliding average of the last 2 s in fine buckets
+    RATE_10S,       // Average of the last 5 slots
+    RATE_40S,       // Average of the last 20 slots
+    RATE_EWMA,      // Exponentially weighted moving average over fine buckets
+    RATE_PEAK,      // Highest 2 s average since the flow appeared
+    RATE_METRICS
+};
+
+/**
+ * @brief Names of the rate metrics, as given by --rate and used in the headless output.
+ */
+constexpr const char *RATE_NAMES[RATE_METRICS] = {"2s", "10s", "40s", "ewma", "peak"};
+
+/**
+ * @brief Sliding windows of the bytes of one direction of a flow.
+ *
+ * Completed fine buckets enter a ring of the last 2 s, every slot boundary folds the ring into
+ * a ring of 2 s slots covering 40 s. The window sums are adjusted by the value entering and the
+ * one leaving, so closing a bucket is O(1) no matter how long the windows are. Slots are floats,
+ * sums of them are exact doubles, so adding and removing the same slot leaves no drift.
+ */
+struct RateWindow {
+    uint32_t buckets[RATE_BUCKETS] = {};    // Bytes of the last completed fine buckets
+    float slots[RATE_SLOTS] = {};           // Bytes of the last completed slots
+    uint64_t sum_2s = 0;                    // Bytes of buckets
+    double sum_10s = 0;                     // Bytes of the newest RATE_SLOTS_10S slots
+    double sum_40s = 0;                     // Bytes of slots
+    float ewma = 0;                         // Moving average in bytes per second
+    float peak = 0;                         // Highest 2 s average in bytes per second
+};
+
+/**
+ * @brief Current fine bucket of a flow, both directions share it.
+ *
+ * This is all a packet touches, it lives in the flow record next to the counters. The windows
+ * are kept apart and visited once per closed bucket.
+ */
+struct RateBucket {
+    uint32_t index = 0;         // Absolute index of the current fine bucket
+    uint32_t bytes[2] = {};     // Bytes of the current fine bucket, transmitted and received
+};
+
+/**
+ * @brief Rate windows of a flow, filled by closing its fine buckets.
+ */
+struct FlowRates {
+    RateWindow tx;              // Direction of the first packet
+    RateWindow rx;              // Opposite direction
+};
+
+/**
+ * @brief Rates of a flow in bytes per second, taken when the interval is published.
+ */
+struct RateSummary {
+    float tx[RATE_METRICS] = {};
+    float rx[RATE_METRICS] = {};
+};
+
+/**
+ * @brief Function for getting the absolute index of the fine bucket of a time.
+ * @param now Time in milliseconds.
+ * @return Bucket index.
+ */
+inline uint32_t rate_bucket(uint64_t now) {
+    return static_cast<uint32_t>(now / RATE_BUCKET_MS);
+}
+
+/**
+ * @brief Function for starting the rates of a new flow with empty windows.
+ * @param current Current bucket of the flow.
+ * @param rates Windows of the flow.
+ * @param now Time of the first packet in milliseconds.
+ */
+void reset_rates(RateBucket &current, FlowRates &rates, uint64_t now);
+
+/**
+ * @brief Function for closing the buckets before the given one, quiet buckets are closed empty.
+ * @param current Current bucket of the flow.
+ * @param rates Windows of the flow.
+ * @param bucket Index of the new current bucket.
+ */
+void advance_rates(RateBucket &current, FlowRates &rates, uint32_t bucket);
+
+/**
+ * @brief Function for adding a packet to the current bucket of its direction, the windows are only touched by a new bucket.
+ * @param current Current bucket of the flow.
+ * @param rates Windows of the flow.
+ * @param tx Whether the packet goes in the direction of the first one.
+ * @param total_len Total length of the packet.
+ * @param now Packet timestamp in milliseconds.
+ */
+inline void count_rate(RateBucket &current, FlowRates &rates, bool tx, uint16_t total_len, uint64_t now) {
+    uint32_t bucket = rate_bucket(now);
+    if (bucket != current.index) advance_rates(current, rates, bucket);
+    current.bytes[tx ? 0 : 1] += total_len;
+}
+
+/**
+ * @brief Function for reading the rates of a flow from its windows.
+ * @param rates Windows of the flow, advanced to the current bucket.
+ * @param summary Rates in bytes per second.
+ */
+void summarize_rates(const FlowRates &rates, RateSummary &summary);
+
+/**
+ * @brief Function for translating the name of a rate metric.
+ * @param name Name given by --rate (interval/2s/10s/40s/ewma/peak).
+ * @return Metric, RATE_METRICS for the counters of the refresh interval.
+ */
+RateMetric rate_metric(const std::string &name);
+
+#endif // RATE_H
@@ -0,0 +1,78 @@
+// Aurel Strigáč <xstrig00>
+
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+constexpr size_t RESOLVER_CACHE_SIZE = 4096;    // Names kept, the least recently shown one is dropped first
+constexpr size_t RESOLVER_QUEUE_SIZE = 256;     // Lookups waiting for a thread, further requests are retried with the next frame
+constexpr uint64_t RESOLVER_TTL_MS = 300000;    // Age after which a found name is looked up again, the old one is shown meanwhile
+constexpr uint64_t RESOLVER_NEGATIVE_TTL_MS = 60000; // Age after which a failed lookup is tried again
+constexpr unsigned RESOLVER_MAX_THREADS = 64;
+
+/**
+ * @brief Names shown instead of numbers, the n key cycles through them.
+ */
+enum ResolveMode {
+    RESOLVE_OFF,        // Numeric addresses and ports
+    RESOLVE_HOSTS,      // Host names of addresses
+    RESOLVE_SERVICES,   // Service names of TCP and UDP ports
+    RESOLVE_ALL,        // Both, RESOLVE_HOSTS | RESOLVE_SERVICES
+    RESOLVE_MODES
+};
+
+/**
+ * @brief Names of the resolve modes, as given by --resolve.
+ */
+constexpr const char *RESOLVE_NAMES[RESOLVE_MODES] = {"off", "hosts", "services", "all"};
+
+/**
+ * @brief Function for finding the resolve mode of a name.
+ * @param name Name as given by --resolve.
+ * @return ResolveMode, RESOLVE_MODES for an unknown name.
+ */
+ResolveMode resolve_mode(const std::string &name);
+
+/**
+ * @brief Function for starting the resolver threads.
+ * @param threads Number of lookups running at once.
+ */
+void start_resolver(unsigned threads);
+
+/**
+ * @brief Function for stopping the resolver threads, lookups in progress are not waited for.
+ */
+void stop_resolver();
+
+/**
+ * @brief Function for getting the cached host name of an address, never waits for a lookup.
+ * @param ip IP address in binary form.
+ * @param family Address family (AF_INET/AF_INET6).
+ * @param request Whether a missing or expired name is queued for a lookup, only for rows on the screen.
+ * @param buffer Buffer for the name.
+ * @param size Size of the buffer.
+ * @return True if a name was copied, false while it is unknown or has none.
+ */
+bool lookup_host(const uint8_t *ip, uint8_t family, bool request, char *buffer, size_t size);
+
+/**
+ * @brief Function for getting the cached service name of a port, never waits for a lookup.
+ * @param port Port number.
+ * @param proto IP protocol number, only TCP and UDP ports have names.
+ * @param request Whether a missing or expired name is queued for a lookup, only for rows on the screen.
+ * @param buffer Buffer for the name.
+ * @param size Size of the buffer.
+ * @return True if a name was copied, false while it is unknown or has none.
+ */
+bool lookup_service(uint16_t port, uint8_t proto, bool request, char *buffer, size_t size);
+
+/**
+ * @brief Function for counting the lookups queued or in progress.
+ * @return Number of pending lookups.
+ */
+size_t resolver_pending();
+
+#endif // RESOLVER_H
@@ -0,0 +1,96 @@
+// Aurel Strigáč <xstrig00>
+
+#ifndef RING_H
+#define RING_H
+
+#include <pcap.h>
+#include <cstdint>
+#include <string>
+
+#include "batch.h"
+#include "link.h"
+
+/**
+ * @brief AF_PACKET socket with a memory-mapped TPACKET_V3 receive ring.
+ */
+struct Ring {
+    int fd = -1;                  // Packet socket
+    uint8_t *map = nullptr;       // Mapped ring
+    size_t map_size = 0;          // Size of the mapping in bytes
+    unsigned block_size = 0;      // Size of one block in bytes
+    unsigned block_count = 0;     // Number of blocks in the ring
+    unsigned current = 0;         // Next block to be read
+    LinkType link = LinkType::ETHERNET; // Header the frames start with, RAW for sockets without link headers
+};
+
+/**
+ * @brief Function for opening the interface and mapping its receive ring.
+ * @param ring Ring to initialize.
+ * @param device Network interface name.
+ * @param block_size Size of one block in bytes, must be a multiple of the page size.
+ * @param block_count Number of blocks in the ring.
+ * @param errbuf Buffer for the error message.
+ * @return True on success, false otherwise.
+ */
+bool ring_open(Ring &ring, const std::string &device, unsigned block_size, unsigned block_count, char *errbuf);
+
+/**
+ * @brief Function for processing blocks the kernel has handed over to user space, at most one pass over the ring.
+ * @param ring Opened ring.
+ * @param callback Function called for each packet, same as with pcap_dispatch.
+ * @param user Argument passed to the callback.
+ * @return Number of processed packets.
+ */
+int ring_dispatch(Ring &ring, pcap_handler callback, u_char *user);
+
+/**
+ * @brief Function for collecting packets of the handed over blocks into batches, at most one pass over the ring.
+ * @param ring Opened ring.
+ * @param batch Batch referencing packets in place, it is flushed before their block is returned to the kernel.
+ * @param flush Function called with user whenever the batch is full or its block is done.
+ * @param user Argument passed to flush.
+ * @return Number of processed packets.
+ */
+int ring_dispatch_batch(Ring &ring, PacketBatch &batch, void (*flush)(u_char *), u_char *user);
+
+/**
+ * @brief Function for adding the ring's socket to a PACKET_FANOUT group in hash mode.
+ * @param ring Opened ring.
+ * @param group Fanout group identifier shared by all workers.
+ * @param errbuf Buffer for the error message.
+ * @return True on success, false otherwise.
+ */
+bool ring_join_fanout(Ring &ring, int group, char *errbuf);
+
+/**
+ * @brief Function for attaching a compiled BPF program to the ring's socket.
+ * @param ring Opened ring.
+ * @param program Compiled filter, its return value also limits the captured length.
+ * @param errbuf Buffer for the error message.
+ * @return True on success, false otherwise.
+ */
+bool ring_set_filter(Ring &ring, const struct bpf_program &program, char *errbuf);
+
+/**
+ * @brief Function for reading the packets the kernel dropped since the last call, the kernel resets its counter on read.
+ * @param ring Opened ring.
+ * @param drops Increased by the dropped packets.
+ * @return True on success, false otherwise.
+ */
+bool ring_drops(Ring &ring, uint64_t &drops);
+
+/**
+ * @brief Function for reading the receive drops the driver reports for an interface.
+ * @param device Network interface name.
+ * @param drops Set to the drops since the interface came up.
+ * @return True on success, false if the interface has no counters (e.g. "any").
+ */
+bool read_interface_drops(const std::string &device, uint64_t &drops);
+
+/**
+ * @brief Function for unmapping the ring and closing the socket.
+ * @param ring Ring to close.
+ */
+void ring_close(Ring &ring);
+
+#endif // RING_H
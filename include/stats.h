@@ -0,0 +1,128 @@
+// Aurel Strigáč <xstrig00>
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+
+/**
+ * @brief Number of histogram buckets, bucket b holds durations in [2^b, 2^(b+1)) nanoseconds.
+ */
+constexpr int LATENCY_BUCKETS = 32;
+
+/**
+ * @brief Log2 histogram of durations, recording is a few instructions so it stays on in the hot path.
+ */
+struct LatencyHistogram {
+    uint64_t buckets[LATENCY_BUCKETS] = {}; // Number of durations per bucket
+    uint64_t count = 0;                     // Number of recorded durations
+    uint64_t total_ns = 0;                  // Sum of recorded durations in nanoseconds
+};
+
+/**
+ * @brief Packet counters of a worker, each worker is the only writer of its own.
+ */
+struct CaptureCounters {
+    uint64_t received = 0;      // Packets handed to user space
+    uint64_t unsupported = 0;   // Packets which are not IP or whose transport protocol is not tracked
+    uint64_t truncated = 0;     // Packets whose headers are cut off or malformed
+    uint64_t kernel_drops = 0;  // Packets dropped by the kernel because the socket buffer or ring was full
+    uint64_t if_drops = 0;      // Packets dropped by the interface or its driver
+};
+
+/**
+ * @brief Instrumentation of one interval summed over the displayed workers.
+ */
+struct IntervalStats {
+    CaptureCounters interval;   // Counters of the interval
+    CaptureCounters total;      // Counters since the start
+    LatencyHistogram parse;     // Batch classification and key extraction, per batch
+    LatencyHistogram update;    // Flow table updates including the slow path parser, per batch
+    LatencyHistogram merge;     // Merging and sorting the snapshots, per frame
+    LatencyHistogram render;    // Drawing the screen, per frame
+};
+
+/**
+ * @brief Function for reading the monotonic clock.
+ * @return Current time in nanoseconds.
+ */
+inline uint64_t monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * @brief Function for recording a duration.
+ * @param histogram Histogram owned by the calling thread.
+ * @param ns Duration in nanoseconds.
+ */
+inline void record_latency(LatencyHistogram &histogram, uint64_t ns) {
+    int bucket = ns != 0 ? 63 - __builtin_clzll(ns) : 0;
+    histogram.buckets[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+    histogram.count++;
+    histogram.total_ns += ns;
+}
+
+/**
+ * @brief Function for adding one histogram to another.
+ * @param into Histogram to add to.
+ * @param from Added histogram.
+ */
+void merge_latency(LatencyHistogram &into, const LatencyHistogram &from);
+
+/**
+ * @brief Function for estimating a percentile of the recorded durations.
+ * @param histogram Histogram.
+ * @param quantile Quantile between 0 and 1.
+ * @return Upper bound of the bucket holding the percentile in nanoseconds, 0 for an empty histogram.
+ */
+uint64_t latency_percentile(const LatencyHistogram &histogram, double quantile);
+
+/**
+ * @brief Function for adding one set of counters to another.
+ * @param into Counters to add to.
+ * @param from Added counters.
+ */
+void add_counters(CaptureCounters &into, const CaptureCounters &from);
+
+/**
+ * @brief Function for computing counters of an interval from two totals.
+ * @param now Totals at the end of the interval.
+ * @param before Totals at the start of the interval.
+ * @return Difference of the totals.
+ */
+CaptureCounters counters_delta(const CaptureCounters &now, const CaptureCounters &before);
+
+/**
+ * @brief Function for formatting a duration with a unit suffix.
+ * @param ns Duration in nanoseconds.
+ * @param buffer Buffer for the text, 16 bytes fit every duration.
+ * @param size Size of the buffer.
+ * @return The buffer, e.g. "850ns", "12.4us" or "3.1ms".
+ */
+const char *format_duration(double ns, char *buffer, size_t size);
+
+/**
+ * @brief Function for opening the file the stats of every interval are written to.
+ * @param path Path of the file, it is truncated.
+ * @return True on success, false otherwise.
+ */
+bool open_stats_file(const std::string &path);
+
+/**
+ * @brief Function for appending the stats of an interval to the stats file as one JSON line, nothing is done if it isn't open.
+ * @param epoch Interval the stats belong to.
+ * @param stats Instrumentation of the interval.
+ */
+void write_stats_file(uint32_t epoch, const IntervalStats &stats);
+
+/**
+ * @brief Function for closing the stats file.
+ */
+void close_stats_file();
+
+#endif // STATS_H
@@ -4,27 +4,51 @@
 #define UTILS_H
 
 #include <string>
+#include <cstdint>
+#include <pcap.h>
+#include <netinet/in.h>
+
+#include "link.h"
+
+constexpr size_t FORMAT_RATE_SIZE = 16;                 // Buffer of format_bits and format_packets
+constexpr size_t FORMAT_IP_SIZE = INET6_ADDRSTRLEN + 2;  // Buffer of format_ip, room for the brackets
 
 /**
  * @brief Function for formatting bit rates.
  * @param bits_per_sec Bit rate to format.
- * @return Formatted string representing the bit rate.
+ * @param buffer Buffer for the text, FORMAT_RATE_SIZE bytes fit every rate.
+ * @param size Size of the buffer.
+ * @return The buffer.
  */
-std::string format_bits(double bits_per_sec);
+const char *format_bits(double bits_per_sec, char *buffer, size_t size);
 
 /**
  * @brief Function for formatting packet rates.
  * @param packets_per_sec Packet rate to format.
- * @return Formatted string representing the packet rate.
+ * @param buffer Buffer for the text, FORMAT_RATE_SIZE bytes fit every rate.
+ * @param size Size of the buffer.
+ * @return The buffer.
+ */
+const char *format_packets(double packets_per_sec, char *buffer, size_t size);
+
+/**
+ * @brief Function for formatting IP addresses before printing, IPv6 addresses are put in brackets.
+ * @param ip IP address in binary form.
+ * @param family Address family (AF_INET/AF_INET6).
+ * @param buffer Buffer for the text, FORMAT_IP_SIZE bytes fit every address.
+ * @param size Size of the buffer.
+ * @return The buffer.
  */
-std::string format_packets(double packets_per_sec);
+const char *format_ip(const uint8_t *ip, uint8_t family, char *buffer, size_t size);
 
 /**
- * @brief Function for formatting IP addresses before printing.
- * @param ip IP address string.
- * @return Formatted IP address.
+ * @brief Function for formatting protocol numbers before printing.
+ * @param proto IP protocol number.
+ * @param buffer Buffer for numbers of unnamed protocols, FORMAT_RATE_SIZE bytes are enough.
+ * @param size Size of the buffer.
+ * @return Protocol name.
  */
-std::string format_ip(const std::string &ip);
+const char *format_proto(uint8_t proto, char *buffer, size_t size);
 
 /**
  * @brief Function for displaying the help message.
@@ -39,15 +63,126 @@ void check_sort_order(char order);
 
 /**
  * @brief Function for checking refresh interval parameter.
- * @param interval Refresh interval in seconds.
+ * @param interval Refresh interval in milliseconds.
+ */
+void check_refresh_interval(long interval);
+
+/**
+ * @brief Function for checking rate parameter.
+ * @param mode Rate shown as b/s (interval/2s/10s/40s/ewma/peak).
+ */
+void check_rate_mode(const std::string &mode);
+
+/**
+ * @brief Function for checking aggregation parameter.
+ * @param level Initial aggregation level (flow/pair/host/prefix/port/proto).
+ */
+void check_aggregation(const std::string &level);
+
+/**
+ * @brief Function for checking prefix length parameters.
+ * @param bits Prefix length.
+ * @param max_bits Length of the address in bits.
+ * @param option Name of the option for the error message.
+ */
+void check_prefix_length(long bits, long max_bits, const char *option);
+
+/**
+ * @brief Function for checking resolve parameter.
+ * @param mode Names shown at start (off/hosts/services/all).
  */
-void check_refresh_interval(int interval);
+void check_resolve(const std::string &mode);
 
 /**
- * @brief Function for checking if the interface parameter is set.
+ * @brief Function for checking resolver thread count parameter.
+ * @param count Number of lookups running at once.
+ */
+void check_resolve_threads(long count);
+
+/**
+ * @brief Function for checking displayed flow count parameter.
+ * @param count Number of displayed flows.
+ */
+void check_top_count(long count);
+
+/**
+ * @brief Function for checking idle timeout parameter.
+ * @param timeout Idle timeout in seconds.
+ */
+void check_idle_timeout(long timeout);
+
+/**
+ * @brief Function for checking flow limit parameter.
+ * @param count Maximum number of flows.
+ */
+void check_max_flows(long count);
+
+/**
+ * @brief Function for checking memory limit parameter.
+ * @param bytes Memory limit of the flow tables in bytes.
+ */
+void check_max_mem(long bytes);
+
+/**
+ * @brief Function for checking history size parameter.
+ * @param bytes Size after which the history is rotated.
+ */
+void check_history_size(long bytes);
+
+/**
+ * @brief Function for checking overload policy parameter.
+ * @param name Policy name (evict/drop).
+ */
+void check_overload_policy(const std::string &name);
+
+/**
+ * @brief Function for checking sketch mode parameter.
+ * @param name Mode name (off/on/auto).
+ */
+void check_sketch_mode(const std::string &name);
+
+/**
+ * @brief Function for checking sketch size parameter.
+ * @param count Number of sketch counters.
+ */
+void check_sketch_size(long count);
+
+/**
+ * @brief Function for checking sketch threshold parameter.
+ * @param count Flows per interval switching to the sketch.
+ */
+void check_sketch_threshold(long count);
+
+/**
+ * @brief Function for checking capture backend parameter.
+ * @param name Backend name (ring/pcap).
+ */
+void check_backend(const std::string &name);
+
+/**
+ * @brief Function for checking ring geometry parameters.
+ * @param block_size Size of one ring block in bytes.
+ * @param block_count Number of ring blocks.
+ */
+void check_ring_geometry(long block_size, long block_count);
+
+/**
+ * @brief Function for checking that exactly one of the interface and capture file parameters is set.
  */
 void check_interface_set();
 
+/**
+ * @brief Function for checking headless output format parameter.
+ * @param format Output format (ndjson/csv).
+ */
+void check_headless_format(const std::string &format);
+
+/**
+ * @brief Function for checking replay speed parameter.
+ * @param speed Replay speed (max/realtime).
+ */
+void check_replay_speed(const std::string &speed);
+
 /**
  * @brief Function for handling invalid arguments.
  */
@@ -61,8 +196,22 @@ void handle_invalid_argument();
 void parse_args(int argc, char *argv[]);
 
 /**
- * @brief Function for checking if the interface supports Ethernet headers.
+ * @brief Function for checking worker count parameter.
+ * @param count Number of capture threads.
+ */
+void check_worker_count(long count);
+
+/**
+ * @brief Function for splitting the comma separated list of interfaces into interfaces.
+ * @param list Value of the -i parameter.
+ */
+void check_interface_list(const std::string &list);
+
+/**
+ * @brief Function for checking if the link-layer headers of the interface or file can be decoded.
+ * @param handle Pcap handle of the interface or file.
+ * @return Decoder of the link type.
  */
-void check_ethernet_support();
+LinkType check_link_support(pcap_t *handle);
 
 #endif // UTILS_H
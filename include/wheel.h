@@ -0,0 +1,115 @@
+// Aurel Strigáč <xstrig00>
+
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Hierarchical timer wheel of integer identifiers.
+ *
+ * Four levels of 64 slots, each level covers 64 times the range of the previous one. A timer
+ * is placed on the lowest level whose range reaches its expiry and is cascaded down as time
+ * advances, so scheduling, cancelling and firing are O(1) per timer.
+ */
+class TimerWheel {
+public:
+    /**
+     * @brief Constructor of the wheel.
+     * @param tick_ms Length of one tick of the lowest level in milliseconds.
+     */
+    explicit TimerWheel(uint64_t tick_ms);
+
+    static constexpr size_t TIMER_SIZE = 2 * sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint16_t); // Memory of one timer
+
+    /**
+     * @brief Function for preallocating storage of timers.
+     * @param count Number of timer identifiers.
+     */
+    void reserve(uint32_t count);
+
+    /**
+     * @brief Function for setting the current time of an empty wheel, so the first advance doesn't walk from zero.
+     * @param now Current time in milliseconds.
+     */
+    void start(uint64_t now);
+
+    /**
+     * @brief Function for scheduling a timer.
+     * @param id Identifier, must not be scheduled already.
+     * @param expires Expiry time in milliseconds.
+     */
+    void schedule(uint32_t id, uint64_t expires);
+
+    /**
+     * @brief Function for cancelling a scheduled timer.
+     * @param id Identifier of the timer.
+     */
+    void cancel(uint32_t id);
+
+    /**
+     * @brief Function for advancing the wheel and firing every timer which has expired.
+     * @param now Current time in milliseconds.
+     * @param expired Called with the identifier of each expired timer, may schedule it again.
+     */
+    template <typename Callback>
+    void advance(uint64_t now, Callback &&expired);
+
+private:
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 6;
+    static constexpr uint32_t SLOTS = 1 << SLOT_BITS;
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    uint64_t tick_ms;                 // Length of one tick in milliseconds
+    uint64_t current = 0;             // Current tick
+    uint64_t pending = 0;             // Number of scheduled timers
+    uint32_t heads[LEVELS][SLOTS];    // First timer of each slot
+    std::vector<uint32_t> next;       // Following timer in the slot
+    std::vector<uint32_t> prev;       // Preceding timer in the slot
+    std::vector<uint64_t> expiry;     // Expiry tick of each timer
+    std::vector<uint16_t> slot_of;    // Level * SLOTS + slot of each timer
+
+    void link(uint32_t id);
+    void unlink(uint32_t id);
+    uint32_t take(int level, uint32_t slot);
+};
+
+template <typename Callback>
+void TimerWheel::advance(uint64_t now, Callback &&expired) {
+    uint64_t target = now / tick_ms;
+
+    while (current < target) {
+        // Nothing to fire, jump straight to the target
+        if (pending == 0) {
+            current = target;
+            break;
+        }
+
+        current++;
+
+        // Cascade timers of the higher levels whose slot has come
+        for (int level = 1; level < LEVELS; level++) {
+            if ((current & ((1ULL << (SLOT_BITS * level)) - 1)) != 0) break;
+            uint32_t id = take(level, (current >> (SLOT_BITS * level)) & (SLOTS - 1));
+            while (id != NONE) {
+                uint32_t following = next[id];
+                link(id);
+                id = following;
+            }
+        }
+
+        uint32_t id = take(0, current & (SLOTS - 1));
+        while (id != NONE) {
+            uint32_t following = next[id];
+            pending--;
+            slot_of[id] = UINT16_MAX;
+            expired(id);
+            id = following;
+        }
+    }
+}
+
+#endif // WHEEL_H
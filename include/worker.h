@@ -0,0 +1,157 @@
+// Aurel Strigáč <xstrig00>
+
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <pcap.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "batch.h"
+#include "capture.h"
+#include "flow.h"
+#include "ring.h"
+#include "stats.h"
+
+/**
+ * @brief Statistics of one worker for one closed interval, handed over to the render thread.
+ */
+struct Snapshot {
+    std::vector<std::pair<FlowID, FlowStats>> flows; // Flows of the interval and quiet ones with rates, oriented for display
+    std::vector<std::pair<FlowID, FlowStats>> rollups[ROLLUPS]; // Records of every rollup listed like flows, grown on demand
+    uint64_t packets = 0;                            // Packets processed in the interval
+    size_t tracked = 0;                              // Flows in the shard at the end of the interval
+    uint64_t evicted = 0;                            // Flows evicted by a full shard, since the start
+    uint64_t dropped = 0;                            // Packets of new flows dropped by a full shard, since the start
+    bool approximate = false;                        // Whether flows come from the heavy-hitter sketch
+    uint64_t closed = 0;                             // End of the interval in milliseconds, packet time when replaying
+    CaptureCounters interval;                        // Counters since the previous published snapshot
+    CaptureCounters total;                           // Counters since the start
+    LatencyHistogram parse;                          // Batch parsing times since the previous published snapshot
+    LatencyHistogram update;                         // Batch flow update times since the previous published snapshot
+};
+
+/**
+ * @brief Memory of one flow of the shard capacity, both snapshot buffers included.
+ */
+constexpr size_t WORKER_FLOW_SIZE = FLOW_RECORD_SIZE + 2 * sizeof(std::pair<FlowID, FlowStats>);
+
+/**
+ * @brief Capture thread with its own socket and private shard of the flow table.
+ *
+ * With the ring backend every worker is a member of one PACKET_FANOUT group in hash mode,
+ * the kernel hashes both directions of a connection to the same socket, so each flow
+ * lives in exactly one shard.
+ *
+ * When capture_epoch moves, the worker closes its interval into snapshots[epoch & 1] and
+ * publishes the epoch. The other buffer may be read by the render thread meanwhile, so
+ * neither side ever waits for the other.
+ */
+struct alignas(64) Worker {
+    unsigned id = 0;                    // Index of the worker
+    uint16_t ingress = 0;               // Index of the interface in interfaces
+    Ring ring;                          // Ring of the fanout member (ring backend)
+    pcap_t *handle = nullptr;           // Pcap handle (pcap backend, single worker)
+    int wake_fd = -1;                   // Eventfd waking the worker on a new epoch or stop request
+    FlowShard flows;                    // Private shard of flows
+    PacketBatch batch;                  // Packets waiting to be parsed together
+    FragmentCache fragments;            // Ports of recent first fragments
+    LinkType link = LinkType::ETHERNET; // Link-layer header of the captured packets
+    LinkHandlers handlers;              // Parsing functions of the link type
+    uint32_t epoch = 0;                 // Epoch the current counters belong to
+    uint64_t packets = 0;               // Packets processed in the current interval
+    CaptureCounters counters;           // Counters since the start
+    CaptureCounters reported;           // Counters in the last published snapshot
+    LatencyHistogram parse_latency;     // Batch parsing times not published yet
+    LatencyHistogram update_latency;    // Batch flow update times not published yet
+    bool reports_interface = false;     // Whether the worker reads drops of the interface, one per interface
+    uint64_t if_drops_base = 0;         // Interface drops when the capture started (ring backend)
+    Snapshot snapshots[2];              // Double buffer of closed intervals
+    std::atomic<uint32_t> published{0}; // Epoch of the last published snapshot
+    std::thread thread;                 // Capture thread
+    uint64_t replayed = 0;              // Packets read from the capture file (replay)
+    uint64_t replay_ns = 0;             // Time spent replaying the capture file in nanoseconds (replay)
+};
+
+/**
+ * @brief Global list of capture workers.
+ */
+extern std::vector<std::unique_ptr<Worker>> workers;
+
+/**
+ * @brief Current interval, advanced by the main thread on every refresh tick.
+ */
+extern std::atomic<uint32_t> capture_epoch;
+
+/**
+ * @brief Epoch whose snapshots the render thread is reading, 0 when it reads none.
+ */
+extern std::atomic<uint32_t> render_epoch;
+
+/**
+ * @brief Last epoch the render thread has drawn or written out.
+ */
+extern std::atomic<uint32_t> rendered_epoch;
+
+/**
+ * @brief Set by the replay thread after publishing its last interval.
+ */
+extern std::atomic<bool> capture_finished;
+
+/**
+ * @brief Eventfd signalled by workers after closing an interval, the render thread waits on it.
+ */
+extern int snapshot_fd;
+
+/**
+ * @brief Function for getting the wall-clock time, the same clock packet timestamps use.
+ * @return Current time in milliseconds.
+ */
+uint64_t current_time_ms();
+
+/**
+ * @brief Function for opening the capture backend of every worker.
+ * @param count Requested number of workers.
+ * @param errbuf Buffer for the error message.
+ * @return True on success, false otherwise.
+ */
+bool open_workers(unsigned count, char *errbuf);
+
+/**
+ * @brief Function for starting the capture threads.
+ */
+void start_workers();
+
+/**
+ * @brief Function for stopping the capture threads and closing their backends.
+ */
+void stop_workers();
+
+/**
+ * @brief Function for starting a new interval and waking the workers to close the old one.
+ */
+void advance_epoch();
+
+/**
+ * @brief Function for closing the worker's interval and publishing its snapshot.
+ * @param worker Worker closing the interval.
+ * @param epoch New epoch.
+ * @param now Current time in milliseconds, packet time when replaying.
+ */
+void close_interval(Worker &worker, uint32_t epoch, uint64_t now);
+
+/**
+ * @brief Function run by each capture thread.
+ * @param worker Worker owning the thread.
+ */
+void worker_loop(Worker &worker);
+
+/**
+ * @brief Function run by the replay thread, intervals are closed by packet timestamps instead of the timer.
+ * @param worker Worker owning the thread.
+ */
+void replay_loop(Worker &worker);
+
+#endif // WORKER_H
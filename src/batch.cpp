@@ -0,0 +1,213 @@
+// Aurel Strigáč <xstrig00>
+
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <net/ethernet.h>
+#include <arpa/inet.h>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "batch.h"
+#include "capture.h"
+
+/**
+ * @brief Offsets of the fields read by the fast path, relative to the start of the IP header.
+ */
+constexpr uint32_t IPV4_PROTO_OFFSET = 9;
+constexpr uint32_t IPV6_PROTO_OFFSET = 6;
+
+/**
+ * @brief Function for classifying frames one by one, used where no SIMD code exists.
+ * @param ethertypes Ethertypes of BATCH_SIZE frames.
+ * @param protos IP protocols of BATCH_SIZE frames.
+ * @return Mask of frames with IPv4/IPv6 and a supported protocol.
+ */
+[[maybe_unused]] static uint64_t classify_scalar(const uint16_t *ethertypes, const uint8_t *protos) {
+    uint64_t mask = 0;
+    for (uint32_t i = 0; i < BATCH_SIZE; i++) {
+        bool ip = ethertypes[i] == htons(ETHERTYPE_IP) || ethertypes[i] == htons(ETHERTYPE_IPV6);
+        bool l4 = protos[i] == IPPROTO_TCP || protos[i] == IPPROTO_UDP || protos[i] == IPPROTO_ICMP || protos[i] == IPPROTO_ICMPV6;
+        mask |= static_cast<uint64_t>(ip && l4) << i;
+    }
+    return mask;
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief Function for classifying 16 frames per step with SSE2, available on every x86-64 CPU.
+ * @param ethertypes Ethertypes of BATCH_SIZE frames.
+ * @param protos IP protocols of BATCH_SIZE frames.
+ * @return Mask of frames with IPv4/IPv6 and a supported protocol.
+ */
+static uint64_t classify_sse2(const uint16_t *ethertypes, const uint8_t *protos) {
+    const __m128i ipv4 = _mm_set1_epi16(static_cast<short>(htons(ETHERTYPE_IP)));
+    const __m128i ipv6 = _mm_set1_epi16(static_cast<short>(htons(ETHERTYPE_IPV6)));
+    const __m128i tcp = _mm_set1_epi8(IPPROTO_TCP), udp = _mm_set1_epi8(IPPROTO_UDP);
+    const __m128i icmp = _mm_set1_epi8(IPPROTO_ICMP), icmp6 = _mm_set1_epi8(IPPROTO_ICMPV6);
+
+    uint64_t mask = 0;
+    for (uint32_t i = 0; i < BATCH_SIZE; i += 16) {
+        __m128i e0 = _mm_load_si128(reinterpret_cast<const __m128i *>(ethertypes + i));
+        __m128i e1 = _mm_load_si128(reinterpret_cast<const __m128i *>(ethertypes + i + 8));
+        __m128i ip0 = _mm_or_si128(_mm_cmpeq_epi16(e0, ipv4), _mm_cmpeq_epi16(e0, ipv6));
+        __m128i ip1 = _mm_or_si128(_mm_cmpeq_epi16(e1, ipv4), _mm_cmpeq_epi16(e1, ipv6));
+        __m128i ip = _mm_packs_epi16(ip0, ip1);     // One byte per frame
+
+        __m128i p = _mm_load_si128(reinterpret_cast<const __m128i *>(protos + i));
+        __m128i l4 = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(p, tcp), _mm_cmpeq_epi8(p, udp)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(p, icmp), _mm_cmpeq_epi8(p, icmp6)));
+
+        mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(ip, l4)))) << i;
+    }
+    return mask;
+}
+
+/**
+ * @brief Function for classifying 32 frames per step with AVX2.
+ * @param ethertypes Ethertypes of BATCH_SIZE frames.
+ * @param protos IP protocols of BATCH_SIZE frames.
+ * @return Mask of frames with IPv4/IPv6 and a supported protocol.
+ */
+__attribute__((target("avx2")))
+static uint64_t classify_avx2(const uint16_t *ethertypes, const uint8_t *protos) {
+    const __m256i ipv4 = _mm256_set1_epi16(static_cast<short>(htons(ETHERTYPE_IP)));
+    const __m256i ipv6 = _mm256_set1_epi16(static_cast<short>(htons(ETHERTYPE_IPV6)));
+    const __m256i tcp = _mm256_set1_epi8(IPPROTO_TCP), udp = _mm256_set1_epi8(IPPROTO_UDP);
+    const __m256i icmp = _mm256_set1_epi8(IPPROTO_ICMP), icmp6 = _mm256_set1_epi8(IPPROTO_ICMPV6);
+
+    uint64_t mask = 0;
+    for (uint32_t i = 0; i < BATCH_SIZE; i += 32) {
+        __m256i e0 = _mm256_load_si256(reinterpret_cast<const __m256i *>(ethertypes + i));
+        __m256i e1 = _mm256_load_si256(reinterpret_cast<const __m256i *>(ethertypes + i + 16));
+        __m256i ip0 = _mm256_or_si256(_mm256_cmpeq_epi16(e0, ipv4), _mm256_cmpeq_epi16(e0, ipv6));
+        __m256i ip1 = _mm256_or_si256(_mm256_cmpeq_epi16(e1, ipv4), _mm256_cmpeq_epi16(e1, ipv6));
+
+        // Packing works within 128-bit lanes, the quadwords are put back into frame order
+        __m256i ip = _mm256_permute4x64_epi64(_mm256_packs_epi16(ip0, ip1), 0xd8);
+
+        __m256i p = _mm256_load_si256(reinterpret_cast<const __m256i *>(protos + i));
+        __m256i l4 = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(p, tcp), _mm256_cmpeq_epi8(p, udp)),
+                                     _mm256_or_si256(_mm256_cmpeq_epi8(p, icmp), _mm256_cmpeq_epi8(p, icmp6)));
+
+        mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(ip, l4)))) << i;
+    }
+    return mask;
+}
+#endif
+
+using Classifier = uint64_t (*)(const uint16_t *, const uint8_t *);
+
+/**
+ * @brief Function for picking the widest classification code the CPU supports.
+ * @return Classification function.
+ */
+static Classifier select_classifier() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();   // Runs from a static initializer, possibly before the CPU model is detected
+    if (__builtin_cpu_supports("avx2")) return classify_avx2;
+    return classify_sse2;
+#else
+    return classify_scalar;
+#endif
+}
+
+static const Classifier classify = select_classifier();
+
+/**
+ * @brief Function for getting the name of the classification code selected for this CPU.
+ * @return "avx2", "sse2" or "scalar".
+ */
+const char *batch_isa() {
+#if defined(__x86_64__)
+    if (classify == classify_avx2) return "avx2";
+    if (classify == classify_sse2) return "sse2";
+#endif
+    return "scalar";
+}
+
+/**
+ * @brief Function for classifying all frames of the batch and extracting keys of the common ones.
+ * @tparam L Link-layer header of the frames.
+ * @param batch Batch to parse, its parsed mask is filled.
+ */
+template <LinkType L>
+void parse_batch(PacketBatch &batch) {
+    // Gather the classified fields into dense arrays, frames too short for them get zeros
+    for (uint32_t i = 0; i < batch.count; i++) {
+        const u_char *frame = batch.frames[i];
+        uint32_t caplen = batch.headers[i].caplen;
+
+        uint16_t ethertype = 0;
+        const u_char *l3_header = parse_link<L>(frame, frame + caplen, ethertype);
+        uint32_t l3 = l3_header != nullptr ? static_cast<uint32_t>(l3_header - frame) : 0;
+        uint32_t proto_offset = l3 + (ethertype == ETHERTYPE_IPV6 ? IPV6_PROTO_OFFSET : IPV4_PROTO_OFFSET);
+
+        batch.ethertypes[i] = l3_header != nullptr ? htons(ethertype) : 0;
+        batch.protos[i] = caplen > proto_offset ? frame[proto_offset] : 0;
+        batch.l3_offsets[i] = static_cast<uint8_t>(l3);
+    }
+    for (uint32_t i = batch.count; i < BATCH_SIZE; i++) {
+        batch.ethertypes[i] = 0;
+        batch.protos[i] = 0;
+    }
+
+    uint64_t candidates = classify(batch.ethertypes, batch.protos);
+
+    // Extract keys of the candidates, a frame whose headers are not all captured is left to the slow path
+    batch.parsed = 0;
+    while (candidates != 0) {
+        uint32_t i = static_cast<uint32_t>(__builtin_ctzll(candidates));
+        candidates &= candidates - 1;
+
+        uint32_t l3_offset = batch.l3_offsets[i];
+        const u_char *l3 = batch.frames[i] + l3_offset;
+        uint32_t caplen = batch.headers[i].caplen;
+        FlowID &key = batch.keys[i];
+        std::memset(&key, 0, sizeof(key));
+
+        uint32_t l4_offset;
+        if (batch.ethertypes[i] == htons(ETHERTYPE_IP)) {
+            uint32_t ihl = (l3[0] & 0x0f) * 4u;
+            l4_offset = l3_offset + ihl;
+            if (ihl < sizeof(struct ip) || l4_offset + L4_PORTS_LEN > caplen) continue;
+
+            // Fragments need the fragment cache
+            if ((l3[6] & 0x3f) != 0 || l3[7] != 0) continue;
+
+            std::memcpy(key.ip1, l3 + 12, 4);
+            std::memcpy(key.ip2, l3 + 16, 4);
+            key.family = AF_INET;
+            batch.lengths[i] = static_cast<uint16_t>(l3[2] << 8 | l3[3]);
+        } else {
+            l4_offset = l3_offset + sizeof(struct ip6_hdr);
+            if (l4_offset + L4_PORTS_LEN > caplen) continue;
+
+            std::memcpy(key.ip1, l3 + 8, 16);
+            std::memcpy(key.ip2, l3 + 24, 16);
+            key.family = AF_INET6;
+            batch.lengths[i] = static_cast<uint16_t>((l3[4] << 8 | l3[5]) + sizeof(struct ip6_hdr));
+        }
+
+        // Ports are the first two words of both TCP and UDP, ICMP has none
+        uint8_t proto = batch.protos[i];
+        const u_char *l4 = batch.frames[i] + l4_offset;
+        bool ports = proto == IPPROTO_TCP || proto == IPPROTO_UDP;
+        key.port1 = ports ? static_cast<uint16_t>(l4[0] << 8 | l4[1]) : 0;
+        key.port2 = ports ? static_cast<uint16_t>(l4[2] << 8 | l4[3]) : 0;
+        key.proto = proto;
+        key.ingress = batch.ingress;
+
+        batch.hashes[i] = flow_hash(key);
+        batch.parsed |= 1ULL << i;
+    }
+}
+
+template void parse_batch<LinkType::ETHERNET>(PacketBatch &);
+template void parse_batch<LinkType::SLL>(PacketBatch &);
+template void parse_batch<LinkType::SLL2>(PacketBatch &);
+template void parse_batch<LinkType::RAW>(PacketBatch &);
+template void parse_batch<LinkType::NULL_LOOP>(PacketBatch &);
@@ -7,70 +7,386 @@
 #include <net/ethernet.h>
 #include <arpa/inet.h>
 #include <cstring>
+#include <cstdio>
 
 #include "capture.h"
+#include "batch.h"
 #include "flow.h"
-#include "net-top.h"
+#include "ring.h"
+#include "stats.h"
+#include "worker.h"
+
+// IPv6 is passed whole because libpcap only checks the Next Header of the fixed header, which misses
+// extension header chains and fragments. The vlan keyword shifts the offsets of everything after it,
+// so it has to come last, and only Ethernet captures get it.
+const char *DEFAULT_FILTER = "tcp or udp or icmp or ip6";
 
 /**
- * @brief Function for handling separate packets.
- * @param args Argument.
+ * @brief Function for extracting the flow key of a separate packet, later fragments take the ports of their first one.
+ * @tparam L Link-layer header of the packet.
+ * @param args Worker which captured the packet, it counts packets which can't be parsed.
  * @param header Pcap packet header.
  * @param packet Pointer to the packet data.
+ * @param key Set to FlowID of the packet (src->dst).
+ * @param total_len Set to the IP length of the packet.
+ * @return True if the packet is counted, false if it is truncated or unsupported.
  */
-void packet_handler(u_char *args, const struct pcap_pkthdr *header, const u_char *packet) {
-    (void) args, (void) header;  // Pity fix for unused variable
+template <LinkType L>
+bool parse_packet(u_char *args, const struct pcap_pkthdr *header, const u_char *packet, FlowID &key, uint16_t &total_len) {
+    Worker *worker = reinterpret_cast<Worker *>(args);
 
-    const struct ether_header *eth_header = (struct ether_header *)packet;
-    uint16_t eth_type = ntohs(eth_header->ether_type);
+    // Only headers are captured, make sure the ones we read are present
+    const u_char *packet_end = packet + header->caplen;
+    uint16_t eth_type;
+    const u_char *l3_header = parse_link<L>(packet, packet_end, eth_type);
+    if (l3_header == nullptr) {
+        worker->counters.truncated++;
+        return false;
+    }
 
     // Variables to store packet information
-    std::string src_ip, dst_ip, src_port = "0", dst_port = "0", proto_str;
+    key = FlowID();
+    key.ingress = worker->ingress;
     uint16_t prot_num = 0;                  // L3 Packet Protocol field in IPv4, Next Header field in IPv6
-    uint16_t total_len = 0;                 // L3 Packet Total length field in IPv4, Payload length field in IPv6
+    total_len = 0;                          // L3 Packet Total length field in IPv4, Payload length field in IPv6
                                             // These fields don't account for length of the Ethernet header and trailer
     const u_char *transport_header = nullptr;
+    FragmentInfo fragment;
 
     if (eth_type == ETHERTYPE_IP) {
         // IPv4 Packet
-        const struct ip *ip_header = (struct ip *)(packet + sizeof(struct ether_header));
-        parse_L3_ipv4(ip_header, src_ip, dst_ip, prot_num, total_len);                                            
+        const struct ip *ip_header = (struct ip *)l3_header;
+        if (l3_header + sizeof(struct ip) > packet_end || ip_header->ip_hl * 4u < sizeof(struct ip)) {
+            worker->counters.truncated++;
+            return false;
+        }
+        parse_L3_ipv4(ip_header, key.ip1, key.ip2, prot_num, total_len);
+        key.family = AF_INET;
+
+        // Only the fragment at offset 0 carries the L4 header
+        uint16_t offset = ntohs(ip_header->ip_off);
+        fragment.fragment = (offset & (IP_MF | IP_OFFMASK)) != 0;
+        fragment.first = (offset & IP_OFFMASK) == 0;
+        fragment.id = ntohs(ip_header->ip_id);
 
         // Transport layer (L4) header
-        transport_header = packet + sizeof(struct ether_header) + ip_header->ip_hl * 4;
+        transport_header = l3_header + ip_header->ip_hl * 4;
     } else if (eth_type == ETHERTYPE_IPV6) {
         // IPv6 Packet
-        const struct ip6_hdr *ip6_header = (struct ip6_hdr *)(packet + sizeof(struct ether_header));
-        parse_L3_ipv6(ip6_header, src_ip, dst_ip, prot_num, total_len);
+        const struct ip6_hdr *ip6_header = (struct ip6_hdr *)l3_header;
+        if (l3_header + sizeof(struct ip6_hdr) > packet_end) {
+            worker->counters.truncated++;
+            return false;
+        }
+        parse_L3_ipv6(ip6_header, key.ip1, key.ip2, prot_num, total_len);
+        key.family = AF_INET6;
 
-        // Transport layer (L4) header
-        transport_header = packet + sizeof(struct ether_header) + sizeof(struct ip6_hdr);
+        // Transport layer (L4) header follows the extension headers
+        transport_header = parse_ipv6_extensions(l3_header + sizeof(struct ip6_hdr), packet_end, prot_num, fragment);
+        if (transport_header == nullptr) {
+            worker->counters.truncated++;
+            return false;
+        }
     } else {
-        return;
+        worker->counters.unsupported++;
+        return false;
     }
 
-    parse_L4(prot_num, transport_header, proto_str, src_port, dst_port);
+    if (!supported_L4(prot_num)) {
+        worker->counters.unsupported++; // Unsupported protocol
+        return false;
+    }
+    key.proto = static_cast<uint8_t>(prot_num);
+    uint64_t now = static_cast<uint64_t>(header->ts.tv_sec) * 1000 + header->ts.tv_usec / 1000;
 
-    if (proto_str.empty()) return; // Unsupported protocol
+    if (!fragment.fragment || fragment.first) {
+        if (transport_header + L4_PORTS_LEN > packet_end) {
+            worker->counters.truncated++;
+            return false;
+        }
+        parse_L4(prot_num, transport_header, key.port1, key.port2);
+        if (fragment.fragment) remember_fragment(worker->fragments, key, fragment.id, now);
+    } else {
+        // Later fragments have no L4 header, they take the ports of their first fragment if it was seen
+        lookup_fragment(worker->fragments, key, fragment.id, now);
+    }
 
-    // Create potential flow IDs
-    FlowID tx_key = {src_ip, dst_ip, src_port, dst_port, proto_str};
-    FlowID rx_key = {dst_ip, src_ip, dst_port, src_port, proto_str};
+    return true;
+}
 
-    update_flow_statistics(tx_key, rx_key, total_len);
+/**
+ * @brief Function for handling separate packets.
+ * @tparam L Link-layer header of the packets.
+ * @param args Worker which captured the packet.
+ * @param header Pcap packet header.
+ * @param packet Pointer to the packet data.
+ */
+template <LinkType L>
+void packet_handler(u_char *args, const struct pcap_pkthdr *header, const u_char *packet) {
+    FlowID key;
+    uint16_t total_len;
+    if (!parse_packet<L>(args, header, packet, key, total_len)) return;
+
+    Worker *worker = reinterpret_cast<Worker *>(args);
+    uint64_t now = static_cast<uint64_t>(header->ts.tv_sec) * 1000 + header->ts.tv_usec / 1000;
+    update_flow_statistics(worker->flows, key, total_len, now);
+}
+
+/**
+ * @brief Function for walking the IPv6 extension header chain up to the transport header.
+ * @param header First header after the fixed IPv6 header.
+ * @param packet_end End of the captured data.
+ * @param prot_num Next Header of the fixed header, set to the transport protocol.
+ * @param fragment Set if a Fragment header is found.
+ * @return Start of the transport header (or of the fragment data), nullptr if the chain is truncated or too long.
+ */
+const u_char *parse_ipv6_extensions(const u_char *header, const u_char *packet_end, uint16_t &prot_num, FragmentInfo &fragment) {
+    for (int count = 0; count < MAX_IPV6_EXT_HEADERS; count++) {
+        // Every extension header starts with Next Header, the length unit differs
+        size_t length;
+        if (prot_num == IPPROTO_HOPOPTS || prot_num == IPPROTO_ROUTING || prot_num == IPPROTO_DSTOPTS) {
+            if (header + 2 > packet_end) return nullptr;
+            length = (header[1] + 1) * 8u;
+        } else if (prot_num == IPPROTO_AH) {
+            if (header + 2 > packet_end) return nullptr;
+            length = (header[1] + 2) * 4u;
+        } else if (prot_num == IPPROTO_FRAGMENT) {
+            const struct ip6_frag *frag = (const struct ip6_frag *)header;
+            if (header + sizeof(struct ip6_frag) > packet_end) return nullptr;
+            fragment.fragment = true;
+            fragment.first = (frag->ip6f_offlg & IP6F_OFF_MASK) == 0;
+            fragment.id = ntohl(frag->ip6f_ident);
+            prot_num = frag->ip6f_nxt;
+
+            // Data of a later fragment is not a header, its Next Header names the original protocol
+            if (!fragment.first) return header + sizeof(struct ip6_frag);
+            header += sizeof(struct ip6_frag);
+            continue;
+        } else {
+            return header;
+        }
+
+        prot_num = header[0];
+        header += length;
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Function for building the key of a fragment cache slot.
+ * @param key FlowID of the fragment (src->dst).
+ * @param id Fragment identification.
+ * @return Key with the fragment ID in place of the ports.
+ */
+static FlowID fragment_key(const FlowID &key, uint32_t id) {
+    FlowID fragment = key;
+    fragment.port1 = static_cast<uint16_t>(id >> 16);
+    fragment.port2 = static_cast<uint16_t>(id);
+    return fragment;
+}
+
+/**
+ * @brief Function for remembering the ports of a first fragment.
+ * @param cache Fragment cache of the worker.
+ * @param key FlowID of the fragment (src->dst) with its ports.
+ * @param id Fragment identification.
+ * @param now Packet timestamp in milliseconds.
+ */
+void remember_fragment(FragmentCache &cache, const FlowID &key, uint32_t id, uint64_t now) {
+    FlowID fragment = fragment_key(key, id);
+    FragmentCache::Slot &slot = cache.slots[flow_hash(fragment) % FRAGMENT_CACHE_SIZE];
+    slot.key = fragment;
+    slot.port1 = key.port1;
+    slot.port2 = key.port2;
+    slot.seen = now != 0 ? now : 1;
+}
+
+/**
+ * @brief Function for filling in the ports of a later fragment from its first fragment.
+ * @param cache Fragment cache of the worker.
+ * @param key FlowID of the fragment (src->dst), its ports are set on a hit.
+ * @param id Fragment identification.
+ * @param now Packet timestamp in milliseconds.
+ * @return True if the first fragment was found, false otherwise.
+ */
+bool lookup_fragment(const FragmentCache &cache, FlowID &key, uint32_t id, uint64_t now) {
+    FlowID fragment = fragment_key(key, id);
+    const FragmentCache::Slot &slot = cache.slots[flow_hash(fragment) % FRAGMENT_CACHE_SIZE];
+    if (slot.seen == 0 || now > slot.seen + FRAGMENT_TIMEOUT_MS || !(slot.key == fragment)) return false;
+
+    key.port1 = slot.port1;
+    key.port2 = slot.port2;
+    return true;
+}
+
+/**
+ * @brief Function for parsing a packet into the worker's batch, for backends which reuse their buffer after the callback.
+ * @tparam L Link-layer header of the packets.
+ * @param args Worker which captured the packet.
+ * @param header Pcap packet header.
+ * @param packet Packet data.
+ */
+template <LinkType L>
+void batch_handler(u_char *args, const struct pcap_pkthdr *header, const u_char *packet) {
+    Worker *worker = reinterpret_cast<Worker *>(args);
+    PacketBatch &batch = worker->batch;
+    if (batch.count == BATCH_SIZE) count_batch(args);
+
+    // Copying the frame for the classification costs more than it saves, only the key waits for the lookup
+    FlowID key;
+    uint16_t total_len;
+    if (parse_packet<L>(args, header, packet, key, total_len)) batch_push_key(batch, *header, key, total_len);
+}
+
+/**
+ * @brief Function for prefetching the flow table slots and then the records of the parsed frames of a batch.
+ * @param table Flow table the batch is counted in.
+ * @param batch Batch with its parsed mask filled.
+ */
+static inline void prefetch_batch(const FlowTable &table, const PacketBatch &batch) {
+    for (uint64_t mask = batch.parsed; mask != 0; mask &= mask - 1) table.prefetch_slot(batch.hashes[__builtin_ctzll(mask)]);
+    for (uint64_t mask = batch.parsed; mask != 0; mask &= mask - 1) table.prefetch_entry(batch.hashes[__builtin_ctzll(mask)]);
+}
+
+/**
+ * @brief Function for counting the packets of the worker's batch whose keys were parsed on arrival, the batch is emptied.
+ * @param args Worker owning the batch.
+ */
+void count_batch(u_char *args) {
+    Worker *worker = reinterpret_cast<Worker *>(args);
+    PacketBatch &batch = worker->batch;
+    uint64_t start = monotonic_ns();
+
+    // Flow records are looked up for the whole batch at once
+    prefetch_batch(worker->flows.table, batch);
+    for (uint32_t i = 0; i < batch.count; i++) {
+        const struct pcap_pkthdr &header = batch.headers[i];
+        uint64_t now = static_cast<uint64_t>(header.ts.tv_sec) * 1000 + header.ts.tv_usec / 1000;
+        update_flow_statistics(worker->flows, batch.keys[i], batch.hashes[i], batch.lengths[i], now);
+    }
+    batch.count = 0;
+    batch.parsed = 0;
+
+    // Parsing happened packet by packet on arrival, only the update is timed
+    record_latency(worker->update_latency, monotonic_ns() - start);
+}
+
+/**
+ * @brief Function for parsing the frames of the worker's batch in place and counting them, the batch is emptied.
+ * @tparam L Link-layer header of the packets.
+ * @param args Worker owning the batch.
+ */
+template <LinkType L>
+void flush_batch(u_char *args) {
+    Worker *worker = reinterpret_cast<Worker *>(args);
+    PacketBatch &batch = worker->batch;
+    uint64_t start = monotonic_ns();
+    parse_batch<L>(batch);
+    uint64_t parsed = monotonic_ns();
+
+    // Flow records are looked up for the whole batch at once, the slots and then the records are fetched ahead
+    prefetch_batch(worker->flows.table, batch);
+
+    // Frames are counted in capture order, the ones the fast path skipped go through the full parser
+    for (uint32_t i = 0; i < batch.count; i++) {
+        const struct pcap_pkthdr &header = batch.headers[i];
+        if (batch.parsed & (1ULL << i)) {
+            uint64_t now = static_cast<uint64_t>(header.ts.tv_sec) * 1000 + header.ts.tv_usec / 1000;
+            update_flow_statistics(worker->flows, batch.keys[i], batch.hashes[i], batch.lengths[i], now);
+        } else {
+            packet_handler<L>(args, &header, batch.frames[i]);
+        }
+    }
+    batch.count = 0;
+
+    // Timed per batch, so reading the clock costs next to nothing per packet
+    record_latency(worker->parse_latency, parsed - start);
+    record_latency(worker->update_latency, monotonic_ns() - parsed);
+}
+
+/**
+ * @brief Function for selecting the parsing functions of a link type.
+ * @param link Link-layer header of the capture.
+ * @return Functions instantiated for the link type.
+ */
+LinkHandlers link_handlers(LinkType link) {
+    switch (link) {
+        case LinkType::SLL:
+            return {packet_handler<LinkType::SLL>, batch_handler<LinkType::SLL>, flush_batch<LinkType::SLL>};
+        case LinkType::SLL2:
+            return {packet_handler<LinkType::SLL2>, batch_handler<LinkType::SLL2>, flush_batch<LinkType::SLL2>};
+        case LinkType::RAW:
+            return {packet_handler<LinkType::RAW>, batch_handler<LinkType::RAW>, flush_batch<LinkType::RAW>};
+        case LinkType::NULL_LOOP:
+            return {packet_handler<LinkType::NULL_LOOP>, batch_handler<LinkType::NULL_LOOP>, flush_batch<LinkType::NULL_LOOP>};
+        default:
+            return {};
+    }
+}
+
+/**
+ * @brief Function for mapping a pcap data link type to a decoder.
+ * @param dlt Value returned by pcap_datalink.
+ * @param link Set to the decoder of the link type.
+ * @return True if the link type is supported, false otherwise.
+ */
+bool link_type_from_dlt(int dlt, LinkType &link) {
+    switch (dlt) {
+        case DLT_EN10MB:
+            link = LinkType::ETHERNET;
+            return true;
+        case DLT_LINUX_SLL:
+            link = LinkType::SLL;
+            return true;
+#ifdef DLT_LINUX_SLL2
+        case DLT_LINUX_SLL2:
+            link = LinkType::SLL2;
+            return true;
+#endif
+        case DLT_RAW:
+#ifdef DLT_IPV4
+        case DLT_IPV4:
+        case DLT_IPV6:
+#endif
+            link = LinkType::RAW;
+            return true;
+        case DLT_NULL:
+        case DLT_LOOP:
+            link = LinkType::NULL_LOOP;
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Function for getting the pcap data link type of a decoder, used for compiling filters.
+ * @param link Decoder.
+ * @return DLT_* value.
+ */
+int link_type_dlt(LinkType link) {
+    switch (link) {
+        case LinkType::SLL: return DLT_LINUX_SLL;
+#ifdef DLT_LINUX_SLL2
+        case LinkType::SLL2: return DLT_LINUX_SLL2;
+#endif
+        case LinkType::RAW: return DLT_RAW;
+        case LinkType::NULL_LOOP: return DLT_NULL;
+        default: return DLT_EN10MB;
+    }
 }
 
 /**
  * @brief Function for parsing IPv4 packet fields.
  * @param ip_header Pointer to the IPv4 header.
- * @param src_ip Source IP address as a string.
- * @param dst_ip Destination IP address as a string.
+ * @param src_ip Source IP address in binary form (16 bytes, zero padded).
+ * @param dst_ip Destination IP address in binary form (16 bytes, zero padded).
  * @param prot_num Protocol number.
  * @param total_len Total length of the packet.
  */
-void parse_L3_ipv4(const struct ip *ip_header, std::string &src_ip, std::string &dst_ip, uint16_t &prot_num, uint16_t &total_len) {
-    src_ip = inet_ntoa(ip_header->ip_src);       // Get source IP as a string
-    dst_ip = inet_ntoa(ip_header->ip_dst);       // Get destination IP as a string
+void parse_L3_ipv4(const struct ip *ip_header, uint8_t *src_ip, uint8_t *dst_ip, uint16_t &prot_num, uint16_t &total_len) {
+    std::memcpy(src_ip, &ip_header->ip_src, sizeof(struct in_addr));
+    std::memcpy(dst_ip, &ip_header->ip_dst, sizeof(struct in_addr));
     prot_num = ip_header->ip_p;
     total_len = ntohs(ip_header->ip_len);
 }
@@ -78,18 +394,14 @@ void parse_L3_ipv4(const struct ip *ip_header, std::string &src_ip, std::string
 /**
  * @brief Function for parsing IPv6 packet fields.
  * @param ip6_header Pointer to the IPv6 header.
- * @param src_ip Source IP address as a string.
- * @param dst_ip Destination IP address as a string.
+ * @param src_ip Source IP address in binary form (16 bytes).
+ * @param dst_ip Destination IP address in binary form (16 bytes).
  * @param prot_num Protocol number.
  * @param total_len Total length of the packet.
  */
-void parse_L3_ipv6(const struct ip6_hdr *ip6_header, std::string &src_ip, std::string &dst_ip, uint16_t &prot_num, uint16_t &total_len) {
-    char src_ip_str[INET6_ADDRSTRLEN];
-    char dst_ip_str[INET6_ADDRSTRLEN];
-    inet_ntop(AF_INET6, &(ip6_header->ip6_src), src_ip_str, INET6_ADDRSTRLEN);
-    inet_ntop(AF_INET6, &(ip6_header->ip6_dst), dst_ip_str, INET6_ADDRSTRLEN);
-    src_ip = src_ip_str;
-    dst_ip = dst_ip_str;
+void parse_L3_ipv6(const struct ip6_hdr *ip6_header, uint8_t *src_ip, uint8_t *dst_ip, uint16_t &prot_num, uint16_t &total_len) {
+    std::memcpy(src_ip, &ip6_header->ip6_src, sizeof(struct in6_addr));
+    std::memcpy(dst_ip, &ip6_header->ip6_dst, sizeof(struct in6_addr));
     prot_num = ip6_header->ip6_nxt;
     total_len = ntohs(ip6_header->ip6_plen) + sizeof(struct ip6_hdr);
 }
@@ -98,26 +410,86 @@ void parse_L3_ipv6(const struct ip6_hdr *ip6_header, std::string &src_ip, std::s
  * @brief Function for parsing L4 protocol fields.
  * @param prot_num Protocol number.
  * @param transport_header Transport layer header.
- * @param proto_str Protocol name.
  * @param src_port Source port.
  * @param dst_port Destination port.
+ * @return True if the protocol is supported, false otherwise.
  */
-void parse_L4(uint16_t prot_num, const u_char *transport_header, std::string &proto_str, std::string &src_port, std::string &dst_port) {
+bool parse_L4(uint16_t prot_num, const u_char *transport_header, uint16_t &src_port, uint16_t &dst_port) {
     if (prot_num == IPPROTO_TCP) {
-        proto_str = "tcp";
         const struct tcphdr *tcp_header = (struct tcphdr *)transport_header;
-        src_port = std::to_string(ntohs(tcp_header->th_sport));
-        dst_port = std::to_string(ntohs(tcp_header->th_dport));
+        src_port = ntohs(tcp_header->th_sport);
+        dst_port = ntohs(tcp_header->th_dport);
     } else if (prot_num == IPPROTO_UDP) {
-        proto_str = "udp";
         const struct udphdr *udp_header = (struct udphdr *)transport_header;
-        src_port = std::to_string(ntohs(udp_header->uh_sport));
-        dst_port = std::to_string(ntohs(udp_header->uh_dport));
-    } else if (prot_num == IPPROTO_ICMP) {
-        proto_str = "icmp";
-    } else if (prot_num == IPPROTO_ICMPV6) {
-        proto_str = "icmp6";
+        src_port = ntohs(udp_header->uh_sport);
+        dst_port = ntohs(udp_header->uh_dport);
+    } else if (prot_num == IPPROTO_ICMP || prot_num == IPPROTO_ICMPV6) {
+        // ICMP has no ports
+        src_port = 0;
+        dst_port = 0;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Function for checking whether flows of a transport protocol are tracked.
+ * @param prot_num Protocol number.
+ * @return True for TCP, UDP, ICMP and ICMPv6.
+ */
+bool supported_L4(uint16_t prot_num) {
+    return prot_num == IPPROTO_TCP || prot_num == IPPROTO_UDP || prot_num == IPPROTO_ICMP || prot_num == IPPROTO_ICMPV6;
+}
+
+/**
+ * @brief Function for building the final filter expression.
+ * @param user_filter Filter expression given by the user, may be empty.
+ * @param link Link-layer header of the capture, VLAN tags only exist on Ethernet.
+ * @return Default filter combined with the user's one.
+ */
+std::string build_filter(const std::string &user_filter, LinkType link) {
+    std::string filter = std::string(DEFAULT_FILTER) + (link == LinkType::ETHERNET ? " or vlan" : "");
+    if (user_filter.empty()) return filter;
+    return "(" + user_filter + ") and (" + filter + ")";
+}
+
+/**
+ * @brief Function for compiling the filter and installing it on the opened capture backend.
+ * @param handle Pcap handle, nullptr when the ring is used.
+ * @param ring Ring used when there is no pcap handle.
+ * @param expression Filter expression.
+ * @param errbuf Buffer for the error message.
+ * @return True on success, false otherwise.
+ */
+bool apply_filter(pcap_t *handle, Ring &ring, const std::string &expression, char *errbuf) {
+    struct bpf_program program;
+
+    // The ring has no pcap handle, a dead one is enough for compiling, accepted packets are cut to its snaplen
+    pcap_t *compiler = handle != nullptr ? handle : pcap_open_dead(link_type_dlt(ring.link), CAPTURE_SNAPLEN);
+    if (compiler == nullptr) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "cannot create filter compiler");
+        return false;
+    }
+
+    bool ok = pcap_compile(compiler, &program, expression.c_str(), 1, PCAP_NETMASK_UNKNOWN) != -1;
+    if (!ok) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", pcap_geterr(compiler));
     } else {
-        proto_str = "";
+        if (handle != nullptr) {
+            ok = pcap_setfilter(handle, &program) != -1;
+            if (!ok) snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", pcap_geterr(handle));
+        } else {
+            ok = ring_set_filter(ring, program, errbuf);
+        }
+        pcap_freecode(&program);
     }
+
+    if (compiler != handle) pcap_close(compiler);
+    return ok;
 }
+
+template bool parse_packet<LinkType::ETHERNET>(u_char *, const struct pcap_pkthdr *, const u_char *, FlowID &, uint16_t &);
+template void packet_handler<LinkType::ETHERNET>(u_char *, const struct pcap_pkthdr *, const u_char *);
+template void batch_handler<LinkType::ETHERNET>(u_char *, const struct pcap_pkthdr *, const u_char *);
+template void flush_batch<LinkType::ETHERNET>(u_char *);
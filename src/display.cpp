@@ -3,105 +3,1155 @@
 #include <ncurses.h>
 #include <vector>
 #include <algorithm>
+#include <string>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <csignal>
+#include <cstdarg>
+#include <cstring>
+#include <cctype>
+#include <ctime>
 
 #include "display.h"
 #include "flow.h"
+#include "history.h"
+#include "output.h"
+#include "resolver.h"
+#include "stats.h"
 #include "utils.h"
+#include "worker.h"
 #include "net-top.h"
 
+std::atomic<bool> resize_pending{false};
+std::atomic<bool> redraw_pending{false};
+std::atomic<int> view_interface{-1};
+std::atomic<int> view_aggregation{AGGREGATE_FLOW};
+std::atomic<int> view_sort{SORT_BYTES};
+std::atomic<size_t> view_count{10};
+std::atomic<int> view_resolve{RESOLVE_OFF};
+
+static std::atomic<int> history_steps{0};   // Scrolling requested by the main thread, applied by the render thread
+static std::atomic<bool> render_running{false};
+static std::thread render_thread;
+
+// Render thread's own timings, drawn one frame late since the current frame is still being drawn
+static LatencyHistogram merge_times;
+static LatencyHistogram render_times;
+static IntervalStats latest_stats;          // Instrumentation of the newest interval, the status lines stay live while frozen
+
+// State of the screen changed by keys, the main thread only flips requests the render thread acts on
+static std::atomic<bool> paused{false};
+static std::atomic<bool> freeze_pending{false};
+static std::atomic<size_t> last_page{0};    // Rows the screen had room for in the last frame
+static bool frozen = false;
+static uint32_t frozen_epoch = 0;
+static std::vector<Snapshot> frozen_snapshots; // Copies of the workers' snapshots while frozen, by worker index
+
+// Filter of the rows, typed by the main thread and parsed by the render thread when it changes
+static constexpr size_t FILTER_SIZE = 64;
+
+/**
+ * @brief Rows shown while a filter is set, parsed from the text typed after /.
+ */
+struct RowFilter {
+    enum Kind {NONE, PORT, ADDRESS, TEXT} kind = NONE;
+    uint8_t family = 0;             // Address family of ADDRESS
+    uint8_t ip[16] = {};            // Address or network of ADDRESS
+    int bits = 0;                   // Prefix length of ADDRESS
+    uint16_t port = 0;              // Port of PORT
+    char text[FILTER_SIZE] = {};    // Text as typed, looked up in the rows by TEXT
+};
+
+static std::mutex filter_lock;
+static char filter_input[FILTER_SIZE];  // Text being typed, guarded by filter_lock
+static char filter_typed[FILTER_SIZE];  // Text of the applied filter, guarded by filter_lock
+static std::atomic<bool> filter_editing{false};
+static std::atomic<bool> filter_changed{false};
+static RowFilter row_filter;            // Applied filter, owned by the render thread
+
+// Groups counted by several workers, or flows of the history grouped on the fly, are summed here
+static std::vector<std::pair<FlowID, FlowStats>> merged;    // Summed records, kept between refreshes to reuse their memory
+static std::vector<uint32_t> merge_slots;                   // Positions in merged probed linearly by key hash, UINT32_MAX if free
+
+/**
+ * @brief Function for starting a merge of up to the given number of records.
+ * @param records Number of records to be merged.
+ */
+static void start_merge(size_t records) {
+    // Half empty at most, so probes stay short
+    size_t size = 16;
+    while (size < records * 2) size *= 2;
+    merge_slots.assign(size, UINT32_MAX);
+    merged.clear();
+    merged.reserve(records);
+}
+
+/**
+ * @brief Function for adding a record to the merge, records with the same key are summed.
+ * @param key FlowID of the group.
+ * @param stats FlowStats of the record.
+ * @param swapped Whether the record's transmit direction is the group's receive one.
+ */
+static void merge_record(const FlowID &key, const FlowStats &stats, bool swapped) {
+    size_t mask = merge_slots.size() - 1;
+    size_t slot = flow_hash(key) & mask;
+    while (merge_slots[slot] != UINT32_MAX && !(merged[merge_slots[slot]].first == key)) slot = (slot + 1) & mask;
+
+    if (merge_slots[slot] == UINT32_MAX) {
+        merge_slots[slot] = static_cast<uint32_t>(merged.size());
+        merged.emplace_back(key, FlowStats());
+    }
+
+    // Windowed rates add up, the peak of the sum is only bounded by the sum of the peaks
+    FlowStats &sum = merged[merge_slots[slot]].second;
+    sum.B_tx += swapped ? stats.B_rx : stats.B_tx;
+    sum.B_rx += swapped ? stats.B_tx : stats.B_rx;
+    sum.p_tx += swapped ? stats.p_rx : stats.p_tx;
+    sum.p_rx += swapped ? stats.p_tx : stats.p_rx;
+    sum.error += stats.error;
+    for (int metric = 0; metric < RATE_METRICS; metric++) {
+        sum.rates.tx[metric] += swapped ? stats.rates.rx[metric] : stats.rates.tx[metric];
+        sum.rates.rx[metric] += swapped ? stats.rates.tx[metric] : stats.rates.rx[metric];
+    }
+}
+
+/**
+ * @brief Function for getting the snapshot of a worker the screen shows, its copy while frozen.
+ * @param worker Worker.
+ * @param epoch Interval whose snapshots are displayed.
+ * @return Snapshot.
+ */
+static const Snapshot &shown_snapshot(const Worker &worker, uint32_t epoch) {
+    return frozen ? frozen_snapshots[worker.id] : worker.snapshots[epoch & 1];
+}
+
+/**
+ * @brief Function for collecting the rollup records of the displayed workers, a group counted by several of them is summed.
+ * @param epoch Interval whose snapshots are read.
+ * @param level Aggregation level, not AGGREGATE_FLOW.
+ * @param view Displayed interface, -1 for all of them.
+ * @param vec Filled with references to the records.
+ */
+static void merge_rollups(uint32_t epoch, Aggregation level, int view, std::vector<FlowRef> &vec) {
+    // Fanout spreads the flows of one host over all workers, but a single snapshot needs no merging
+    size_t records = 0, sources = 0;
+    for (auto &worker : workers) {
+        if (view >= 0 && worker->ingress != view) continue;
+        size_t count = shown_snapshot(*worker, epoch).rollups[level - AGGREGATE_PAIR].size();
+        records += count;
+        sources += count > 0;
+    }
+
+    if (sources <= 1) {
+        for (auto &worker : workers) {
+            if (view >= 0 && worker->ingress != view) continue;
+            for (const auto &record : shown_snapshot(*worker, epoch).rollups[level - AGGREGATE_PAIR]) vec.push_back(&record);
+        }
+        return;
+    }
+
+    start_merge(records);
+    for (auto &worker : workers) {
+        if (view >= 0 && worker->ingress != view) continue;
+        for (const auto &record : shown_snapshot(*worker, epoch).rollups[level - AGGREGATE_PAIR]) merge_record(record.first, record.second, false);
+    }
+    for (const auto &record : merged) vec.push_back(&record);
+}
+
+// Rows as last sent to ncurses, a row is drawn again only when its text changes, so an unchanged screen costs no output
+static constexpr size_t LINE_SIZE = 1024;   // Stride of a row, text beyond it is not shown on wider terminals
+static std::vector<char> frame;             // LINE_SIZE bytes per row of the screen, reallocated only on resize
+static std::vector<char> touched;           // Rows drawn in the frame being built, the others are blanked
+static int frame_rows = 0;
+static int frame_cols = 0;
+static int view_row = -1;                   // Row of the view line in the last frame
+
+// Width of the columns other than the two addresses, which share the rest of the terminal
+static constexpr int TABLE_FIXED = 55;
+static constexpr int ADDRESS_MIN = 15;      // Longest IPv4 address
+static constexpr int ADDRESS_MAX = 47;      // Longest IPv6 address in brackets with a port
+static constexpr size_t ENDPOINT_SIZE = 64;
+
+// Scrolling of the list requested by the main thread, applied by the render thread
+static std::atomic<int> list_rows{0};
+static std::atomic<int> list_pages{0};
+static size_t list_first = 0;               // Rank of the first row shown
+
+/**
+ * @brief Function for forgetting the rows on the screen, the next refresh repaints all of it.
+ */
+static void reset_frame() {
+    frame_rows = std::max(LINES, 0);
+    frame_cols = std::max(COLS, 0);
+    frame.assign(static_cast<size_t>(frame_rows) * LINE_SIZE, '\0');
+    touched.assign(static_cast<size_t>(frame_rows), 0);
+    clear();
+}
+
+/**
+ * @brief Function for drawing a row of the frame, nothing is sent to ncurses if the row shows the text already.
+ * @param row Row of the screen, rows below it are skipped.
+ * @param text Text of the row, cut at the width of the screen.
+ */
+static void draw_line(int row, const char *text) {
+    if (LINES != frame_rows || COLS != frame_cols) reset_frame();
+    if (row < 0 || row >= frame_rows) return;
+    touched[row] = 1;
+
+    size_t length = strnlen(text, std::min(static_cast<size_t>(frame_cols), LINE_SIZE - 1));
+    char *drawn = &frame[static_cast<size_t>(row) * LINE_SIZE];
+    if (drawn[length] == '\0' && memcmp(drawn, text, length) == 0) return;
+
+    mvaddnstr(row, 0, text, static_cast<int>(length));
+    if (static_cast<int>(length) < frame_cols) clrtoeol();
+    memcpy(drawn, text, length);
+    drawn[length] = '\0';
+}
+
+/**
+ * @brief Function for blanking the rows the frame didn't draw and sending the changes to the terminal.
+ */
+static void finish_frame() {
+    for (int row = 0; row < frame_rows; row++) {
+        if (!touched[row]) draw_line(row, "");
+        touched[row] = 0;
+    }
+    refresh();
+}
+
+/**
+ * @brief Function for appending formatted text to a row being built.
+ * @param line Row of LINE_SIZE bytes.
+ * @param used Length of the row, advanced by the appended text.
+ * @param format Format of the text as for printf.
+ */
+static void __attribute__((format(printf, 3, 4))) appendf(char *line, size_t &used, const char *format, ...) {
+    if (used >= LINE_SIZE - 1) return;
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(line + used, LINE_SIZE - used, format, args);
+    va_end(args);
+    if (written > 0) used = std::min(used + static_cast<size_t>(written), LINE_SIZE - 1);
+}
+
+/**
+ * @brief Function for updating only the view line while the screen is paused, so the rest stays as it was.
+ */
+static void show_paused() {
+    if (view_row < 0) return;
+    int row = view_row;
+    display_view(row);
+    refresh();
+}
+
+/**
+ * @brief Function for getting the width of the address columns, they share what the terminal has left.
+ * @return Characters of each address column.
+ */
+static int address_width() {
+    return std::max(ADDRESS_MIN, std::min((COLS - TABLE_FIXED) / 2, ADDRESS_MAX));
+}
+
+/**
+ * @brief Function run by the render thread, draws every interval all workers have published.
+ */
+void render_loop() {
+    uint32_t rendered = 0;
+    long history_index = -1;    // Interval of the history on the screen, -1 for the live view
+
+    while (render_running.load()) {
+        // Workers signal a closed interval, the main thread a resize or stop request
+        uint64_t value;
+        if (read(snapshot_fd, &value, sizeof(value)) != sizeof(value)) continue;
+
+        if (resize_pending.exchange(false) && headless_format.empty()) {
+            // Terminal was resized, the interval on the screen is drawn again with columns fitting the new width
+            struct winsize size;
+            if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0) resizeterm(size.ws_row, size.ws_col);
+            reset_frame();
+            refresh();
+            redraw_pending = true;
+        }
+
+        // Stepping from the live view starts at the interval before the one on the screen, the newest one
+        int steps = history_steps.exchange(0);
+        if (steps != 0 || history_index >= 0) {
+            size_t count = history_count();
+            long index = (history_index < 0 ? static_cast<long>(count) - 1 : history_index) + steps;
+            history_index = std::max(0L, std::min(index, static_cast<long>(count) - 1));
+            if (playback_path.empty() && index >= static_cast<long>(count) - 1) history_index = -1;
+            if (count == 0) history_index = -1;
+        }
+
+        // A changed view redraws the interval already on the screen
+        uint32_t epoch = capture_epoch.load();
+        bool redraw = redraw_pending.exchange(false) && rendered != 0;
+        redraw = redraw || (steps != 0 && history_index < 0 && rendered != 0);
+        if (epoch != rendered || redraw) {
+            // Announce the buffers being read before checking them, workers skip publishing into them meanwhile
+            render_epoch.store(epoch);
+            bool complete = capture_epoch.load() <= epoch + 1;
+            for (auto &worker : workers) {
+                complete = complete && worker->published.load() == epoch;
+            }
+
+            if (complete) {
+                // Logged once, the interval is still read by the history view while scrolled back
+                if (epoch != rendered) {
+                    log_interval(epoch);
+                    latest_stats = collect_stats(epoch);
+                }
+                if (history_index < 0 && !paused.load()) {
+                    display_statistics(epoch);
+                } else if (history_index < 0 && redraw) {
+                    show_paused();
+                }
+                if (epoch != rendered) write_stats_file(epoch, latest_stats);
+                rendered = epoch;
+                rendered_epoch.store(epoch);
+            }
+            render_epoch.store(0);
+        }
+
+        // Scrolled back, every wake-up draws the chosen interval again, the count of logged ones grows meanwhile
+        if (history_index >= 0 && !paused.load()) display_history(static_cast<size_t>(history_index), history_count());
+        if (history_index >= 0 && paused.load()) show_paused();
+
+        // Headless replay exits once the last interval has been written out
+        if (!headless_format.empty() && capture_finished.load() && rendered == capture_epoch.load()) kill(getpid(), SIGINT);
+    }
+}
+
+/**
+ * @brief Function for starting the render thread.
+ */
+void start_render() {
+    render_running = true;
+    render_thread = std::thread(render_loop);
+}
+
+/**
+ * @brief Function for stopping the render thread.
+ */
+void stop_render() {
+    render_running = false;
+    uint64_t one = 1;
+    if (write(snapshot_fd, &one, sizeof(one)) != sizeof(one)) return;
+    if (render_thread.joinable()) render_thread.join();
+}
+
+/**
+ * @brief Function for drawing the interval on the screen again, wakes the render thread from any thread.
+ */
+void request_redraw() {
+    redraw_pending = true;
+    uint64_t one = 1;
+    if (write(snapshot_fd, &one, sizeof(one)) != sizeof(one)) return;
+}
+
+/**
+ * @brief Function for switching to the next interface view, the merged view follows the last interface.
+ */
+void switch_view() {
+    int count = static_cast<int>(interfaces.size());
+    if (count < 2) return;
+
+    int view = view_interface.load() + 1;
+    view_interface.store(view >= count ? -1 : view);
+    request_redraw();
+}
+
+/**
+ * @brief Function for switching to the next aggregation level, the flows follow the last one.
+ */
+void switch_aggregation() {
+    int level = view_aggregation.load() + 1;
+    view_aggregation.store(level >= AGGREGATIONS ? AGGREGATE_FLOW : level);
+    request_redraw();
+}
+
 /**
- * @brief Function for displaying the collected statistics using ncurses.
+ * @brief Function for scrolling through the logged intervals, stepping past the newest one returns to the live view.
+ * @param steps Intervals to step, negative towards older ones.
  */
-void display_statistics() {
+void scroll_history(int steps) {
+    // Steps are summed until the render thread takes them, Home and End saturate instead of overflowing
+    int pending = history_steps.load();
+    int sum;
+    do {
+        sum = static_cast<int>(std::max<long>(-HISTORY_JUMP, std::min<long>(static_cast<long>(pending) + steps, HISTORY_JUMP)));
+    } while (!history_steps.compare_exchange_weak(pending, sum));
+    uint64_t one = 1;
+    if (write(snapshot_fd, &one, sizeof(one)) != sizeof(one)) return;
+}
 
-    trim_flows();
+/**
+ * @brief Function for scrolling the list of flows, the position is clamped to the list when it is drawn.
+ * @param rows Rows to scroll, negative towards the top.
+ * @param pages Pages to scroll, negative towards the top.
+ */
+void scroll_list(int rows, int pages) {
+    list_rows += rows;
+    list_pages += pages;
+    request_redraw();
+}
 
-    // Vector for holding data flows used then for sorting and displaying
-    std::vector<std::pair<FlowID, FlowStats>> vec(flows.begin(), flows.end());
+/**
+ * @brief Function for applying the requested scrolling of the list, the last page is kept full.
+ * @param total Number of rows of the list.
+ * @param page Number of rows shown at once.
+ * @return Rank of the first row shown.
+ */
+static size_t list_position(size_t total, size_t page) {
+    long first = static_cast<long>(list_first) + list_rows.exchange(0) + static_cast<long>(list_pages.exchange(0)) * static_cast<long>(page);
+    long last = total > page ? static_cast<long>(total - page) : 0;
+    list_first = static_cast<size_t>(std::max(0L, std::min(first, last)));
+    return list_first;
+}
 
-    sort_flows(vec);
+/**
+ * @brief Function for switching to the next sort key, bytes follow the last one.
+ */
+void switch_sort() {
+    int key = view_sort.load() + 1;
+    view_sort.store(key >= SORT_KEYS ? SORT_BYTES : key);
+    request_redraw();
+}
 
-    clear(); // Clear terminal
+/**
+ * @brief Function for switching to the next resolve mode, numbers follow showing every name.
+ */
+void switch_resolve() {
+    int mode = view_resolve.load() + 1;
+    view_resolve.store(mode >= RESOLVE_MODES ? RESOLVE_OFF : mode);
+    request_redraw();
+}
 
-    display_header();
+/**
+ * @brief Function for showing one row more or less, steps start from the rows the screen has room for.
+ * @param delta Positive for one row more, negative for one less.
+ */
+void change_rows(int delta) {
+    // -n all or a short terminal shows fewer rows than requested, stepping from the request would seem to do nothing
+    size_t rows = std::min(view_count.load(), last_page.load());
+    if (delta < 0 && rows > 1) rows--;
+    if (delta > 0) rows++;
+    view_count.store(rows);
+    request_redraw();
+}
+
+/**
+ * @brief Function for stopping or resuming the refresh of the screen, capture and logging go on meanwhile.
+ */
+void toggle_pause() {
+    paused = !paused.load();
+    request_redraw();
+}
+
+/**
+ * @brief Function for holding the interval on the screen or returning to the live one, the held one can still be sorted and filtered.
+ */
+void toggle_freeze() {
+    // The snapshots can only be copied by the render thread while it has them announced
+    freeze_pending = true;
+    request_redraw();
+}
+
+/**
+ * @brief Function for telling whether keys are being typed into the filter.
+ * @return True while the filter is edited.
+ */
+bool editing_filter() {
+    return filter_editing.load();
+}
+
+/**
+ * @brief Function for starting to type a filter, the previous one is shown for editing.
+ */
+void start_filter() {
+    {
+        std::lock_guard<std::mutex> lock(filter_lock);
+        memcpy(filter_input, filter_typed, sizeof(filter_input));
+    }
+    filter_editing = true;
+    request_redraw();
+}
+
+/**
+ * @brief Function for editing the filter, Enter applies it, Esc drops the changes, an empty filter shows every row.
+ * @param key Key typed.
+ */
+void edit_filter(char key) {
+    {
+        std::lock_guard<std::mutex> lock(filter_lock);
+        size_t length = strlen(filter_input);
+        if (key == '\r' || key == '\n') {
+            memcpy(filter_typed, filter_input, sizeof(filter_typed));
+            filter_editing = false;
+            filter_changed = true;
+        } else if (key == '\033') {
+            filter_editing = false;
+        } else if ((key == 0x7f || key == '\b') && length > 0) {
+            filter_input[length - 1] = '\0';
+        } else if (isprint(static_cast<unsigned char>(key)) && length < FILTER_SIZE - 1) {
+            filter_input[length] = key;
+            filter_input[length + 1] = '\0';
+        }
+    }
+    request_redraw();
+}
+
+/**
+ * @brief Function for formatting an endpoint of a row.
+ * @param ip IP address in binary form.
+ * @param family Address family (AF_INET/AF_INET6).
+ * @param address Whether the address is shown, a wildcard otherwise.
+ * @param prefix Prefix length appended to the address, -1 for none.
+ * @param port Port appended to the address, -1 for none.
+ * @param proto IP protocol number the port belongs to.
+ * @param request Whether names missing from the cache are looked up, only for rows on the screen.
+ * @param buffer Buffer for the text, ENDPOINT_SIZE bytes fit every endpoint.
+ * @return The buffer.
+ */
+static const char *format_endpoint(const uint8_t *ip, uint8_t family, bool address, int prefix, int port, uint8_t proto, bool request, char *buffer) {
+    // Names are shown once they are cached, numbers until then, networks of the prefix level stay numeric
+    int resolve = view_resolve.load();
+    char text[ENDPOINT_SIZE];
+    const char *host = "*";
+    if (address) {
+        host = prefix < 0 && (resolve & RESOLVE_HOSTS) && lookup_host(ip, family, request, text, sizeof(text))
+                   ? text : format_ip(ip, family, text, sizeof(text));
+    }
+    int length = snprintf(buffer, ENDPOINT_SIZE, "%s", host);
+    if (prefix >= 0) length += snprintf(buffer + length, ENDPOINT_SIZE - length, "/%d", prefix);
+    if (port < 0) return buffer;
+    if ((resolve & RESOLVE_SERVICES) && lookup_service(static_cast<uint16_t>(port), proto, request, text, sizeof(text))) {
+        snprintf(buffer + length, ENDPOINT_SIZE - length, ":%s", text);
+    } else {
+        snprintf(buffer + length, ENDPOINT_SIZE - length, ":%d", port);
+    }
+    return buffer;
+}
+
+/**
+ * @brief Function for formatting the endpoints and the protocol of a row, merged fields are wildcards.
+ * @param key FlowID of the row.
+ * @param level Aggregation level of the key.
+ * @param source Buffer for the source, ENDPOINT_SIZE bytes.
+ * @param destination Buffer for the destination, ENDPOINT_SIZE bytes.
+ * @param number Buffer for the number of an unnamed protocol, FORMAT_RATE_SIZE bytes.
+ * @param request Whether names missing from the cache are looked up, only for rows on the screen.
+ * @return Protocol name.
+ */
+static const char *format_key(const FlowID &key, Aggregation level, char *source, char *destination, char *number, bool request) {
+    // ICMP connections should not include port numbers
+    unsigned fields = AGGREGATION_FIELDS[level];
+    bool ports = key.proto != IPPROTO_ICMP && key.proto != IPPROTO_ICMPV6;
+    int prefix = level == AGGREGATE_PREFIX ? (key.family == AF_INET6 ? prefix_v6 : prefix_v4) : -1;
+    format_endpoint(key.ip1, key.family, fields & FIELD_SRC_IP, prefix, ports && (fields & FIELD_SRC_PORT) ? key.port1 : -1, key.proto, request, source);
+    format_endpoint(key.ip2, key.family, fields & FIELD_DST_IP, -1, ports && (fields & FIELD_DST_PORT) ? key.port2 : -1, key.proto, request, destination);
+    return fields & FIELD_PROTO ? format_proto(key.proto, number, FORMAT_RATE_SIZE) : "*";
+}
+
+/**
+ * @brief Function for parsing a filter, a number is a port, an address with an optional prefix length an endpoint, anything else a text.
+ * @param text Filter as typed.
+ * @param filter Parsed filter, NONE for an empty text.
+ */
+static void parse_filter(const char *text, RowFilter &filter) {
+    filter = RowFilter();
+    if (text[0] == '\0') return;
+    snprintf(filter.text, sizeof(filter.text), "%s", text);
+
+    char *end;
+    unsigned long port = strtoul(text, &end, 10);
+    if (isdigit(static_cast<unsigned char>(text[0])) && *end == '\0' && port <= UINT16_MAX) {
+        filter.kind = RowFilter::PORT;
+        filter.port = static_cast<uint16_t>(port);
+        return;
+    }
+
+    // IPv6 addresses may be typed in brackets as they are shown
+    char address[FILTER_SIZE];
+    snprintf(address, sizeof(address), "%s", text[0] == '[' ? text + 1 : text);
+    char *slash = strchr(address, '/');
+    if (slash != nullptr) *slash = '\0';
+    size_t length = strlen(address);
+    if (text[0] == '[' && length > 0 && address[length - 1] == ']') address[length - 1] = '\0';
+
+    int max_bits = 0;
+    if (inet_pton(AF_INET, address, filter.ip) == 1) {
+        filter.family = AF_INET;
+        max_bits = 32;
+    } else if (inet_pton(AF_INET6, address, filter.ip) == 1) {
+        filter.family = AF_INET6;
+        max_bits = 128;
+    } else {
+        filter.kind = RowFilter::TEXT;
+        return;
+    }
+
+    filter.bits = max_bits;
+    if (slash != nullptr) {
+        long bits = strtol(slash + 1, &end, 10);
+        if (slash[1] == '\0' || *end != '\0' || bits < 0 || bits > max_bits) {
+            filter.kind = RowFilter::TEXT;
+            return;
+        }
+        filter.bits = static_cast<int>(bits);
+    }
+    filter.kind = RowFilter::ADDRESS;
+}
+
+/**
+ * @brief Function for comparing the leading bits of two addresses.
+ * @param ip Address of a row.
+ * @param network Address of the filter.
+ * @param bits Number of leading bits compared.
+ * @return True if the bits are equal.
+ */
+static bool prefix_match(const uint8_t *ip, const uint8_t *network, int bits) {
+    int bytes = bits / 8;
+    if (memcmp(ip, network, static_cast<size_t>(bytes)) != 0) return false;
+    if (bits % 8 == 0) return true;
+    uint8_t mask = static_cast<uint8_t>(0xff << (8 - bits % 8));
+    return (ip[bytes] & mask) == (network[bytes] & mask);
+}
+
+/**
+ * @brief Function for checking whether a row passes the filter, only fields shown at the level are compared.
+ * @param filter Parsed filter.
+ * @param key FlowID of the row.
+ * @param level Aggregation level of the row.
+ * @return True if the row is shown.
+ */
+static bool filter_match(const RowFilter &filter, const FlowID &key, Aggregation level) {
+    unsigned fields = AGGREGATION_FIELDS[level];
+    switch (filter.kind) {
+        case RowFilter::NONE:
+            return true;
+        case RowFilter::PORT:
+            return ((fields & FIELD_SRC_PORT) && key.port1 == filter.port) || ((fields & FIELD_DST_PORT) && key.port2 == filter.port);
+        case RowFilter::ADDRESS: {
+            if (key.family != filter.family) return false;
+
+            // A network of the prefix level matches the addresses inside it
+            int bits = filter.bits;
+            if (level == AGGREGATE_PREFIX) bits = std::min(bits, key.family == AF_INET6 ? prefix_v6 : prefix_v4);
+            return ((fields & FIELD_SRC_IP) && prefix_match(key.ip1, filter.ip, bits)) ||
+                   ((fields & FIELD_DST_IP) && prefix_match(key.ip2, filter.ip, bits));
+        }
+        case RowFilter::TEXT: {
+            // Looked up in the row as it is shown, with names already cached, rows off the screen never queue lookups
+            char source[ENDPOINT_SIZE], destination[ENDPOINT_SIZE], number[FORMAT_RATE_SIZE];
+            const char *proto = format_key(key, level, source, destination, number, false);
+            return strstr(source, filter.text) != nullptr || strstr(destination, filter.text) != nullptr ||
+                   strstr(proto, filter.text) != nullptr ||
+                   (interfaces.size() > 1 && strstr(interfaces[key.ingress].c_str(), filter.text) != nullptr);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Function for dropping the rows the filter doesn't pass, a changed filter is parsed first.
+ * @param vec Vector of references to the rows.
+ * @param level Aggregation level of the rows.
+ */
+static void filter_rows(std::vector<FlowRef> &vec, Aggregation level) {
+    if (filter_changed.exchange(false)) {
+        char typed[FILTER_SIZE];
+        {
+            std::lock_guard<std::mutex> lock(filter_lock);
+            memcpy(typed, filter_typed, sizeof(typed));
+        }
+        parse_filter(typed, row_filter);
+        list_first = 0;
+    }
+    if (row_filter.kind == RowFilter::NONE) return;
+    vec.erase(std::remove_if(vec.begin(), vec.end(), [level](FlowRef ref) { return !filter_match(row_filter, ref->first, level); }), vec.end());
+}
+
+/**
+ * @brief Function for displaying the collected statistics using ncurses, or writing them out in headless mode.
+ * @param epoch Interval whose snapshots are displayed.
+ */
+void display_statistics(uint32_t epoch) {
+    uint64_t start = monotonic_ns();
+
+    // References to data flows used then for selecting and displaying, kept between refreshes to reuse its memory
+    static std::vector<FlowRef> vec;
+    vec.clear();
+
+    // Freezing copies the snapshots, they are announced as read now, so no worker publishes into them meanwhile
+    if (freeze_pending.exchange(false)) {
+        frozen = !frozen;
+        if (frozen) {
+            frozen_snapshots.resize(workers.size());
+            for (auto &worker : workers) frozen_snapshots[worker->id] = worker->snapshots[epoch & 1];
+            frozen_epoch = epoch;
+        }
+    }
+
+    // Merge the snapshots of all workers, each flow lives in exactly one of them, groups are summed
+    int view = view_interface.load();
+    Aggregation level = static_cast<Aggregation>(view_aggregation.load());
+    uint64_t closed = 0;
+    for (auto &worker : workers) {
+        if (view >= 0 && worker->ingress != view) continue;
+        const Snapshot &snapshot = shown_snapshot(*worker, epoch);
+        if (level == AGGREGATE_FLOW) {
+            for (const auto &flow : snapshot.flows) vec.push_back(&flow);
+        }
+        closed = std::max(closed, snapshot.closed);
+    }
+    if (level != AGGREGATE_FLOW) merge_rollups(epoch, level, view, vec);
+
+    // Only the rows on the screen are selected and sorted, so drawing costs the same however many flows there are
+    // Rows below the flows: blank, workers, flows, aggregation, capture, latency, view and the interface view
+    int footer = 7 + (interfaces.size() > 1);
+    size_t first = 0;
+    size_t count = std::min(vec.size(), top_count);
+    if (headless_format.empty()) {
+        filter_rows(vec, level);
+        size_t page = std::min(static_cast<size_t>(std::max(LINES - 3 - footer, 0)), view_count.load());
+        last_page = static_cast<size_t>(std::max(LINES - 3 - footer, 0));
+        first = list_position(vec.size(), page);
+        count = std::min(vec.size() - first, page);
+    }
+    sort_flows(vec, first, count);
+    uint64_t sorted = monotonic_ns();
+    record_latency(merge_times, sorted - start);
+
+    if (!headless_format.empty()) {
+        output_flows(epoch, closed, level, vec, count);
+        record_latency(render_times, monotonic_ns() - sorted);
+        return;
+    }
+
+    display_header(level);
 
     int row = 3;    // Starting row for network statistics
-    int count = 0;  // Number of currently displayed flows
-    for (const auto &entry : vec) {
-        if (count++ >= 10) break;   // Display only top 10 flows
+    for (size_t i = first; i < first + count; i++) {
+        display_flow(vec[i]->first, vec[i]->second, level, row);
+    }
 
-        display_flow(entry.first, entry.second, row);
+    display_workers(epoch, row);
+    display_aggregation(level, vec.size(), first, count, row);
+    display_status(latest_stats, row);
+    display_view(row);
+
+    finish_frame(); // Send the changed rows to the terminal
+    record_latency(render_times, monotonic_ns() - sorted);
+}
+
+/**
+ * @brief Function for displaying an interval read back from the history.
+ * @param index Interval index in the history.
+ * @param count Number of intervals in the history.
+ */
+void display_history(size_t index, size_t count) {
+    // Flows are decoded from the mapping into a vector kept between refreshes to reuse its memory
+    static std::vector<std::pair<FlowID, FlowStats>> flows;
+    static std::vector<FlowRef> vec;
+    uint32_t epoch;
+    uint64_t time_ms;
+    if (!read_history(index, epoch, time_ms, flows)) return;
+
+    int view = view_interface.load();
+    Aggregation level = static_cast<Aggregation>(view_aggregation.load());
+    vec.clear();
+    if (level == AGGREGATE_FLOW) {
+        for (const auto &flow : flows) {
+            if (view >= 0 && flow.first.ingress != view) continue;
+            vec.push_back(&flow);
+        }
+    } else {
+        // Only flows are logged, their groups are summed when the interval is read back
+        start_merge(flows.size());
+        for (const auto &flow : flows) {
+            if (view >= 0 && flow.first.ingress != view) continue;
+            bool swapped;
+            FlowID key = rollup_key(flow.first, level, static_cast<uint8_t>(prefix_v4), static_cast<uint8_t>(prefix_v6), swapped);
+            merge_record(key, flow.second, swapped);
+        }
+        for (const auto &record : merged) vec.push_back(&record);
     }
 
-    refresh(); // Refresh terminal
+    // Rows below the flows: blank, aggregation, position, keys, view and the interface view
+    int footer = 5 + (interfaces.size() > 1);
+    filter_rows(vec, level);
+    size_t page = std::min(static_cast<size_t>(std::max(LINES - 3 - footer, 0)), view_count.load());
+    last_page = static_cast<size_t>(std::max(LINES - 3 - footer, 0));
+    size_t first = list_position(vec.size(), page);
+    size_t shown = std::min(vec.size() - first, page);
+    sort_flows(vec, first, shown);
 
-    reset_flow_statistics();
+    display_header(level);
+    int row = 3;
+    for (size_t i = first; i < first + shown; i++) {
+        display_flow(vec[i]->first, vec[i]->second, level, row);
+    }
+    row++;
+    display_aggregation(level, vec.size(), first, shown, row);
+
+    char ended[32];
+    time_t seconds = static_cast<time_t>(time_ms / 1000);
+    struct tm local;
+    strftime(ended, sizeof(ended), "%Y-%m-%d %H:%M:%S", localtime_r(&seconds, &local));
+    char line[LINE_SIZE];
+    snprintf(line, sizeof(line), "History: interval %zu/%zu (epoch %u) ended %s, %zu flows", index + 1, count, epoch, ended, vec.size());
+    draw_line(row++, line);
+    if (playback_path.empty()) {
+        draw_line(row++, "Left/Right step, Home oldest, End or Right past the newest back to live");
+    } else {
+        draw_line(row++, "Left/Right step, Home oldest, End newest");
+    }
+    display_view(row);
+    if (interfaces.size() > 1) {
+        if (view < 0) {
+            snprintf(line, sizeof(line), "Interfaces: all %zu merged, press i to switch", interfaces.size());
+        } else {
+            snprintf(line, sizeof(line), "Interfaces: %s (%d/%zu), press i to switch", interfaces[view].c_str(), view + 1, interfaces.size());
+        }
+        draw_line(row, line);
+    }
+
+    finish_frame();
+}
+
+/**
+ * @brief Function for summing the instrumentation of the displayed workers and the render thread.
+ * @param epoch Interval whose snapshots are summed.
+ * @return Instrumentation of the interval, the render thread's timings are reset.
+ */
+IntervalStats collect_stats(uint32_t epoch) {
+    IntervalStats stats;
+    int view = view_interface.load();
+    for (auto &worker : workers) {
+        if (view >= 0 && worker->ingress != view) continue;
+        const Snapshot &snapshot = worker->snapshots[epoch & 1];
+        add_counters(stats.interval, snapshot.interval);
+        add_counters(stats.total, snapshot.total);
+        merge_latency(stats.parse, snapshot.parse);
+        merge_latency(stats.update, snapshot.update);
+    }
+
+    stats.merge = merge_times;
+    stats.render = render_times;
+    merge_times = LatencyHistogram();
+    render_times = LatencyHistogram();
+    return stats;
 }
 
 /**
  * @brief Function for printing the header of the statistics table.
+ * @param level Aggregation level of the rows.
  */
-void display_header() {
-    mvprintw(0, 0, "|                                    |                                    |       |         Rx        |         Tx        |");
-    mvprintw(1, 0, "| %-34s | %-34s | %-5s | %-7s | %-7s | %-7s | %-7s |",
-             "Src IP:port", "Dst IP:port", "Proto", "b/s", "p/s", "b/s", "p/s");
-    mvprintw(2, 0, "+------------------------------------+------------------------------------+-------+---------+---------+---------+---------+");
+void display_header(Aggregation level) {
+    // The averaging of the b/s columns is named above them, the interval needs no name
+    char rx[20], tx[20];
+    if (rate_metric(rate_mode) == RATE_METRICS) {
+        snprintf(rx, sizeof(rx), "Rx");
+        snprintf(tx, sizeof(tx), "Tx");
+    } else {
+        snprintf(rx, sizeof(rx), "Rx %s", rate_mode.c_str());
+        snprintf(tx, sizeof(tx), "Tx %s", rate_mode.c_str());
+    }
+    int width = address_width();
+    char line[LINE_SIZE];
+    snprintf(line, sizeof(line), "|%*s|%*s|       |%*s%*s|%*s%*s|", width + 2, "", width + 2, "",
+             static_cast<int>(10 + strlen(rx) / 2), rx, static_cast<int>(9 - strlen(rx) / 2), "",
+             static_cast<int>(10 + strlen(tx) / 2), tx, static_cast<int>(9 - strlen(tx) / 2), "");
+    draw_line(0, line);
+
+    // Merged endpoints are named by what is left of them
+    static const char *sources[AGGREGATIONS] = {"Src IP:port", "Src IP", "Src IP", "Src prefix", "Clients", "Src"};
+    static const char *destinations[AGGREGATIONS] = {"Dst IP:port", "Dst IP", "Peers", "Peers", "Service", "Dst"};
+    snprintf(line, sizeof(line), "| %-*s | %-*s | %-5s | %-7s | %-7s | %-7s | %-7s |",
+             width, sources[level], width, destinations[level], "Proto", "b/s", "p/s", "b/s", "p/s");
+    draw_line(1, line);
+
+    // Address columns stretch with the terminal, the rest of the rule is fixed
+    char dashes[ADDRESS_MAX + 3];
+    memset(dashes, '-', static_cast<size_t>(width) + 2);
+    dashes[width + 2] = '\0';
+    snprintf(line, sizeof(line), "+%s+%s+-------+---------+---------+---------+---------+", dashes, dashes);
+    draw_line(2, line);
 }
 
 /**
  * @brief Function for displaying the startup message.
  */
 void display_startup() {
-    mvprintw(0, 0, "LOADING...");
-    refresh();
+    draw_line(0, "LOADING...");
+    finish_frame();
+}
+
+/**
+ * @brief Function for getting the byte rate of one direction of a flow.
+ * @param stats FlowStats.
+ * @param tx Whether the transmit direction is wanted, receive otherwise.
+ * @param metric Window of the rate, RATE_METRICS for the refresh interval.
+ * @return Bytes per second.
+ */
+double byte_rate(const FlowStats &stats, bool tx, RateMetric metric) {
+    if (metric == RATE_METRICS) return static_cast<double>(tx ? stats.B_tx : stats.B_rx) * 1000 / refresh_ms;
+    return tx ? stats.rates.tx[metric] : stats.rates.rx[metric];
 }
 
 /**
  * @brief Function for printing a single flow's statistics.
  * @param key FlowID.
  * @param stats FlowStats.
+ * @param level Aggregation level of the key, merged fields are printed as wildcards.
+ * @param row Current row in the display.
+ */
+void display_flow(const FlowID &key, const FlowStats &stats, Aggregation level, int &row) {
+    // Calculate and format values of b/s from the chosen window and p/s from the interval, all into buffers on the stack
+    double seconds = static_cast<double>(refresh_ms) / 1000;
+    RateMetric metric = rate_metric(rate_mode);
+    char rx_bits[FORMAT_RATE_SIZE], tx_bits[FORMAT_RATE_SIZE], rx_packets[FORMAT_RATE_SIZE], tx_packets[FORMAT_RATE_SIZE];
+    format_bits(byte_rate(stats, false, metric) * 8, rx_bits, sizeof(rx_bits));
+    format_bits(byte_rate(stats, true, metric) * 8, tx_bits, sizeof(tx_bits));
+    format_packets(static_cast<double>(stats.p_rx) / seconds, rx_packets, sizeof(rx_packets));
+    format_packets(static_cast<double>(stats.p_tx) / seconds, tx_packets, sizeof(tx_packets));
+
+    // Format IP addresses and protocol, merged fields are wildcards
+    char source[ENDPOINT_SIZE], destination[ENDPOINT_SIZE], number[FORMAT_RATE_SIZE];
+    const char *proto = format_key(key, level, source, destination, number, true);
+
+    // Addresses longer than their column are cut, the columns widen with the terminal
+    int width = address_width();
+    char line[LINE_SIZE];
+    size_t used = 0;
+    appendf(line, used, "| %-*.*s | %-*.*s | %-5s | %-7s | %-7s | %-7s | %-7s |",
+            width, width, source, width, width, destination, proto,
+            rx_bits, rx_packets, tx_bits, tx_packets);
+
+    // Flows of all interfaces are listed together, each is marked with the one it was captured on
+    if (interfaces.size() > 1 && view_interface.load() < 0) {
+        appendf(line, used, " @%s", interfaces[key.ingress].c_str());
+    }
+
+    // Counted by the sketch, the flow may have sent up to this much more before it got a counter
+    if (stats.error > 0) {
+        double error = static_cast<double>(stats.error) / seconds;
+        char bound[FORMAT_RATE_SIZE];
+        appendf(line, used, " +%s", sort_order == 'b' ? format_bits(error * 8, bound, sizeof(bound)) : format_packets(error, bound, sizeof(bound)));
+    }
+    draw_line(row++, line);
+}
+
+/**
+ * @brief Function for printing packet rates of capture workers, shows skew of the fanout.
+ * @param epoch Interval whose snapshots are displayed.
  * @param row Current row in the display.
  */
-void display_flow(const FlowID &key, const FlowStats &stats, int &row) {
-    // Calculate and format values of b/s and p/s
-    std::string rx_bits_str = format_bits(static_cast<double>((stats.B_rx * 8)) / refresh_interval);
-    std::string tx_bits_str = format_bits(static_cast<double>((stats.B_tx * 8)) / refresh_interval);
-    std::string rx_packets_str = format_packets(static_cast<double>(stats.p_rx) / refresh_interval);
-    std::string tx_packets_str = format_packets(static_cast<double>(stats.p_tx) / refresh_interval);
-
-    // Format IP addresses
-    std::string ip1 = format_ip(key.ip1);
-    std::string ip2 = format_ip(key.ip2);
-
-    // Print the data for this connection
-    if (key.proto == "icmp" || key.proto == "icmp6") {
-        // ICMP connections should not include port numbers
-        mvprintw(row++, 0, "| %-34s | %-34s | %-5s | %-7s | %-7s | %-7s | %-7s |",
-                 ip1.c_str(), ip2.c_str(), key.proto.c_str(),
-                 rx_bits_str.c_str(), rx_packets_str.c_str(),
-                 tx_bits_str.c_str(), tx_packets_str.c_str());
+void display_workers(uint32_t epoch, int &row) {
+    row++;
+    char line[LINE_SIZE];
+    size_t used = 0;
+    appendf(line, used, "Workers:");
+    size_t tracked = 0, capacity = 0;
+    uint64_t evicted = 0, dropped = 0;
+    unsigned approximate = 0, shown = 0;
+    int view = view_interface.load();
+    for (auto &worker : workers) {
+        if (view >= 0 && worker->ingress != view) continue;
+        shown++;
+        const Snapshot &snapshot = shown_snapshot(*worker, epoch);
+        char rate[FORMAT_RATE_SIZE];
+        format_packets(static_cast<double>(snapshot.packets) * 1000 / refresh_ms, rate, sizeof(rate));
+        if (interfaces.size() > 1) {
+            appendf(line, used, " #%u@%s %s p/s", worker->id, interfaces[worker->ingress].c_str(), rate);
+        } else {
+            appendf(line, used, " #%u %s p/s", worker->id, rate);
+        }
+        tracked += snapshot.tracked;
+        capacity += worker->flows.table.capacity();
+        evicted += snapshot.evicted;
+        dropped += snapshot.dropped;
+        approximate += snapshot.approximate;
+    }
+    draw_line(row++, line);
+
+    // Flow table usage, evictions and drops show that the flow limit is too low for the traffic
+    used = 0;
+    appendf(line, used, "Flows: %zu/%zu, evicted %llu, dropped %llu packets", tracked, capacity,
+            static_cast<unsigned long long>(evicted), static_cast<unsigned long long>(dropped));
+    if (approximate > 0) {
+        appendf(line, used, ", sketch on %u/%u workers (+ marks the error bound)", approximate, shown);
+    }
+    draw_line(row++, line);
+
+    if (interfaces.size() > 1) {
+        if (view < 0) {
+            snprintf(line, sizeof(line), "Interfaces: all %zu merged, press i to switch", interfaces.size());
+        } else {
+            snprintf(line, sizeof(line), "Interfaces: %s (%d/%zu), press i to switch", interfaces[view].c_str(), view + 1, interfaces.size());
+        }
+        draw_line(row++, line);
+    }
+}
+
+/**
+ * @brief Function for printing the aggregation level of the rows and the part of the list on the screen.
+ * @param level Aggregation level of the rows.
+ * @param groups Number of flows or groups of the interval.
+ * @param first Rank of the first row shown.
+ * @param shown Number of rows shown.
+ * @param row Current row in the display.
+ */
+void display_aggregation(Aggregation level, size_t groups, size_t first, size_t shown, int &row) {
+    char line[LINE_SIZE];
+    size_t from = shown > 0 ? first + 1 : 0;
+    if (level == AGGREGATE_FLOW) {
+        snprintf(line, sizeof(line), "Aggregation: none, flows %zu-%zu of %zu (PgUp/PgDn), press a to group by pair, host, prefix, port or protocol",
+                 from, first + shown, groups);
+    } else {
+        snprintf(line, sizeof(line), "Aggregation: %s, groups %zu-%zu of %zu (PgUp/PgDn), press a to switch",
+                 AGGREGATION_NAMES[level], from, first + shown, groups);
+    }
+    draw_line(row++, line);
+}
+
+/**
+ * @brief Function for printing the status lines, they tell whether the displayed numbers are complete.
+ * @param stats Instrumentation of the interval.
+ * @param row Current row in the display.
+ */
+void display_status(const IntervalStats &stats, int &row) {
+    // Drops are relative to everything the kernel saw, delivered or not
+    const CaptureCounters &interval = stats.interval;
+    uint64_t seen = interval.received + interval.kernel_drops;
+    double drop_ratio = seen > 0 ? 100.0 * static_cast<double>(interval.kernel_drops) / static_cast<double>(seen) : 0;
+    char received[FORMAT_RATE_SIZE];
+    format_packets(static_cast<double>(interval.received) * 1000 / refresh_ms, received, sizeof(received));
+    char line[LINE_SIZE];
+    snprintf(line, sizeof(line), "Capture: %s p/s, kernel drops %llu (%.2f%%, %llu total), interface drops %llu, unsupported %llu, truncated %llu",
+             received, static_cast<unsigned long long>(interval.kernel_drops), drop_ratio,
+             static_cast<unsigned long long>(stats.total.kernel_drops), static_cast<unsigned long long>(interval.if_drops),
+             static_cast<unsigned long long>(interval.unsupported), static_cast<unsigned long long>(interval.truncated));
+    draw_line(row++, line);
+
+    // Parse and update are measured per batch and shown per packet, the p99 is of whole batches
+    uint64_t packets = std::max<uint64_t>(interval.received, 1);
+    char parse[16], parse_p99[16], update[16], update_p99[16], merge[16], render[16];
+    format_duration(static_cast<double>(stats.parse.total_ns) / packets, parse, sizeof(parse));
+    format_duration(static_cast<double>(latency_percentile(stats.parse, 0.99)), parse_p99, sizeof(parse_p99));
+    format_duration(static_cast<double>(stats.update.total_ns) / packets, update, sizeof(update));
+    format_duration(static_cast<double>(latency_percentile(stats.update, 0.99)), update_p99, sizeof(update_p99));
+    format_duration(stats.merge.count > 0 ? static_cast<double>(stats.merge.total_ns) / stats.merge.count : 0, merge, sizeof(merge));
+    format_duration(stats.render.count > 0 ? static_cast<double>(stats.render.total_ns) / stats.render.count : 0, render, sizeof(render));
+    snprintf(line, sizeof(line), "Latency: parse %s/p (p99 %s/batch), update %s/p (p99 %s/batch), merge+sort %s, render %s",
+             parse, parse_p99, update, update_p99, merge, render);
+    draw_line(row++, line);
+}
+
+/**
+ * @brief Function for printing the sort key, the row count, the filter and the state of the screen with their keys.
+ * @param row Current row in the display.
+ */
+void display_view(int &row) {
+    char line[LINE_SIZE];
+    size_t used = 0;
+    view_row = row;
+    if (filter_editing.load()) {
+        // Typed keys go to the filter until Enter or Esc
+        std::lock_guard<std::mutex> lock(filter_lock);
+        appendf(line, used, "Filter: %s_ (port, address[/bits] or text, Enter to apply, Esc to cancel)", filter_input);
+        draw_line(row++, line);
+        return;
+    }
+
+    size_t rows = view_count.load();
+    appendf(line, used, "Sort: %s (s), rows: ", SORT_NAMES[view_sort.load()]);
+    if (rows == SIZE_MAX) {
+        appendf(line, used, "all (+/-)");
     } else {
-        mvprintw(row++, 0, "| %-34s | %-34s | %-5s | %-7s | %-7s | %-7s | %-7s |",
-                 (ip1 + ":" + key.port1).c_str(), (ip2 + ":" + key.port2).c_str(), key.proto.c_str(),
-                 rx_bits_str.c_str(), rx_packets_str.c_str(),
-                 tx_bits_str.c_str(), tx_packets_str.c_str());
+        appendf(line, used, "%zu (+/-)", rows);
     }
+    if (row_filter.kind == RowFilter::NONE) {
+        appendf(line, used, ", filter: none (/)");
+    } else {
+        appendf(line, used, ", filter: %s (/)", row_filter.text);
+    }
+    if (frozen) {
+        appendf(line, used, ", FROZEN at epoch %u (f)", frozen_epoch);
+    } else {
+        appendf(line, used, ", freeze (f)");
+    }
+    appendf(line, used, paused.load() ? ", PAUSED (space)" : ", pause (space)");
+    appendf(line, used, ", names: %s (n)", RESOLVE_NAMES[view_resolve.load()]);
+    size_t pending = resolver_pending();
+    if (pending > 0) appendf(line, used, " %zu pending", pending);
+    draw_line(row++, line);
+}
+
+/**
+ * @brief Function for placing the flows of the given ranks sorted at their positions.
+ * @param vec Vector of references to flow entries.
+ * @param first Rank of the first flow to be placed.
+ * @param count Number of flows to be placed.
+ * @param compare Order of the flows, the heaviest first.
+ */
+template <typename Compare>
+static void select_flows(std::vector<FlowRef> &vec, size_t first, size_t count, Compare compare) {
+    // Flows ranked above the page are only partitioned off, sorting them would cost as much as the whole list
+    if (first > 0) std::nth_element(vec.begin(), vec.begin() + first, vec.end(), compare);
+    std::partial_sort(vec.begin() + first, vec.begin() + first + count, vec.end(), compare);
 }
 
 /**
- * @brief Function to sort flows based on the chosen sort order.
- * @param vec Vector of flow entries to sort.
+ * @brief Function to select and sort the flows of the given ranks based on the chosen sort key.
+ * @param vec Vector of references to flow entries.
+ * @param first Rank of the first flow to place, those before it end up in front of it unordered.
+ * @param count Number of flows to place sorted from first on, the rest stays unordered.
  */
-void sort_flows(std::vector<std::pair<FlowID, FlowStats>> &vec) {
-    if (sort_order == 'b') {
-        // Sort by total bytes in the interval from highest to lowest
-        std::sort(vec.begin(), vec.end(), [](const auto &a, const auto &b) {
-            return (a.second.B_tx + a.second.B_rx) > (b.second.B_tx + b.second.B_rx);
-        });
-    } else if (sort_order == 'p') {
-        // Sort by total packets in the interval from highest to lowest
-        std::sort(vec.begin(), vec.end(), [](const auto &a, const auto &b) {
-            return (a.second.p_tx + a.second.p_rx) > (b.second.p_tx + b.second.p_rx);
-        });
+void sort_flows(std::vector<FlowRef> &vec, size_t first, size_t count) {
+    // Byte keys follow the shown rate, or the bytes of the interval when the interval is shown
+    RateMetric metric = rate_metric(rate_mode);
+    switch (view_sort.load()) {
+        case SORT_BYTES:
+            if (metric != RATE_METRICS) {
+                select_flows(vec, first, count, [metric](FlowRef a, FlowRef b) {
+                    return (a->second.rates.tx[metric] + a->second.rates.rx[metric]) > (b->second.rates.tx[metric] + b->second.rates.rx[metric]);
+                });
+            } else {
+                select_flows(vec, first, count, [](FlowRef a, FlowRef b) {
+                    return (a->second.B_tx + a->second.B_rx) > (b->second.B_tx + b->second.B_rx);
+                });
+            }
+            break;
+        case SORT_PACKETS:
+            select_flows(vec, first, count, [](FlowRef a, FlowRef b) {
+                return (a->second.p_tx + a->second.p_rx) > (b->second.p_tx + b->second.p_rx);
+            });
+            break;
+        case SORT_TX:
+            if (metric != RATE_METRICS) {
+                select_flows(vec, first, count, [metric](FlowRef a, FlowRef b) { return a->second.rates.tx[metric] > b->second.rates.tx[metric]; });
+            } else {
+                select_flows(vec, first, count, [](FlowRef a, FlowRef b) { return a->second.B_tx > b->second.B_tx; });
+            }
+            break;
+        case SORT_RX:
+            if (metric != RATE_METRICS) {
+                select_flows(vec, first, count, [metric](FlowRef a, FlowRef b) { return a->second.rates.rx[metric] > b->second.rates.rx[metric]; });
+            } else {
+                select_flows(vec, first, count, [](FlowRef a, FlowRef b) { return a->second.B_rx > b->second.B_rx; });
+            }
+            break;
+        case SORT_PEAK:
+            select_flows(vec, first, count, [](FlowRef a, FlowRef b) {
+                return (a->second.rates.tx[RATE_PEAK] + a->second.rates.rx[RATE_PEAK]) > (b->second.rates.tx[RATE_PEAK] + b->second.rates.rx[RATE_PEAK]);
+            });
+            break;
     }
 }
@@ -1,75 +1,846 @@
 // Aurel Strigáč <xstrig00>
 
+#include <cstring>
+#include <algorithm>
+#include <netinet/in.h>
+
 #include "flow.h"
-#include "net-top.h"
 
-std::map<FlowID, FlowStats> flows;
+static_assert(sizeof(FlowID) == 40, "FlowID must stay packed, it is compared with memcmp");
 
 /**
- * @brief Custom comparison operator for custom FlowID.
+ * @brief Comparison operator for custom FlowID.
  * @param other Another FlowID to compare with.
- * @return True if this FlowID is less than other, false otherwise.
+ * @return True if both FlowIDs are identical, false otherwise.
+ */
+bool FlowID::operator==(const FlowID &other) const {
+    return std::memcmp(this, &other, sizeof(FlowID)) == 0;
+}
+
+/**
+ * @brief Function for mixing 64-bit value into a well distributed hash.
+ * @param x Value to mix.
+ * @return Mixed value.
+ */
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/**
+ * @brief Function for hashing one endpoint of the connection.
+ * @param ip IP address.
+ * @param port Port number.
+ * @return Hash of the endpoint.
+ */
+static inline uint64_t endpoint_hash(const uint8_t *ip, uint16_t port) {
+    uint64_t lo, hi;
+    std::memcpy(&lo, ip, sizeof(lo));
+    std::memcpy(&hi, ip + 8, sizeof(hi));
+    return mix64(lo ^ mix64(hi ^ port));
+}
+
+/**
+ * @brief Function for computing a direction-normalized hash of a flow.
+ * @param key FlowID to hash.
+ * @return Hash value, identical for both directions of the connection.
+ */
+uint32_t flow_hash(const FlowID &key) {
+    // Addition is commutative, so swapping the endpoints gives the same result
+    uint64_t h = endpoint_hash(key.ip1, key.port1) + endpoint_hash(key.ip2, key.port2);
+    return static_cast<uint32_t>(mix64(h ^ (static_cast<uint64_t>(key.ingress) << 16 | key.proto << 8 | key.family)));
+}
+
+/**
+ * @brief Function for creating FlowID of the opposite direction.
+ * @param key FlowID to reverse.
+ * @return FlowID with swapped endpoints.
+ */
+FlowID reverse_flow(const FlowID &key) {
+    FlowID rev = key;
+    std::memcpy(rev.ip1, key.ip2, sizeof(rev.ip1));
+    std::memcpy(rev.ip2, key.ip1, sizeof(rev.ip2));
+    rev.port1 = key.port2;
+    rev.port2 = key.port1;
+    return rev;
+}
+
+FlowTable::FlowTable() {
+    reserve(1024);
+}
+
+/**
+ * @brief Function for allocating the table for a fixed number of flows, drops all flows.
+ * @param capacity Maximum number of flows.
+ */
+void FlowTable::reserve(uint32_t capacity) {
+    // The load factor stays under 0.75 even when the table is full
+    size_t size = 16;
+    while (size * 3 < static_cast<size_t>(capacity) * 4) size *= 2;
+    slots.assign(size, Slot());
+    mask = static_cast<uint32_t>(size - 1);
+
+    // Records are constructed on first use, but the pool never reallocates
+    pool.clear();
+    pool.shrink_to_fit();
+    pool.reserve(capacity);
+    free_ids.clear();
+    free_ids.reserve(capacity);
+    count = 0;
+    limit = capacity;
+}
+
+/**
+ * @brief Function for removing all flows, keeps the allocated memory.
+ */
+void FlowTable::clear() {
+    std::fill(slots.begin(), slots.end(), Slot());
+    pool.clear();
+    free_ids.clear();
+    count = 0;
+}
+
+/**
+ * @brief Function for finding the slot holding the key, or the first empty slot of its probe sequence.
+ * @param key FlowID to look for.
+ * @param hash Hash of the key.
+ * @return Slot index.
+ */
+uint32_t FlowTable::find_slot(const FlowID &key, uint32_t hash) const {
+    uint32_t slot = hash & mask;
+    while (slots[slot].index != EMPTY) {
+        if (slots[slot].hash == hash && pool[slots[slot].index].key == key) break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/**
+ * @brief Function for finding a flow with an already computed hash and inserting it with empty statistics if missing.
+ * @param key FlowID to look for.
+ * @param hash flow_hash of the key.
+ * @param inserted Set to true if the flow was not in the table.
+ * @return Pointer to the flow record, nullptr if the flow is missing and the table is full.
+ */
+FlowEntry *FlowTable::insert(const FlowID &key, uint32_t hash, bool &inserted) {
+    uint32_t slot = find_slot(key, hash);
+    if (slots[slot].index != EMPTY) {
+        inserted = false;
+        return &pool[slots[slot].index];
+    }
+
+    inserted = count < limit;
+    if (!inserted) return nullptr;
+
+    uint32_t index;
+    if (!free_ids.empty()) {
+        index = free_ids.back();
+        free_ids.pop_back();
+    } else {
+        index = static_cast<uint32_t>(pool.size());
+        pool.emplace_back();
+    }
+
+    FlowEntry &entry = pool[index];
+    entry.key = key;
+    entry.stats = FlowStats();
+    entry.hash = hash;
+    entry.used = true;
+    entry.reversed = false;
+    slots[slot].index = index;
+    slots[slot].hash = hash;
+    count++;
+
+    return &entry;
+}
+
+/**
+ * @brief Function for removing a flow record.
+ * @param index Index of the record in the pool.
+ */
+void FlowTable::erase(uint32_t index) {
+    FlowEntry &entry = pool[index];
+    uint32_t slot = find_slot(entry.key, entry.hash);
+
+    // Backward shift deletion, move following records of the cluster closer to their home slot
+    uint32_t next = (slot + 1) & mask;
+    while (slots[next].index != EMPTY) {
+        uint32_t home = slots[next].hash & mask;
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            slots[slot] = slots[next];
+            slot = next;
+        }
+        next = (next + 1) & mask;
+    }
+    slots[slot] = Slot();
+
+    entry.used = false;
+    free_ids.push_back(index);
+    count--;
+}
+
+/**
+ * @brief Function for preallocating a shard for a fixed number of flows.
+ * @param flows Shard of flows.
+ * @param capacity Maximum number of flows.
+ * @param idle_timeout Time without packets after which a flow is removed, in milliseconds.
+ * @param policy Policy applied when the shard is full.
+ * @param now Current time in milliseconds.
+ */
+void init_flow_shard(FlowShard &flows, uint32_t capacity, uint64_t idle_timeout, OverloadPolicy policy, uint64_t now) {
+    flows.table.reserve(capacity);
+    flows.rates.clear();
+    flows.rates.reserve(capacity);
+    flows.wheel.reserve(capacity);
+    flows.wheel.start(now);
+    flows.active.reserve(capacity);
+    flows.recent.reserve(capacity);
+    flows.idle_timeout = idle_timeout;
+    flows.policy = policy;
+}
+
+/**
+ * @brief Function for setting up the rollup tables of a shard.
+ * @param flows Shard of flows.
+ * @param capacity Maximum number of flows of the shard.
+ * @param prefix_v4 Prefix length of IPv4 hosts in the prefix rollup.
+ * @param prefix_v6 Prefix length of IPv6 hosts in the prefix rollup.
+ */
+void init_flow_rollups(FlowShard &flows, uint32_t capacity, uint8_t prefix_v4, uint8_t prefix_v6) {
+    // Ports and protocols have few distinct values, the other levels may have one per flow
+    const uint32_t limits[ROLLUPS] = {capacity, capacity, capacity, std::min(capacity, ROLLUP_PORTS), std::min(capacity, ROLLUP_PROTOS)};
+    for (int level = 0; level < ROLLUPS; level++) {
+        Rollup &rollup = flows.rollups[level];
+        rollup.table.reserve(limits[level]);
+        rollup.refs.assign(limits[level], 0);
+        rollup.rates.clear();
+        rollup.rates.reserve(limits[level]);
+        rollup.active.clear();
+        rollup.active.reserve(limits[level]);
+        rollup.listed.clear();
+        rollup.listed.reserve(limits[level]);
+        rollup.orphans.clear();
+    }
+    flows.prefix_v4 = prefix_v4;
+    flows.prefix_v6 = prefix_v6;
+}
+
+/**
+ * @brief Function for getting the key of the rollup record a flow is counted in.
+ * @param key FlowID oriented in the flow's first seen direction.
+ * @param level Aggregation level, not AGGREGATE_FLOW.
+ * @param prefix_v4 Prefix length of IPv4 hosts for AGGREGATE_PREFIX.
+ * @param prefix_v6 Prefix length of IPv6 hosts for AGGREGATE_PREFIX.
+ * @param swapped Set to true if the record's transmit direction is the flow's receive one.
+ * @return FlowID with the merged fields zeroed.
+ */
+FlowID rollup_key(const FlowID &key, Aggregation level, uint8_t prefix_v4, uint8_t prefix_v6, bool &swapped) {
+    FlowID rollup = {};
+    rollup.ingress = key.ingress;
+    swapped = false;
+
+    switch (level) {
+        case AGGREGATE_PAIR:
+            // Both directions between two hosts share a record, the lower address goes first
+            swapped = std::memcmp(key.ip1, key.ip2, sizeof(key.ip1)) > 0;
+            std::memcpy(rollup.ip1, swapped ? key.ip2 : key.ip1, sizeof(rollup.ip1));
+            std::memcpy(rollup.ip2, swapped ? key.ip1 : key.ip2, sizeof(rollup.ip2));
+            rollup.family = key.family;
+            break;
+        case AGGREGATE_PREFIX: {
+            // Bits past the prefix are cleared, whole bytes first
+            unsigned bits = key.family == AF_INET6 ? prefix_v6 : prefix_v4;
+            std::memcpy(rollup.ip1, key.ip1, bits / 8);
+            if (bits % 8 != 0) rollup.ip1[bits / 8] = static_cast<uint8_t>(key.ip1[bits / 8] & (0xff00 >> (bits % 8)));
+            rollup.family = key.family;
+            break;
+        }
+        case AGGREGATE_HOST:
+            std::memcpy(rollup.ip1, key.ip1, sizeof(rollup.ip1));
+            rollup.family = key.family;
+            break;
+        case AGGREGATE_PORT:
+            rollup.port2 = key.port2;
+            rollup.proto = key.proto;
+            break;
+        case AGGREGATE_PROTO:
+            rollup.proto = key.proto;
+            break;
+        default:
+            return key;
+    }
+    return rollup;
+}
+
+/**
+ * @brief Function for translating the name of an aggregation level.
+ * @param name Name given by --aggregate (flow/pair/host/prefix/port/proto).
+ * @return Level, AGGREGATIONS for an unknown name.
+ */
+Aggregation aggregation_level(const std::string &name) {
+    for (int level = 0; level < AGGREGATIONS; level++) {
+        if (name == AGGREGATION_NAMES[level]) return static_cast<Aggregation>(level);
+    }
+    return AGGREGATIONS;
+}
+
+/**
+ * @brief Function for getting the rate windows of a record, the array grows with the pool of the table.
+ * @param rates Rate windows of a table by record index, reserved for its capacity.
+ * @param index Index of the record.
+ * @return Windows of the record.
+ */
+static inline FlowRates &record_rates(std::vector<FlowRates> &rates, uint32_t index) {
+    if (index >= rates.size()) rates.resize(index + 1);
+    return rates[index];
+}
+
+/**
+ * @brief Function for finding a rollup record and inserting it with empty statistics and rates if missing.
+ * @param rollup Rollup table.
+ * @param key Rollup key.
+ * @param hash flow_hash of the key.
+ * @param inserted Set to true if the record was not in the table.
+ * @return Index of the record, ROLLUP_NONE if it is missing and the table is full.
+ */
+static uint32_t find_rollup(Rollup &rollup, const FlowID &key, uint32_t hash, bool &inserted) {
+    FlowEntry *entry = rollup.table.insert(key, hash, inserted);
+    if (entry == nullptr) return ROLLUP_NONE;
+
+    uint32_t index = rollup.table.index_of(*entry);
+    if (inserted) {
+        rollup.refs[index] = 0;
+        if (index >= rollup.rates.size()) rollup.rates.resize(index + 1);
+        rollup.rates[index] = RateSummary();
+    }
+    return index;
+}
+
+/**
+ * @brief Function for adding a packet to a rollup record, only the counters are updated.
+ * @param rollup Rollup table.
+ * @param index Index of the record.
+ * @param epoch Current interval.
+ * @param tx Whether the packet goes in the record's transmit direction.
+ * @param total_len Total length of the packet.
+ */
+static inline void count_rollup(Rollup &rollup, uint32_t index, uint32_t epoch, bool tx, uint16_t total_len) {
+    FlowEntry &entry = rollup.table.entries()[index];
+
+    // Reset lazily like flows, the record is listed once per interval
+    if (entry.epoch != epoch) {
+        entry.stats = FlowStats();
+        entry.epoch = epoch;
+        rollup.active.push_back(index);
+    }
+    count_packet(entry, !tx, total_len);
+}
+
+/**
+ * @brief Function for looking up the rollup records of a new flow, the flow keeps their indices.
+ * @param flows Shard of flows.
+ * @param entry Flow record, its direction is already known.
+ */
+static void attach_rollups(FlowShard &flows, FlowEntry &entry) {
+    FlowID oriented = oriented_flow(entry);
+    FlowID keys[ROLLUPS];
+    uint32_t hashes[ROLLUPS];
+    entry.rollup_swapped = 0;
+
+    // All levels are hashed before any is looked up, so the misses of the tables overlap
+    for (int level = 0; level < ROLLUPS; level++) {
+        bool swapped;
+        keys[level] = rollup_key(oriented, static_cast<Aggregation>(AGGREGATE_PAIR + level), flows.prefix_v4, flows.prefix_v6, swapped);
+        hashes[level] = flow_hash(keys[level]);
+        entry.rollup_swapped |= static_cast<uint8_t>(swapped << level);
+        flows.rollups[level].table.prefetch_slot(hashes[level]);
+    }
+    for (int level = 0; level < ROLLUPS; level++) flows.rollups[level].table.prefetch_entry(hashes[level]);
+
+    for (int level = 0; level < ROLLUPS; level++) {
+        bool inserted;
+        Rollup &rollup = flows.rollups[level];
+        uint32_t index = find_rollup(rollup, keys[level], hashes[level], inserted);
+        entry.rollups[level] = index;
+        if (index == ROLLUP_NONE) continue;
+        rollup.refs[index]++;
+        rollup.table.prefetch_record(index);
+    }
+}
+
+/**
+ * @brief Function for dropping the references of a removed flow, records left without flows become orphans.
+ * @param flows Shard of flows.
+ * @param entry Flow record being removed.
+ */
+static void release_rollups(FlowShard &flows, const FlowEntry &entry) {
+    for (int level = 0; level < ROLLUPS; level++) {
+        if (entry.rollups[level] != ROLLUP_NONE) __builtin_prefetch(&flows.rollups[level].refs[entry.rollups[level]], 1);
+    }
+    for (int level = 0; level < ROLLUPS; level++) {
+        uint32_t index = entry.rollups[level];
+        if (index == ROLLUP_NONE) continue;
+        Rollup &rollup = flows.rollups[level];
+        if (--rollup.refs[index] == 0) rollup.orphans.push_back(index);
+    }
+}
+
+/**
+ * @brief Function for erasing orphaned rollup records which are not part of the current interval, the rest stays listed.
+ * @param flows Shard of flows.
+ */
+static void collect_rollups(FlowShard &flows) {
+    for (Rollup &rollup : flows.rollups) {
+        auto &entries = rollup.table.entries();
+        for (size_t i = 0; i < rollup.orphans.size();) {
+            uint32_t index = rollup.orphans[i];
+            const FlowEntry &entry = entries[index];
+
+            // Adopted again or already erased through a duplicate listing, nothing to do
+            bool orphan = entry.used && rollup.refs[index] == 0;
+            if (orphan && entry.epoch == flows.epoch) {
+                i++;
+                continue;
+            }
+            if (orphan) rollup.table.erase(index);
+            rollup.orphans[i] = rollup.orphans.back();
+            rollup.orphans.pop_back();
+        }
+    }
+}
+
+/**
+ * @brief Function for counting a packet of the sketch in the rollups, there is no flow record to keep the indices.
+ * @param flows Shard of flows.
+ * @param counter Sketch counter of the flow.
+ * @param tx Whether the packet goes in the flow's transmit direction.
+ * @param total_len Total length of the packet.
+ */
+static void count_sketch_rollups(FlowShard &flows, const FlowEntry &counter, bool tx, uint16_t total_len) {
+    FlowID oriented = oriented_flow(counter);
+    for (int level = 0; level < ROLLUPS; level++) {
+        bool swapped, inserted;
+        Rollup &rollup = flows.rollups[level];
+        FlowID key = rollup_key(oriented, static_cast<Aggregation>(AGGREGATE_PAIR + level), flows.prefix_v4, flows.prefix_v6, swapped);
+        uint32_t index = find_rollup(rollup, key, flow_hash(key), inserted);
+        if (index == ROLLUP_NONE) continue;
+        if (inserted) rollup.orphans.push_back(index);
+        count_rollup(rollup, index, flows.epoch, tx != swapped, total_len);
+    }
+}
+
+/**
+ * @brief Function for allocating a fixed number of counters, drops all flows.
+ * @param capacity Number of counters.
+ * @param by_bytes Whether flows are ranked by bytes, by packets otherwise.
+ */
+void SpaceSaving::reserve(uint32_t capacity, bool by_bytes) {
+    table.reserve(capacity);
+    heap.clear();
+    heap.reserve(capacity);
+    position.assign(capacity, 0);
+    counts.assign(capacity, 0);
+    admitted = 0;
+    this->by_bytes = by_bytes;
+}
+
+/**
+ * @brief Function for removing all flows, keeps the allocated memory.
  */
-bool FlowID::operator<(const FlowID &other) const {
-    return std::tie(ip1, ip2, port1, port2, proto) <
-           std::tie(other.ip1, other.ip2, other.port1, other.port2, other.proto);
+void SpaceSaving::clear() {
+    if (heap.empty()) return;
+    table.clear();
+    heap.clear();
+    admitted = 0;
 }
 
 /**
- * @brief Function for checking if the connection exists in either direction and updating its statistics.
- * @param tx_key FlowID for transmitted data (ip1->ip2).
- * @param rx_key FlowID for received data (ip1<-ip2).
+ * @brief Function for counting a packet of a flow.
+ * @param key Canonical FlowID.
+ * @param swapped Whether the packet goes ip2->ip1 of the canonical key.
  * @param total_len Total length of the packet.
+ * @return Counter of the flow.
  */
-void update_flow_statistics(const FlowID &tx_key, const FlowID &rx_key, uint16_t total_len) {
-    auto tx_item = flows.find(tx_key);
-    auto rx_item = flows.find(rx_key);
-
-    if (tx_item != flows.end()) {
-        // Connection already exists in the SrcIP->DstIP direction, so we are transmitting
-        tx_item->second.B_tx += total_len;
-        tx_item->second.p_tx += 1;
-    } else if (rx_item != flows.end()) {
-        // Connection already exists in the DstIP->SrcIP direction, so we are receiving
-        rx_item->second.B_rx += total_len;
-        rx_item->second.p_rx += 1;
+const FlowEntry &SpaceSaving::update(const FlowID &key, bool swapped, uint16_t total_len) {
+    bool inserted;
+    FlowEntry *entry = table.insert(key, inserted);
+    uint32_t index;
+
+    if (entry != nullptr && !inserted) {
+        index = table.index_of(*entry);
+    } else if (entry != nullptr) {
+        // Free counter, the flow is counted exactly from its first packet
+        index = table.index_of(*entry);
+        counts[index] = 0;
+        entry->stats.error = 0;
+        position[index] = static_cast<uint32_t>(heap.size());
+        heap.push_back(index);
+        sift_up(position[index]);
+        admitted++;
     } else {
-        // Connection doesn't exist in either direction
-        flows[tx_key] = {total_len, 0, 1, 0};
+        // The least counted flow hands its counter over, its count bounds what the new flow may have missed
+        uint32_t victim = heap[0];
+        uint64_t floor = counts[victim];
+        table.erase(victim);
+        entry = table.insert(key, inserted);
+        index = table.index_of(*entry);
+        counts[index] = floor;
+        entry->stats.error = floor;
+        heap[0] = index;
+        position[index] = 0;
+        admitted++;
     }
+
+    if (inserted) entry->reversed = swapped;
+    count_packet(*entry, swapped, total_len);
+    counts[index] += by_bytes ? total_len : 1;
+    sift_down(position[index]);
+    return *entry;
 }
 
 /**
- * @brief Function for checking if the flow is not active.
- * @param stats Flow statistics.
- * @return True if the flow is not active, false otherwise.
+ * @brief Function for moving a counter towards the leaves until the heap order holds.
+ * @param pos Heap position of the counter.
  */
-bool flow_not_active(const FlowStats &stats) {
-    return stats.B_tx == 0 && stats.B_rx == 0 && stats.p_tx == 0 && stats.p_rx == 0;
+void SpaceSaving::sift_down(uint32_t pos) {
+    uint32_t index = heap[pos];
+    uint32_t size = static_cast<uint32_t>(heap.size());
+
+    while (2 * pos + 1 < size) {
+        uint32_t child = 2 * pos + 1;
+        if (child + 1 < size && counts[heap[child + 1]] < counts[heap[child]]) child++;
+        if (counts[heap[child]] >= counts[index]) break;
+        heap[pos] = heap[child];
+        position[heap[pos]] = pos;
+        pos = child;
+    }
+    heap[pos] = index;
+    position[index] = pos;
 }
 
 /**
- * @brief Function for resetting flow statistics.
+ * @brief Function for moving a counter towards the root until the heap order holds.
+ * @param pos Heap position of the counter.
  */
-void reset_flow_statistics() {
-    for (auto flow = flows.begin(); flow != flows.end(); flow++) {
-        flow->second.B_tx = 0;
-        flow->second.B_rx = 0;
-        flow->second.p_tx = 0;
-        flow->second.p_rx = 0;
+void SpaceSaving::sift_up(uint32_t pos) {
+    uint32_t index = heap[pos];
+
+    while (pos > 0) {
+        uint32_t parent = (pos - 1) / 2;
+        if (counts[heap[parent]] <= counts[index]) break;
+        heap[pos] = heap[parent];
+        position[heap[pos]] = pos;
+        pos = parent;
     }
+    heap[pos] = index;
+    position[index] = pos;
 }
 
 /**
- * @brief Function for deleting inactive connections.
+ * @brief Function for setting up the heavy-hitter sketch of a shard.
+ * @param flows Shard of flows.
+ * @param mode When the sketch replaces the table.
+ * @param counters Number of sketch counters.
+ * @param threshold Flows per interval switching to the sketch in automatic mode.
+ * @param by_bytes Whether flows are ranked by bytes, by packets otherwise.
  */
-void trim_flows() {
-    for (auto flow = flows.begin(); flow != flows.end();) {
-        if (flow_not_active(flow->second)) {
-            // Remove non-active flows
-            flow = flows.erase(flow);
-        } else {
-            flow++;
+void init_flow_sketch(FlowShard &flows, SketchMode mode, uint32_t counters, size_t threshold, bool by_bytes) {
+    flows.sketch_mode = mode;
+    flows.sketching = mode == SketchMode::ON;
+    flows.sketch_threshold = threshold;
+    if (mode != SketchMode::OFF) flows.sketch.reserve(counters, by_bytes);
+}
+
+/**
+ * @brief Function for ordering the endpoints of a flow so that both directions share one key.
+ * @param key FlowID of the packet (src->dst).
+ * @param swapped Set to true if the endpoints had to be swapped.
+ * @return Canonical FlowID.
+ */
+FlowID canonical_flow(const FlowID &key, bool &swapped) {
+    int order = std::memcmp(key.ip1, key.ip2, sizeof(key.ip1));
+    swapped = order > 0 || (order == 0 && key.port1 > key.port2);
+    return swapped ? reverse_flow(key) : key;
+}
+
+/**
+ * @brief Function for getting FlowID of a record oriented in its first seen direction.
+ * @param entry Flow record.
+ * @return FlowID where ip1 is the side that transmitted first.
+ */
+FlowID oriented_flow(const FlowEntry &entry) {
+    return entry.reversed ? reverse_flow(entry.key) : entry.key;
+}
+
+/**
+ * @brief Function for adding a packet to the statistics of its flow.
+ * @param entry Flow record.
+ * @param swapped Whether the packet goes ip2->ip1 of the canonical key.
+ * @param total_len Total length of the packet.
+ */
+void count_packet(FlowEntry &entry, bool swapped, uint16_t total_len) {
+    if (swapped == entry.reversed) {
+        // Packet goes in the same direction as the first one, so we are transmitting
+        entry.stats.B_tx += total_len;
+        entry.stats.p_tx += 1;
+    } else {
+        // Packet goes in the opposite direction, so we are receiving
+        entry.stats.B_rx += total_len;
+        entry.stats.p_rx += 1;
+    }
+}
+
+/**
+ * @brief Function for finding the connection with a single lookup and updating its statistics.
+ * @param flows Shard of flows.
+ * @param key FlowID of the packet (src->dst).
+ * @param total_len Total length of the packet.
+ * @param now Packet timestamp in milliseconds.
+ */
+void update_flow_statistics(FlowShard &flows, const FlowID &key, uint16_t total_len, uint64_t now) {
+    update_flow_statistics(flows, key, flow_hash(key), total_len, now);
+}
+
+/**
+ * @brief Function for updating the statistics of a connection whose hash is already known.
+ * @param flows Shard of flows.
+ * @param key FlowID of the packet (src->dst).
+ * @param hash flow_hash of the key, the same for both directions.
+ * @param total_len Total length of the packet.
+ * @param now Packet timestamp in milliseconds.
+ */
+void update_flow_statistics(FlowShard &flows, const FlowID &key, uint32_t hash, uint16_t total_len, uint64_t now) {
+    bool swapped, inserted;
+    FlowID canonical = canonical_flow(key, swapped);
+
+    if (flows.sketching) {
+        // Rollups stay exact, every packet is counted in them whether its flow holds a counter or not
+        const FlowEntry &counter = flows.sketch.update(canonical, swapped, total_len);
+        count_sketch_rollups(flows, counter, swapped == counter.reversed, total_len);
+        return;
+    }
+    FlowEntry *record = flows.table.insert(canonical, hash, inserted);
+
+    if (record == nullptr) {
+        // Table is full, the new flow either replaces an old one or is not tracked at all
+        if (flows.policy == OverloadPolicy::DROP || flows.table.size() == 0) {
+            flows.dropped++;
+            return;
+        }
+        evict_flow(flows);
+        record = flows.table.insert(canonical, hash, inserted);
+    }
+
+    FlowEntry &entry = *record;
+    if (!inserted) {
+        // Rollup records are scattered over larger tables than the flow's neighbours, their misses overlap with the work below
+        for (int level = 0; level < ROLLUPS; level++) {
+            if (entry.rollups[level] != ROLLUP_NONE) flows.rollups[level].table.prefetch_record(entry.rollups[level]);
+        }
+    }
+    if (inserted) {
+        // The first packet of a connection defines its transmit direction
+        entry.reversed = swapped;
+        flows.wheel.schedule(flows.table.index_of(entry), now + flows.idle_timeout);
+        reset_rates(entry.bucket, record_rates(flows.rates, flows.table.index_of(entry)), now);
+        attach_rollups(flows, entry);
+    }
+
+    // First packet of the interval, statistics of older intervals are discarded
+    if (entry.epoch != flows.epoch) {
+        entry.stats = FlowStats();
+        entry.epoch = flows.epoch;
+        flows.active.push_back(flows.table.index_of(entry));
+        if (!entry.recent) {
+            entry.recent = true;
+            flows.recent.push_back(flows.table.index_of(entry));
+        }
+    }
+    entry.last_seen = now;
+    count_packet(entry, swapped, total_len);
+    bool tx = swapped == entry.reversed;
+    count_rate(entry.bucket, flows.rates[flows.table.index_of(entry)], tx, total_len, now);
+
+    // Same pass over the groups of the flow, their records were found when the flow was inserted
+    for (int level = 0; level < ROLLUPS; level++) {
+        uint32_t index = entry.rollups[level];
+        if (index == ROLLUP_NONE) continue;
+        count_rollup(flows.rollups[level], index, flows.epoch, tx != ((entry.rollup_swapped >> level) & 1), total_len);
+    }
+}
+
+/**
+ * @brief Function for resetting flow statistics by starting a new interval, records are zeroed on their next update.
+ * @param flows Shard of flows.
+ */
+void reset_flow_statistics(FlowShard &flows) {
+    if (flows.sketch_mode == SketchMode::AUTO) {
+        // Switch back only well below the threshold, so a load around it doesn't flip modes every interval
+        if (!flows.sketching && flows.active.size() >= flows.sketch_threshold) {
+            flows.sketching = true;
+        } else if (flows.sketching && flows.sketch.admissions() < flows.sketch_threshold / 2) {
+            flows.sketching = false;
+        }
+    }
+
+    flows.epoch++;
+    flows.active.clear();
+    flows.sketch.clear();
+    for (Rollup &rollup : flows.rollups) rollup.active.clear();
+}
+
+/**
+ * @brief Function for closing the rate buckets of recent flows up to now, flows with empty windows are unlisted.
+ * @param flows Shard of flows.
+ * @param now Current time in milliseconds.
+ */
+void advance_flow_rates(FlowShard &flows, uint64_t now) {
+    auto &entries = flows.table.entries();
+    auto &recent = flows.recent;
+    uint32_t bucket = rate_bucket(now);
+    for (size_t i = 0; i < recent.size();) {
+        FlowEntry &entry = entries[recent[i]];
+
+        // A removed flow is still reported for the interval it was removed in
+        bool expired = entry.used ? entry.last_seen + RATE_WINDOW_MS <= now : entry.epoch != flows.epoch;
+        if (expired) {
+            entry.recent = false;
+            recent[i] = recent.back();
+            recent.pop_back();
+            continue;
+        }
+        advance_rates(entry.bucket, flows.rates[recent[i]], bucket);
+        i++;
+    }
+}
+
+/**
+ * @brief Function for listing a rollup record for the published interval, its rates restart from zero except the peak.
+ * @param rollup Rollup table.
+ * @param index Index of the record.
+ * @return Rates of the record.
+ */
+static inline RateSummary &list_rollup(Rollup &rollup, uint32_t index) {
+    FlowEntry &entry = rollup.table.entries()[index];
+    RateSummary &rates = rollup.rates[index];
+    if (!entry.recent) {
+        entry.recent = true;
+        rollup.listed.push_back(index);
+        for (int metric = 0; metric < RATE_METRICS; metric++) {
+            if (metric == RATE_PEAK) continue;
+            rates.tx[metric] = 0;
+            rates.rx[metric] = 0;
         }
     }
+    return rates;
+}
+
+/**
+ * @brief Function for starting to sum the rates of the rollups, lists the records active in the interval with zero rates.
+ * @param flows Shard of flows.
+ */
+void start_rollup_rates(FlowShard &flows) {
+    for (Rollup &rollup : flows.rollups) {
+        // Records erased since the last interval keep their index, the flag of a reused one is cleared as well
+        auto &entries = rollup.table.entries();
+        for (uint32_t index : rollup.listed) entries[index].recent = false;
+        rollup.listed.clear();
+        for (uint32_t index : rollup.active) list_rollup(rollup, index);
+    }
+}
+
+/**
+ * @brief Function for adding the rates of a published flow to its rollup records, listing them.
+ * @param flows Shard of flows.
+ * @param index Index of the flow record.
+ * @param rates Rates of the flow in its first seen direction.
+ */
+void add_rollup_rates(FlowShard &flows, uint32_t index, const RateSummary &rates) {
+    // Rollup records of a flow removed in this interval are kept until it is published
+    const FlowEntry &entry = flows.table.entries()[index];
+    for (int level = 0; level < ROLLUPS; level++) {
+        uint32_t record = entry.rollups[level];
+        if (record == ROLLUP_NONE) continue;
+        RateSummary &sum = list_rollup(flows.rollups[level], record);
+        bool swapped = (entry.rollup_swapped >> level) & 1;
+        for (int metric = 0; metric < RATE_METRICS; metric++) {
+            if (metric == RATE_PEAK) continue;
+            sum.tx[metric] += swapped ? rates.rx[metric] : rates.tx[metric];
+            sum.rx[metric] += swapped ? rates.tx[metric] : rates.rx[metric];
+        }
+    }
+}
+
+/**
+ * @brief Function for finishing the rates of the listed rollup records, their peaks are raised to the summed 2 s rates.
+ * @param flows Shard of flows.
+ * @param seconds Length of the interval, the rates of a sketched interval are those of its counters.
+ */
+void finish_rollup_rates(FlowShard &flows, double seconds) {
+    for (Rollup &rollup : flows.rollups) {
+        auto &entries = rollup.table.entries();
+        for (uint32_t index : rollup.listed) {
+            RateSummary &rates = rollup.rates[index];
+            if (flows.sketching) {
+                // Sketched flows have no windows, like their counters the groups show the rates of the interval
+                const FlowStats &stats = entries[index].stats;
+                std::fill(rates.tx, rates.tx + RATE_PEAK, static_cast<float>(static_cast<double>(stats.B_tx) / seconds));
+                std::fill(rates.rx, rates.rx + RATE_PEAK, static_cast<float>(static_cast<double>(stats.B_rx) / seconds));
+            }
+            rates.tx[RATE_PEAK] = std::max(rates.tx[RATE_PEAK], rates.tx[RATE_2S]);
+            rates.rx[RATE_PEAK] = std::max(rates.rx[RATE_PEAK], rates.rx[RATE_2S]);
+        }
+    }
+}
+
+/**
+ * @brief Function for evicting the least recently seen of a few sampled flows.
+ * @param flows Shard of flows, must not be empty.
+ */
+void evict_flow(FlowShard &flows) {
+    static constexpr int SAMPLES = 8;
+
+    // Sampling approximates LRU without keeping records ordered on every packet
+    auto &entries = flows.table.entries();
+    uint32_t victim = UINT32_MAX;
+    for (int sampled = 0; sampled < SAMPLES;) {
+        uint32_t index = flows.evict_cursor;
+        flows.evict_cursor = index + 1 < entries.size() ? index + 1 : 0;
+        if (!entries[index].used) continue;
+
+        if (victim == UINT32_MAX || entries[index].last_seen < entries[victim].last_seen) victim = index;
+        sampled++;
+    }
+
+    flows.wheel.cancel(victim);
+    release_rollups(flows, entries[victim]);
+    flows.table.erase(victim);
+    flows.evicted++;
+}
+
+/**
+ * @brief Function for deleting connections idle for longer than the idle timeout, rollups left without flows go once quiet.
+ * @param flows Shard of flows.
+ * @param now Current time in milliseconds.
+ */
+void trim_flows(FlowShard &flows, uint64_t now) {
+    flows.wheel.advance(now, [&flows, now](uint32_t index) {
+        const FlowEntry &entry = flows.table.entries()[index];
+
+        if (entry.last_seen + flows.idle_timeout > now) {
+            // Packets arrived since the timer was set
+            flows.wheel.schedule(index, entry.last_seen + flows.idle_timeout);
+        } else if (entry.epoch == flows.epoch) {
+            // Flow is part of the current interval, it must stay until the interval is published
+            flows.wheel.schedule(index, now + flows.idle_timeout);
+        } else {
+            release_rollups(flows, entry);
+            flows.table.erase(index);
+        }
+    });
+    collect_rollups(flows);
 }
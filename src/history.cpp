@@ -0,0 +1,335 @@
+// Aurel Strigáč <xstrig00>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+#include "history.h"
+#include "net-top.h"
+#include "utils.h"
+#include "worker.h"
+
+/**
+ * @brief Hash of a FlowID for the dictionary, snapshots hold oriented keys so direction doesn't matter.
+ */
+struct FlowIDHash {
+    size_t operator()(const FlowID &key) const { return flow_hash(key); }
+};
+
+// Writer, only used by the render thread
+static int log_fd = -1;                                                 // Current log file
+static std::string log_path;                                            // Path of the current log file
+static size_t log_limit = HISTORY_DEFAULT_SIZE;                         // Size after which the log is rotated
+static size_t log_size = 0;                                             // Bytes in the current log file
+static uint32_t log_generation = 0;                                     // Incremented on rotation, the reader remaps
+static std::unordered_map<FlowID, uint32_t, FlowIDHash> dictionary;     // Dictionary IDs of the current file
+static std::vector<FlowID> added;                                       // Keys first seen in the interval
+static std::vector<uint32_t> ids;                                       // Dictionary IDs of the interval's flows
+static std::vector<uint8_t> block;                                      // Block being written
+
+// Reader, only used by the render thread
+static std::string reader_path;             // Path of the mapped log
+static int reader_fd = -1;                  // Mapped log file
+static uint32_t reader_generation = 0;      // Generation of the writer the mapping belongs to
+static const uint8_t *map = nullptr;        // Mapping of the whole file
+static size_t map_size = 0;                 // Size of the mapping
+static size_t scanned = 0;                  // End of the last indexed block
+static std::vector<size_t> blocks;          // Offsets of complete blocks
+static std::vector<size_t> keys;                                        // Offsets of dictionary entries by their ID
+
+/**
+ * @brief Function for rounding a size up to the alignment of blocks.
+ * @param size Size in bytes.
+ * @return Size rounded up to a multiple of 8.
+ */
+static size_t align_block(size_t size) {
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+/**
+ * @brief Function for writing a whole buffer to the log.
+ * @param data Buffer.
+ * @param size Size of the buffer in bytes.
+ * @return True on success, false otherwise.
+ */
+static bool write_all(const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    while (size > 0) {
+        ssize_t written = write(log_fd, bytes, size);
+        if (written == -1 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        bytes += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+/**
+ * @brief Function for starting a new log file with an empty dictionary.
+ * @param errbuf Buffer for the error message.
+ * @return True on success, false otherwise.
+ */
+static bool start_file(char *errbuf) {
+    if ((log_fd = open(log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", log_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    HistoryFileHeader header = {};
+    memcpy(header.magic, HISTORY_MAGIC, sizeof(header.magic));
+    header.interval_ms = static_cast<uint32_t>(refresh_ms);
+    strncpy(header.interfaces, interface.c_str(), sizeof(header.interfaces) - 1);
+    if (!write_all(&header, sizeof(header))) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", log_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    log_size = sizeof(header);
+    dictionary.clear();
+    log_generation++;
+    return true;
+}
+
+/**
+ * @brief Function for creating the history log, an existing file is replaced.
+ * @param path Path of the log, the previous file is kept as path.1 on rotation.
+ * @param max_size Size after which the log is rotated.
+ * @param errbuf Buffer for the error message.
+ * @return True on success, false otherwise.
+ */
+bool open_history(const std::string &path, size_t max_size, char *errbuf) {
+    log_path = path;
+    log_limit = max_size;
+    reader_path = path;
+    return start_file(errbuf);
+}
+
+/**
+ * @brief Function for looking up the dictionary IDs of all flows of the interval, unknown keys get new ones.
+ * @param epoch Interval whose snapshots are logged.
+ * @return Number of flows.
+ */
+static size_t intern_flows(uint32_t epoch) {
+    added.clear();
+    ids.clear();
+    for (auto &worker : workers) {
+        for (const auto &flow : worker->snapshots[epoch & 1].flows) {
+            auto result = dictionary.try_emplace(flow.first, static_cast<uint32_t>(dictionary.size()));
+            if (result.second) added.push_back(flow.first);
+            ids.push_back(result.first->second);
+        }
+    }
+    return ids.size();
+}
+
+/**
+ * @brief Function for appending the flows of all workers' published snapshots, nothing is done without a log.
+ * @param epoch Interval whose snapshots are logged, they must not be written meanwhile.
+ */
+void log_interval(uint32_t epoch) {
+    if (log_fd == -1) return;
+
+    size_t flows = intern_flows(epoch);
+    size_t size = align_block(sizeof(HistoryBlockHeader) + added.size() * sizeof(FlowID) + flows * HISTORY_FLOW_SIZE);
+
+    // A full file is moved aside, the block is interned again into the dictionary of the new one
+    if (log_size + size > log_limit && log_size > sizeof(HistoryFileHeader)) {
+        close(log_fd);
+        std::string rotated = log_path + ".1";
+        char message[PCAP_ERRBUF_SIZE];
+        if (rename(log_path.c_str(), rotated.c_str()) == -1 || !start_file(message)) {
+            std::cerr << "[ WARNING ] Cannot rotate history " << log_path << ", logging stopped\n";
+            close_history();
+            return;
+        }
+        flows = intern_flows(epoch);
+        size = align_block(sizeof(HistoryBlockHeader) + added.size() * sizeof(FlowID) + flows * HISTORY_FLOW_SIZE);
+    }
+
+    block.assign(size, 0);
+    HistoryBlockHeader header = {};
+    header.magic = HISTORY_BLOCK_MAGIC;
+    header.epoch = epoch;
+    header.new_keys = static_cast<uint32_t>(added.size());
+    header.flows = static_cast<uint32_t>(flows);
+    header.size = size;
+    for (auto &worker : workers) header.time_ms = std::max(header.time_ms, worker->snapshots[epoch & 1].closed);
+    memcpy(block.data(), &header, sizeof(header));
+
+    uint8_t *position = block.data() + sizeof(header);
+    if (!added.empty()) memcpy(position, added.data(), added.size() * sizeof(FlowID));
+    position += added.size() * sizeof(FlowID);
+
+    // Columns, the 64-bit ones first so they stay aligned
+    uint64_t *bytes_rx = reinterpret_cast<uint64_t *>(position);
+    uint64_t *bytes_tx = bytes_rx + flows;
+    uint32_t *flow_ids = reinterpret_cast<uint32_t *>(bytes_tx + flows);
+    uint32_t *packets_rx = flow_ids + flows;
+    uint32_t *packets_tx = packets_rx + flows;
+    size_t i = 0;
+    for (auto &worker : workers) {
+        for (const auto &flow : worker->snapshots[epoch & 1].flows) {
+            bytes_rx[i] = flow.second.B_rx;
+            bytes_tx[i] = flow.second.B_tx;
+            flow_ids[i] = ids[i];
+            packets_rx[i] = static_cast<uint32_t>(flow.second.p_rx);
+            packets_tx[i] = static_cast<uint32_t>(flow.second.p_tx);
+            i++;
+        }
+    }
+
+    if (!write_all(block.data(), size)) {
+        std::cerr << "[ WARNING ] Cannot write history " << log_path << ": " << strerror(errno) << ", logging stopped\n";
+        close_history();
+        return;
+    }
+    log_size += size;
+}
+
+/**
+ * @brief Function for closing the history log.
+ */
+void close_history() {
+    if (log_fd != -1) close(log_fd);
+    log_fd = -1;
+}
+
+/**
+ * @brief Function for dropping the mapping and the index of the reader.
+ */
+static void reset_reader() {
+    if (map != nullptr) munmap(const_cast<uint8_t *>(map), map_size);
+    if (reader_fd != -1) close(reader_fd);
+    map = nullptr;
+    map_size = 0;
+    reader_fd = -1;
+    scanned = 0;
+    blocks.clear();
+    keys.clear();
+}
+
+/**
+ * @brief Function for opening a history log for reading only, the refresh interval and interfaces are taken from it.
+ * @param path Path of the log.
+ * @param errbuf Buffer for the error message.
+ * @return True on success, false otherwise.
+ */
+bool open_playback(const std::string &path, char *errbuf) {
+    reader_path = path;
+    if ((reader_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC)) == -1) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    history_count();
+    if (map == nullptr || scanned == 0) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: not a net-top history log", path.c_str());
+        return false;
+    }
+
+    // Rates and interface names are those of the recording session
+    HistoryFileHeader header;
+    memcpy(&header, map, sizeof(header));
+    refresh_ms = std::max<int>(static_cast<int>(header.interval_ms), 1);
+    rate_mode = "interval";     // Only the counters of the intervals are logged
+    header.interfaces[HISTORY_INTERFACES_LEN - 1] = '\0';
+    interface = header.interfaces;
+    check_interface_list(interface);
+    return true;
+}
+
+/**
+ * @brief Function for counting the intervals in the log, blocks appended since the last call are indexed.
+ * @return Number of complete intervals.
+ */
+size_t history_count() {
+    if (reader_path.empty()) return 0;
+
+    // A rotated log is a different file, its dictionary starts over
+    if (reader_generation != log_generation) {
+        reset_reader();
+        reader_generation = log_generation;
+    }
+    if (reader_fd == -1 && (reader_fd = open(reader_path.c_str(), O_RDONLY | O_CLOEXEC)) == -1) return 0;
+
+    // The log only grows, the mapping follows its size
+    struct stat info;
+    if (fstat(reader_fd, &info) == -1) return blocks.size();
+    size_t size = static_cast<size_t>(info.st_size);
+    if (size != map_size && size >= sizeof(HistoryFileHeader)) {
+        if (map != nullptr) munmap(const_cast<uint8_t *>(map), map_size);
+        void *mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, reader_fd, 0);
+        map = mapping != MAP_FAILED ? static_cast<const uint8_t *>(mapping) : nullptr;
+        map_size = map != nullptr ? size : 0;
+        if (map == nullptr) {
+            scanned = 0;
+            blocks.clear();
+            keys.clear();
+            return 0;
+        }
+    }
+    if (map == nullptr) return 0;
+
+    if (scanned == 0) {
+        if (memcmp(map, HISTORY_MAGIC, sizeof(HISTORY_MAGIC)) != 0) return 0;
+        scanned = sizeof(HistoryFileHeader);
+    }
+
+    // Only block headers are visited, a block cut off by a crash ends the log
+    while (scanned + sizeof(HistoryBlockHeader) <= map_size) {
+        HistoryBlockHeader header;
+        memcpy(&header, map + scanned, sizeof(header));
+        size_t minimum = sizeof(header) + header.new_keys * sizeof(FlowID) + static_cast<size_t>(header.flows) * HISTORY_FLOW_SIZE;
+        if (header.magic != HISTORY_BLOCK_MAGIC || header.size < minimum || header.size > map_size - scanned) break;
+
+        for (uint32_t k = 0; k < header.new_keys; k++) keys.push_back(scanned + sizeof(header) + k * sizeof(FlowID));
+        blocks.push_back(scanned);
+        scanned += header.size;
+    }
+    return blocks.size();
+}
+
+/**
+ * @brief Function for reading one interval of the log through its memory mapping.
+ * @param index Interval index, 0 is the oldest one of the file.
+ * @param epoch Set to the interval number.
+ * @param time_ms Set to the end of the interval.
+ * @param flows Filled with the flows of the interval.
+ * @return True on success, false if the interval doesn't exist.
+ */
+bool read_history(size_t index, uint32_t &epoch, uint64_t &time_ms, std::vector<std::pair<FlowID, FlowStats>> &flows) {
+    flows.clear();
+    if (index >= blocks.size()) return false;
+
+    HistoryBlockHeader header;
+    memcpy(&header, map + blocks[index], sizeof(header));
+    epoch = header.epoch;
+    time_ms = header.time_ms;
+
+    const uint8_t *columns = map + blocks[index] + sizeof(header) + header.new_keys * sizeof(FlowID);
+    const uint64_t *bytes_rx = reinterpret_cast<const uint64_t *>(columns);
+    const uint64_t *bytes_tx = bytes_rx + header.flows;
+    const uint32_t *flow_ids = reinterpret_cast<const uint32_t *>(bytes_tx + header.flows);
+    const uint32_t *packets_rx = flow_ids + header.flows;
+    const uint32_t *packets_tx = packets_rx + header.flows;
+
+    flows.reserve(header.flows);
+    for (uint32_t i = 0; i < header.flows; i++) {
+        if (flow_ids[i] >= keys.size()) continue;
+        FlowID key;
+        memcpy(&key, map + keys[flow_ids[i]], sizeof(key));
+        FlowStats stats;
+        stats.B_rx = bytes_rx[i];
+        stats.B_tx = bytes_tx[i];
+        stats.p_rx = packets_rx[i];
+        stats.p_tx = packets_tx[i];
+        flows.emplace_back(key, stats);
+    }
+    return true;
+}
@@ -5,9 +5,13 @@
 #include <pcap.h>
 #include <cstring>
 #include <csignal>
-#include <chrono>
-#include <thread>
 #include <cstdlib>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
 
 #include <ncurses.h>
 
@@ -15,73 +19,361 @@
 #include "display.h"
 #include "flow.h"
 #include "capture.h"
+#include "history.h"
+#include "output.h"
+#include "resolver.h"
+#include "stats.h"
+#include "worker.h"
 #include "net-top.h"
 
-std::string interface;                              // Network interface to capture packets from
+std::string interface;                              // Network interfaces to capture packets from as given by -i
+std::vector<std::string> interfaces;                // Network interfaces to capture packets from
+std::string filter_expr;                            // User-supplied BPF filter expression
+std::string headless_format;                        // Headless output format: "ndjson" or "csv", empty for the ncurses screen
+std::string output_path;                            // File the headless output is written to, empty for standard output
+std::string history_path;                           // File the flows of every interval are logged to, empty for none
+size_t history_max_size = HISTORY_DEFAULT_SIZE;     // Size after which the history is rotated
+std::string playback_path;                          // History file browsed instead of capturing, empty for a capture
+std::string stats_path;                             // File the instrumentation of every interval is written to, empty for none
+std::string read_file;                              // Capture file to replay instead of a live interface
+std::string replay_speed = "max";                   // Replay speed: "max" as fast as possible, "realtime" following packet timestamps
 char sort_order = 'b';                              // Sorting order: 'b' for bytes, 'p' for packets
-int refresh_interval = 1;                           // Output update interval in seconds
-pcap_t *handle = nullptr;                           // Pcap handle for packet capturing
+int refresh_ms = 1000;                              // Output update interval in milliseconds
+std::string rate_mode = "2s";                       // Rate shown as b/s: "interval", "2s", "10s", "40s", "ewma" or "peak"
+size_t top_count = 10;                              // Number of displayed flows
+std::string aggregation = "flow";                   // Initial aggregation level: "flow", "pair", "host", "prefix", "port" or "proto"
+int prefix_v4 = 24;                                 // Prefix length of IPv4 hosts in the prefix aggregation
+int prefix_v6 = 64;                                 // Prefix length of IPv6 hosts in the prefix aggregation
+std::string resolve = "off";                        // Names shown at start: "off", "hosts", "services" or "all"
+unsigned resolve_threads = 2;                       // Number of resolver threads
+int idle_timeout = 30;                              // Seconds without packets after which a flow is forgotten
+size_t max_flows = 1 << 18;                         // Maximum number of tracked flows over all workers
+size_t max_mem = 0;                                 // Memory limit of the flow tables in bytes, 0 for none
+std::string overload_policy = "evict";              // Policy for new flows when the table is full: "evict" or "drop"
+std::string sketch_mode = "off";                    // Heavy-hitter sketch: "off", "on" or "auto"
+size_t sketch_size = 4096;                          // Number of sketch counters per worker
+size_t sketch_threshold = 0;                        // Flows per interval switching to the sketch in auto mode, 0 for half of max_flows
+std::string backend = "ring";                       // Capture backend: "ring" for TPACKET_V3 ring, "pcap" for libpcap
+unsigned ring_block_size = 1 << 20;                 // Size of one ring block in bytes
+unsigned ring_block_count = 64;                     // Number of ring blocks
+unsigned worker_count = 1;                          // Number of capture threads
 char errbuf[PCAP_ERRBUF_SIZE];                      // Buffer for pcap error messages
 
 /**
- * @brief Function for handling the SIGINT signal.
- * @param sig Signal number.
+ * @brief Function for stopping the capture workers and render thread and restoring the terminal.
  */
-void signal_handler(int sig) {
-    (void)sig; // Pity fix for unused variable
+void cleanup() {
+    stop_workers();
+    stop_resolver();
+    stop_render();
+    if (headless_format.empty()) endwin();
+    close_output();
+    close_stats_file();
+    close_history();
+}
+
+/**
+ * @brief Function for creating the descriptors the event loop waits on.
+ * @param events Descriptors to fill.
+ * @return True on success, false otherwise.
+ */
+bool setup_events(EventFds &events) {
+    // Signals are delivered through signalfd, so they have to be blocked for the default handling
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGWINCH);
+    if (sigprocmask(SIG_BLOCK, &mask, nullptr) == -1) return false;
+    if ((events.signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) return false;
+
+    if ((events.epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) return false;
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = events.signal_fd;
+    if (epoll_ctl(events.epoll_fd, EPOLL_CTL_ADD, events.signal_fd, &event) == -1) return false;
+
+    // Keys are read raw here, ncurses input would race with the render thread; a redirected stdin is simply not polled
+    event.data.fd = STDIN_FILENO;
+    if (headless_format.empty() && epoll_ctl(events.epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &event) == 0) events.input_fd = STDIN_FILENO;
+
+    // A replay closes intervals by packet timestamps and a playback has none, the timer is not needed
+    if (!read_file.empty() || !playback_path.empty()) return true;
 
-    endwin();
-    pcap_close(handle);
+    // Periodic timer anchored to the start, so refreshes don't drift by the time spent drawing
+    if ((events.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) return false;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct itimerspec spec = {};
+    spec.it_interval.tv_sec = refresh_ms / 1000;
+    spec.it_interval.tv_nsec = static_cast<long>(refresh_ms % 1000) * 1000000;
+    spec.it_value.tv_sec = now.tv_sec + spec.it_interval.tv_sec;
+    spec.it_value.tv_nsec = now.tv_nsec + spec.it_interval.tv_nsec;
+    if (spec.it_value.tv_nsec >= 1000000000) {
+        spec.it_value.tv_sec++;
+        spec.it_value.tv_nsec -= 1000000000;
+    }
+    if (timerfd_settime(events.timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) return false;
 
-    exit(0);
+    event.data.fd = events.timer_fd;
+    return epoll_ctl(events.epoll_fd, EPOLL_CTL_ADD, events.timer_fd, &event) != -1;
 }
 
-int main(int argc, char *argv[]) {
-    signal(SIGINT, signal_handler);
+// Bytes of an escape sequence split across reads wait here for the rest, a lone Esc for ESCAPE_DELAY_MS
+static constexpr int ESCAPE_DELAY_MS = 25;
+static char escape_sequence[16];
+static size_t escape_length = 0;
+
+/**
+ * @brief Function for acting on a single key, typed text goes to the filter while it is edited.
+ * @param key Key typed.
+ */
+static void handle_key(char key) {
+    if (editing_filter()) {
+        edit_filter(key);
+        return;
+    }
+    switch (key) {
+        case 'i':
+            switch_view();
+            break;
+        case 'a':
+            switch_aggregation();
+            break;
+        case 's':
+            switch_sort();
+            break;
+        case 'n':
+            switch_resolve();
+            break;
+        case '+':
+        case '=':
+            change_rows(1);
+            break;
+        case '-':
+            change_rows(-1);
+            break;
+        case ' ':
+            toggle_pause();
+            break;
+        case 'f':
+            toggle_freeze();
+            break;
+        case '/':
+            start_filter();
+            break;
+    }
+}
+
+/**
+ * @brief Function for acting on a complete escape sequence, modifiers such as ESC [ 1 ; 5 A are ignored.
+ * @param sequence Sequence starting with ESC [ (CSI) or ESC O (SS3) and ending with its final byte.
+ * @param length Length of the sequence.
+ */
+static void handle_sequence(const char *sequence, size_t length) {
+    // Special keys do nothing while the filter is typed
+    if (editing_filter()) return;
+
+    // Arrows, Home and End end with a letter, PgUp, PgDn and the other Home and End with ~ after a number
+    char final = sequence[length - 1];
+    int number = atoi(sequence + 2);
+    if (final == '~') {
+        if (number == 1 || number == 7) final = 'H';
+        if (number == 4 || number == 8) final = 'F';
+        if (number == 5) scroll_list(0, -1);
+        if (number == 6) scroll_list(0, 1);
+    }
+    switch (final) {
+        case 'A':
+            scroll_list(-1, 0);
+            break;
+        case 'B':
+            scroll_list(1, 0);
+            break;
+        case 'D':
+            scroll_history(-1);
+            break;
+        case 'C':
+            scroll_history(1);
+            break;
+        case 'H':
+            scroll_history(-HISTORY_JUMP);
+            break;
+        case 'F':
+            scroll_history(HISTORY_JUMP);
+            break;
+    }
+}
+
+/**
+ * @brief Function for splitting the bytes read from the terminal into keys and escape sequences.
+ * @param keys Bytes read.
+ * @param length Number of bytes read.
+ */
+static void handle_input(const char *keys, ssize_t length) {
+    for (ssize_t i = 0; i < length; i++) {
+        char key = keys[i];
+        if (escape_length == 0) {
+            if (key == '\033') {
+                escape_sequence[escape_length++] = key;
+            } else {
+                handle_key(key);
+            }
+            continue;
+        }
+
+        // ESC not followed by [ or O is the Esc key itself, the byte after it is a key of its own
+        if (escape_length == 1 && key != '[' && key != 'O') {
+            escape_length = 0;
+            handle_key('\033');
+            i--;
+            continue;
+        }
 
+        // SS3 ends with the byte after O, CSI with the first byte from @ to ~ after parameters and intermediates
+        bool final = escape_length >= 2 && (escape_sequence[1] == 'O' || (key >= 0x40 && key <= 0x7e));
+        if (escape_length >= 2 && !final && (key < 0x20 || key > 0x3f)) {
+            // Not a sequence after all, it is dropped and the byte read again
+            escape_length = 0;
+            i--;
+            continue;
+        }
+        if (escape_length < sizeof(escape_sequence)) escape_sequence[escape_length++] = key;
+        if (final) {
+            if (escape_length < sizeof(escape_sequence)) handle_sequence(escape_sequence, escape_length);
+            escape_length = 0;
+        }
+    }
+}
+
+/**
+ * @brief Function for processing timer ticks and signals until SIGINT arrives, packets are processed by workers.
+ * @param events Descriptors created by setup_events.
+ */
+void run_event_loop(const EventFds &events) {
+    struct epoll_event ready[4];
+    bool running = true;
+
+    while (running) {
+        // Nothing following an ESC within the delay means the Esc key was pressed on its own
+        int count = epoll_wait(events.epoll_fd, ready, 4, escape_length == 1 ? ESCAPE_DELAY_MS : -1);
+        if (count == -1 && errno != EINTR) break;
+        if (count == 0 && escape_length == 1) {
+            escape_length = 0;
+            handle_key('\033');
+        }
+
+        for (int i = 0; i < count; i++) {
+            int fd = ready[i].data.fd;
+
+            if (fd == events.timer_fd) {
+                // Refresh interval has elapsed, workers close it and the render thread draws it
+                uint64_t expirations;
+                if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                    advance_epoch();
+                }
+            } else if (fd == events.input_fd) {
+                char keys[16];
+                ssize_t length = read(fd, keys, sizeof(keys));
+                if (length <= 0) {
+                    // Terminal is gone, stop polling it instead of waking up forever
+                    epoll_ctl(events.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+                    continue;
+                }
+                handle_input(keys, length);
+            } else if (fd == events.signal_fd) {
+                struct signalfd_siginfo info;
+                while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+                    if (info.ssi_signo == SIGINT) {
+                        running = false;
+                    } else if (info.ssi_signo == SIGWINCH) {
+                        // Ncurses is only touched by the render thread
+                        resize_pending = true;
+                        request_redraw();
+                    }
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
     parse_args(argc, argv);
+    view_aggregation = aggregation_level(aggregation);
+    view_sort = sort_order == 'p' ? SORT_PACKETS : SORT_BYTES;
+    view_count = top_count;
+    view_resolve = resolve_mode(resolve);
+
+    if (!stats_path.empty() && !open_stats_file(stats_path)) {
+        std::cerr << "[ ERROR ] Cannot open stats file " << stats_path << ": " << strerror(errno) << "\n";
+        return EXIT_FAILURE;
+    }
     
-    // Initialization of packet capture on the interface
-    if ((handle = pcap_open_live(interface.c_str(), BUFSIZ, 1, 1000, errbuf)) == nullptr) {
-        std::cerr << "[ ERROR ] Cannot open device " << interface << ": " << errbuf << "\n";
+    if (!playback_path.empty()) {
+        // Nothing is captured, the render thread only reads the history and is woken up by keys
+        if (!open_playback(playback_path, errbuf) || (snapshot_fd = eventfd(0, EFD_CLOEXEC)) == -1) {
+            std::cerr << "[ ERROR ] Cannot open history " << errbuf << "\n";
+            return EXIT_FAILURE;
+        }
+    } else if (!history_path.empty() && !open_history(history_path, history_max_size, errbuf)) {
+        std::cerr << "[ ERROR ] Cannot open history " << errbuf << "\n";
         return EXIT_FAILURE;
     }
 
-    // Set the pcap handle to non-blocking mode
-    if (pcap_setnonblock(handle, 1, errbuf) == -1) {
-        std::cerr << "[ ERROR ] Cannot set non-blocking mode: " << errbuf << "\n";
+    // Initialization of packet capture, every worker gets its own socket
+    if (playback_path.empty() && !open_workers(worker_count, errbuf)) {
+        if (!read_file.empty()) {
+            std::cerr << "[ ERROR ] Cannot open file " << read_file << ": " << errbuf << "\n";
+        } else {
+            std::cerr << "[ ERROR ] Cannot open device " << interface << ": " << errbuf << "\n";
+        }
         return EXIT_FAILURE;
     }
 
-    // Validation that the provided interface supports ethernet packets
-    check_ethernet_support();
+    EventFds events;
+    if (!setup_events(events)) {
+        std::cerr << "[ ERROR ] Cannot set up event loop: " << strerror(errno) << "\n";
+        return EXIT_FAILURE;
+    }
 
-    auto start_time = std::chrono::steady_clock::now();
+    if (!headless_format.empty()) {
+        // Headless mode never touches the terminal, records go to the output instead
+        if (!open_output(output_path, errbuf)) {
+            std::cerr << "[ ERROR ] Cannot open output " << errbuf << "\n";
+            return EXIT_FAILURE;
+        }
+    } else {
+        // Initialation of ncurses
+        initscr();
+        noecho();
+        cbreak();
 
-    // Initialation of ncurses
-    initscr();
-    noecho();
-    cbreak();
+        display_startup();
 
-    display_startup(); 
+        // Names are only shown on the screen, lookups run in the background and never hold up a frame
+        start_resolver(resolve_threads);
+    }
 
-    while (true) {
-        // Process incomming and outgoing network traffic
-        pcap_dispatch(handle, -1, packet_handler, nullptr);
+    start_workers();
+    start_render();
 
+    // Playback starts at the newest interval
+    if (!playback_path.empty()) scroll_history(HISTORY_JUMP);
 
-        auto curr_time = std::chrono::steady_clock::now();
-        std::chrono::duration<double> last_refresh = curr_time - start_time;
+    run_event_loop(events);
 
-        // Check, if we have reached referesh interval
-        if (last_refresh.count() >= refresh_interval) {
-            start_time = curr_time;
-            display_statistics();
-        }
+    cleanup();
+    for (int fd : {events.epoll_fd, events.timer_fd, events.signal_fd}) {
+        if (fd != -1) close(fd);
     }
 
-    endwin();
-    pcap_close(handle);
+    // Throughput of the engine on the trace, the screen is already restored
+    if (!read_file.empty()) {
+        const Worker &worker = *workers.front();
+        double seconds = static_cast<double>(worker.replay_ns) / 1e9;
+        std::ostream &out = headless_format.empty() ? std::cout : std::cerr;     // Standard output may carry the records
+        out << "Replayed " << worker.replayed << " packets in " << seconds << " s ("
+            << (seconds > 0 ? static_cast<uint64_t>(worker.replayed / seconds) : 0) << " packets/s)\n";
+    }
 
     return 0;
 }
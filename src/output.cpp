@@ -0,0 +1,346 @@
+// Aurel Strigáč <xstrig00>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+
+#include "output.h"
+#include "net-top.h"
+
+static int output_fd = -1;              // Descriptor records are written to
+static int output_flags = -1;           // Flags of the descriptor before O_NONBLOCK was set
+static bool output_blocking = false;    // Whether the consumer paces the producer (replay)
+static bool output_failed = false;      // Set once the consumer has gone away
+static char buffer[OUTPUT_BUFFER_SIZE]; // Formatted records not written yet
+static size_t head = 0, tail = 0;       // Bytes in [head, tail) are pending
+static uint64_t dropped_records = 0;    // Records which didn't fit into the buffer
+
+/**
+ * @brief Record being formatted into a fixed buffer, nothing is allocated.
+ */
+struct Record {
+    char data[OUTPUT_RECORD_LEN];
+    size_t length = 0;
+};
+
+/**
+ * @brief Function for appending a string to a record.
+ * @param record Record to append to.
+ * @param text Null-terminated string.
+ */
+static void append(Record &record, const char *text) {
+    size_t length = strlen(text);
+    if (record.length + length > sizeof(record.data)) length = sizeof(record.data) - record.length;
+    memcpy(record.data + record.length, text, length);
+    record.length += length;
+}
+
+/**
+ * @brief Function for appending an unsigned number in decimal to a record.
+ * @param record Record to append to.
+ * @param value Number.
+ */
+static void append(Record &record, uint64_t value) {
+    // Digits are produced from the lowest one, so they are written from the end of a scratch buffer
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[sizeof(digits) - ++count] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    if (record.length + count > sizeof(record.data)) return;
+    memcpy(record.data + record.length, digits + sizeof(digits) - count, count);
+    record.length += count;
+}
+
+/**
+ * @brief Function for appending an IP address to a record, IPv6 without brackets since ports are separate fields.
+ * @param record Record to append to.
+ * @param ip IP address in binary form.
+ * @param family Address family (AF_INET/AF_INET6).
+ */
+static void append_ip(Record &record, const uint8_t *ip, uint8_t family) {
+    char ip_str[INET6_ADDRSTRLEN];
+    inet_ntop(family, ip, ip_str, sizeof(ip_str));
+    append(record, ip_str);
+}
+
+/**
+ * @brief Function for appending the source address of a key, with the prefix length at the prefix level.
+ * @param record Record to append to.
+ * @param key FlowID.
+ * @param level Aggregation level of the key.
+ */
+static void append_source(Record &record, const FlowID &key, Aggregation level) {
+    append_ip(record, key.ip1, key.family);
+    if (level != AGGREGATE_PREFIX) return;
+    append(record, "/");
+    append(record, static_cast<uint64_t>(key.family == AF_INET6 ? prefix_v6 : prefix_v4));
+}
+
+/**
+ * @brief Function for appending a protocol name to a record.
+ * @param record Record to append to.
+ * @param proto IP protocol number.
+ */
+static void append_proto(Record &record, uint8_t proto) {
+    switch (proto) {
+        case IPPROTO_TCP:
+            return append(record, "tcp");
+        case IPPROTO_UDP:
+            return append(record, "udp");
+        case IPPROTO_ICMP:
+            return append(record, "icmp");
+        case IPPROTO_ICMPV6:
+            return append(record, "icmp6");
+        default:
+            return append(record, static_cast<uint64_t>(proto));
+    }
+}
+
+/**
+ * @brief Function for formatting a flow as a JSON object on one line, fields merged by the aggregation are left out.
+ * @param record Record to fill.
+ * @param epoch Interval the flow belongs to.
+ * @param closed End of the interval in milliseconds.
+ * @param level Aggregation level of the key.
+ * @param key FlowID.
+ * @param stats FlowStats.
+ */
+static void format_ndjson(Record &record, uint32_t epoch, uint64_t closed, Aggregation level, const FlowID &key, const FlowStats &stats) {
+    uint64_t interval = static_cast<uint64_t>(refresh_ms);
+    unsigned fields = AGGREGATION_FIELDS[level];
+    append(record, "{\"time_ms\":");
+    append(record, closed);
+    append(record, ",\"epoch\":");
+    append(record, static_cast<uint64_t>(epoch));
+    if (level != AGGREGATE_FLOW) {
+        append(record, ",\"aggregate\":\"");
+        append(record, AGGREGATION_NAMES[level]);
+        append(record, "\"");
+    }
+    if (!interfaces.empty()) {
+        append(record, ",\"interface\":\"");
+        append(record, interfaces[key.ingress].c_str());
+        append(record, "\"");
+    }
+    if (fields & FIELD_SRC_IP) {
+        append(record, ",\"src\":\"");
+        append_source(record, key, level);
+        append(record, "\"");
+    }
+    if (fields & FIELD_SRC_PORT) {
+        append(record, ",\"src_port\":");
+        append(record, static_cast<uint64_t>(key.port1));
+    }
+    if (fields & FIELD_DST_IP) {
+        append(record, ",\"dst\":\"");
+        append_ip(record, key.ip2, key.family);
+        append(record, "\"");
+    }
+    if (fields & FIELD_DST_PORT) {
+        append(record, ",\"dst_port\":");
+        append(record, static_cast<uint64_t>(key.port2));
+    }
+    if (fields & FIELD_PROTO) {
+        append(record, ",\"proto\":\"");
+        append_proto(record, key.proto);
+        append(record, "\"");
+    }
+    append(record, ",\"rx_bytes\":");
+    append(record, stats.B_rx);
+    append(record, ",\"rx_packets\":");
+    append(record, stats.p_rx);
+    append(record, ",\"tx_bytes\":");
+    append(record, stats.B_tx);
+    append(record, ",\"tx_packets\":");
+    append(record, stats.p_tx);
+    append(record, ",\"rx_bps\":");
+    append(record, stats.B_rx * 8000 / interval);
+    append(record, ",\"rx_pps\":");
+    append(record, stats.p_rx * 1000 / interval);
+    append(record, ",\"tx_bps\":");
+    append(record, stats.B_tx * 8000 / interval);
+    append(record, ",\"tx_pps\":");
+    append(record, stats.p_tx * 1000 / interval);
+    for (int metric = 0; metric < RATE_METRICS; metric++) {
+        append(record, ",\"rx_bps_");
+        append(record, RATE_NAMES[metric]);
+        append(record, "\":");
+        append(record, static_cast<uint64_t>(stats.rates.rx[metric] * 8));
+        append(record, ",\"tx_bps_");
+        append(record, RATE_NAMES[metric]);
+        append(record, "\":");
+        append(record, static_cast<uint64_t>(stats.rates.tx[metric] * 8));
+    }
+    append(record, ",\"error\":");
+    append(record, stats.error);
+    append(record, "}\n");
+}
+
+/**
+ * @brief Function for formatting a flow as a CSV row, columns follow the header written by open_output, merged fields are empty.
+ * @param record Record to fill.
+ * @param epoch Interval the flow belongs to.
+ * @param closed End of the interval in milliseconds.
+ * @param level Aggregation level of the key.
+ * @param key FlowID.
+ * @param stats FlowStats.
+ */
+static void format_csv(Record &record, uint32_t epoch, uint64_t closed, Aggregation level, const FlowID &key, const FlowStats &stats) {
+    uint64_t interval = static_cast<uint64_t>(refresh_ms);
+    unsigned fields = AGGREGATION_FIELDS[level];
+    append(record, closed);
+    append(record, ",");
+    append(record, static_cast<uint64_t>(epoch));
+    append(record, ",");
+    if (!interfaces.empty()) append(record, interfaces[key.ingress].c_str());
+    append(record, ",");
+    if (fields & FIELD_SRC_IP) append_source(record, key, level);
+    append(record, ",");
+    if (fields & FIELD_SRC_PORT) append(record, static_cast<uint64_t>(key.port1));
+    append(record, ",");
+    if (fields & FIELD_DST_IP) append_ip(record, key.ip2, key.family);
+    append(record, ",");
+    if (fields & FIELD_DST_PORT) append(record, static_cast<uint64_t>(key.port2));
+    append(record, ",");
+    if (fields & FIELD_PROTO) append_proto(record, key.proto);
+    for (uint64_t value : {stats.B_rx, stats.p_rx, stats.B_tx, stats.p_tx, stats.B_rx * 8000 / interval, stats.p_rx * 1000 / interval,
+                           stats.B_tx * 8000 / interval, stats.p_tx * 1000 / interval}) {
+        append(record, ",");
+        append(record, value);
+    }
+    for (int metric = 0; metric < RATE_METRICS; metric++) {
+        append(record, ",");
+        append(record, static_cast<uint64_t>(stats.rates.rx[metric] * 8));
+        append(record, ",");
+        append(record, static_cast<uint64_t>(stats.rates.tx[metric] * 8));
+    }
+    append(record, ",");
+    append(record, stats.error);
+    append(record, "\n");
+}
+
+/**
+ * @brief Function for writing as much of the buffer as the consumer takes, without waiting unless the output is blocking.
+ */
+static void flush_output() {
+    while (head < tail && !output_failed) {
+        ssize_t written = write(output_fd, buffer + head, tail - head);
+        if (written > 0) {
+            head += static_cast<size_t>(written);
+        } else if (written == -1 && errno == EINTR) {
+            continue;
+        } else if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            // The consumer has gone away, there is no point in capturing for nobody
+            std::cerr << "[ ERROR ] Cannot write output: " << strerror(errno) << "\n";
+            output_failed = true;
+            kill(getpid(), SIGINT);
+        }
+    }
+
+    // Pending bytes are moved to the front, so the free space is contiguous
+    if (head == tail) {
+        head = tail = 0;
+    } else if (head > 0) {
+        memmove(buffer, buffer + head, tail - head);
+        tail -= head;
+        head = 0;
+    }
+}
+
+/**
+ * @brief Function for opening the headless output and writing the CSV header.
+ * @param path File to write to, empty or "-" for standard output.
+ * @param errbuf Buffer for the error message.
+ * @return True on success, false otherwise.
+ */
+bool open_output(const std::string &path, char *errbuf) {
+    if (path.empty() || path == "-") {
+        output_fd = STDOUT_FILENO;
+    } else if ((output_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // A full pipe must not hold up a live capture, a replay is paced by the consumer instead of losing records
+    output_blocking = !read_file.empty();
+    if (!output_blocking) {
+        if ((output_flags = fcntl(output_fd, F_GETFL)) == -1 || fcntl(output_fd, F_SETFL, output_flags | O_NONBLOCK) == -1) {
+            snprintf(errbuf, PCAP_ERRBUF_SIZE, "fcntl: %s", strerror(errno));
+            return false;
+        }
+    }
+
+    // A closed consumer is reported by write instead of a signal
+    signal(SIGPIPE, SIG_IGN);
+
+    if (headless_format == "csv") {
+        const char *header = "time_ms,epoch,interface,src,src_port,dst,dst_port,proto,rx_bytes,rx_packets,tx_bytes,tx_packets,"
+                             "rx_bps,rx_pps,tx_bps,tx_pps,rx_bps_2s,tx_bps_2s,rx_bps_10s,tx_bps_10s,rx_bps_40s,tx_bps_40s,"
+                             "rx_bps_ewma,tx_bps_ewma,rx_bps_peak,tx_bps_peak,error\n";
+        tail = strlen(header);
+        memcpy(buffer, header, tail);
+    }
+    return true;
+}
+
+/**
+ * @brief Function for streaming the selected flows of an interval, never blocks on a slow consumer of a live capture.
+ * @param epoch Interval the flows belong to.
+ * @param closed End of the interval in milliseconds.
+ * @param level Aggregation level of the flows, merged fields are left out.
+ * @param flows Merged flows, the first count of them are written.
+ * @param count Number of flows to write.
+ */
+void output_flows(uint32_t epoch, uint64_t closed, Aggregation level, const std::vector<FlowRef> &flows, size_t count) {
+    if (output_failed) return;
+    flush_output();
+
+    // Live records of an interval are dropped once the buffer is full, earlier intervals are never cut
+    bool ndjson = headless_format == "ndjson";
+    for (size_t i = 0; i < count; i++) {
+        Record record;
+        if (ndjson) {
+            format_ndjson(record, epoch, closed, level, flows[i]->first, flows[i]->second);
+        } else {
+            format_csv(record, epoch, closed, level, flows[i]->first, flows[i]->second);
+        }
+
+        if (tail + record.length > sizeof(buffer) && output_blocking) flush_output();
+        if (tail + record.length > sizeof(buffer)) {
+            dropped_records += count - i;
+            break;
+        }
+        memcpy(buffer + tail, record.data, record.length);
+        tail += record.length;
+    }
+
+    flush_output();
+}
+
+/**
+ * @brief Function for writing what is still buffered, waiting for the consumer, and restoring the descriptor.
+ */
+void close_output() {
+    if (output_fd == -1) return;
+
+    // Capture has stopped, so the rest can be written blocking
+    if (output_flags != -1) fcntl(output_fd, F_SETFL, output_flags);
+    flush_output();
+
+    if (dropped_records > 0) {
+        std::cerr << "[ WARNING ] " << dropped_records << " records dropped, the output consumer was too slow\n";
+    }
+    if (output_fd != STDOUT_FILENO) close(output_fd);
+    output_fd = -1;
+}
@@ -0,0 +1,109 @@
+// Aurel Strigáč <xstrig00>
+
+#include <algorithm>
+#include <cmath>
+
+#include "rate.h"
+
+static const double BUCKET_SECONDS = static_cast<double>(RATE_BUCKET_MS) / 1000;
+static const double EWMA_ALPHA = 1 - std::exp(-static_cast<double>(RATE_BUCKET_MS) / RATE_EWMA_MS); // Weight of a closed bucket
+
+/**
+ * @brief Function for moving a completed bucket into the windows of one direction.
+ * @param window Windows of the direction.
+ * @param bucket Absolute index of the completed bucket.
+ * @param bytes Bytes of the bucket.
+ */
+static void close_bucket(RateWindow &window, uint32_t bucket, uint32_t bytes) {
+    uint32_t &oldest = window.buckets[bucket % RATE_BUCKETS];
+    window.sum_2s += bytes;
+    window.sum_2s -= oldest;
+    oldest = bytes;
+
+    float rate = static_cast<float>(static_cast<double>(bytes) / BUCKET_SECONDS);
+    window.ewma += static_cast<float>(EWMA_ALPHA) * (rate - window.ewma);
+    window.peak = std::max(window.peak, static_cast<float>(static_cast<double>(window.sum_2s) / (BUCKET_SECONDS * RATE_BUCKETS)));
+
+    // The last bucket of a slot completes it, the bucket ring then holds exactly that slot
+    if (bucket % RATE_BUCKETS != RATE_BUCKETS - 1) return;
+    uint32_t slot = (bucket / RATE_BUCKETS) % RATE_SLOTS;
+    float bytes_slot = static_cast<float>(window.sum_2s);
+    window.sum_10s += static_cast<double>(bytes_slot) - window.slots[(slot + RATE_SLOTS - RATE_SLOTS_10S) % RATE_SLOTS];
+    window.sum_40s += static_cast<double>(bytes_slot) - window.slots[slot];
+    window.slots[slot] = bytes_slot;
+}
+
+/**
+ * @brief Function for starting the rates of a new flow with empty windows.
+ * @param current Current bucket of the flow.
+ * @param rates Windows of the flow.
+ * @param now Time of the first packet in milliseconds.
+ */
+void reset_rates(RateBucket &current, FlowRates &rates, uint64_t now) {
+    current = RateBucket();
+    current.index = rate_bucket(now);
+    rates = FlowRates();
+}
+
+/**
+ * @brief Function for closing the buckets before the given one, quiet buckets are closed empty.
+ * @param current Current bucket of the flow.
+ * @param rates Windows of the flow.
+ * @param bucket Index of the new current bucket.
+ */
+void advance_rates(RateBucket &current, FlowRates &rates, uint32_t bucket) {
+    // Time going backwards (a replay of merged files) just continues in the current bucket
+    if (static_cast<int32_t>(bucket - current.index) <= 0) return;
+    uint32_t quiet = bucket - current.index - 1;
+
+    RateWindow *windows[2] = {&rates.tx, &rates.rx};
+    for (int direction = 0; direction < 2; direction++) {
+        RateWindow *window = windows[direction];
+        close_bucket(*window, current.index, current.bytes[direction]);
+        current.bytes[direction] = 0;
+
+        // Beyond the longest window nothing is left but the decayed average and the peak
+        if (quiet > RATE_BUCKETS * (RATE_SLOTS + 1)) {
+            float ewma = window->ewma * static_cast<float>(std::pow(1 - EWMA_ALPHA, quiet));
+            float peak = window->peak;
+            *window = RateWindow();
+            window->ewma = ewma;
+            window->peak = peak;
+            continue;
+        }
+        for (uint32_t empty = current.index + 1; empty != bucket; empty++) close_bucket(*window, empty, 0);
+    }
+    current.index = bucket;
+}
+
+/**
+ * @brief Function for reading the rates of a flow from its windows.
+ * @param rates Rate state of the flow, advanced to the current bucket.
+ * @param summary Rates in bytes per second.
+ */
+void summarize_rates(const FlowRates &rates, RateSummary &summary) {
+    const double slot_seconds = BUCKET_SECONDS * RATE_BUCKETS;
+    const RateWindow *windows[2] = {&rates.tx, &rates.rx};
+    float *rows[2] = {summary.tx, summary.rx};
+    for (int direction = 0; direction < 2; direction++) {
+        const RateWindow &window = *windows[direction];
+        float *row = rows[direction];
+        row[RATE_2S] = static_cast<float>(static_cast<double>(window.sum_2s) / slot_seconds);
+        row[RATE_10S] = static_cast<float>(window.sum_10s / (slot_seconds * RATE_SLOTS_10S));
+        row[RATE_40S] = static_cast<float>(window.sum_40s / (slot_seconds * RATE_SLOTS));
+        row[RATE_EWMA] = window.ewma;
+        row[RATE_PEAK] = window.peak;
+    }
+}
+
+/**
+ * @brief Function for translating the name of a rate metric.
+ * @param name Name given by --rate (interval/2s/10s/40s/ewma/peak).
+ * @return Metric, RATE_METRICS for the counters of the refresh interval.
+ */
+RateMetric rate_metric(const std::string &name) {
+    for (int metric = 0; metric < RATE_METRICS; metric++) {
+        if (name == RATE_NAMES[metric]) return static_cast<RateMetric>(metric);
+    }
+    return RATE_METRICS;
+}
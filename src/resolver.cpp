@@ -0,0 +1,264 @@
+// Aurel Strigáč <xstrig00>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <cctype>
+#include <condition_variable>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "resolver.h"
+#include "display.h"
+#include "stats.h"
+
+/**
+ * @brief Address or port looked up, compared and hashed as raw bytes.
+ */
+struct ResolveKey {
+    uint8_t family = 0;     // AF_INET/AF_INET6 of a host, 0 for a service
+    uint8_t proto = 0;      // IPPROTO_TCP/IPPROTO_UDP of a service
+    uint16_t port = 0;      // Port of a service
+    uint8_t ip[16] = {};    // Address of a host
+
+    bool operator==(const ResolveKey &other) const { return memcmp(this, &other, sizeof(*this)) == 0; }
+};
+
+/**
+ * @brief FNV-1a hash of the key bytes.
+ */
+struct ResolveKeyHash {
+    size_t operator()(const ResolveKey &key) const {
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&key);
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < sizeof(key); i++) hash = (hash ^ bytes[i]) * 16777619u;
+        return hash;
+    }
+};
+
+/**
+ * @brief Cached name of a key.
+ */
+struct CacheEntry {
+    ResolveKey key;
+    std::string name;           // Name found, empty if there is none or it is not known yet
+    uint64_t expires_ms = 0;    // Monotonic time after which the key is looked up again
+    bool pending = false;       // Queued or being looked up
+};
+
+/**
+ * @brief State shared by the render thread and the resolver threads.
+ *
+ * Lookups can't be cancelled, so a thread may still be inside getnameinfo when the program exits.
+ * The threads are detached and the state is never freed, so they never touch destroyed objects.
+ */
+struct Resolver {
+    std::mutex lock;
+    std::condition_variable ready;      // Signalled when a key is queued or the threads are stopped
+    std::list<CacheEntry> cache;        // Entries, the most recently shown first
+    std::unordered_map<ResolveKey, std::list<CacheEntry>::iterator, ResolveKeyHash> index;
+    std::vector<ResolveKey> queue;      // Keys to look up, the last queued is taken first as its row was shown last
+    size_t busy = 0;                    // Lookups in progress
+    bool running = false;
+};
+
+static Resolver *resolver = nullptr;
+
+/**
+ * @brief Function for finding the resolve mode of a name.
+ * @param name Name as given by --resolve.
+ * @return ResolveMode, RESOLVE_MODES for an unknown name.
+ */
+ResolveMode resolve_mode(const std::string &name) {
+    for (int mode = 0; mode < RESOLVE_MODES; mode++) {
+        if (name == RESOLVE_NAMES[mode]) return static_cast<ResolveMode>(mode);
+    }
+    return RESOLVE_MODES;
+}
+
+/**
+ * @brief Function for looking up the name of a key, blocks for as long as the system resolver takes.
+ * @param key Address or port.
+ * @param name Found name.
+ * @return 0 on success, EAI_NONAME if there is no name, another EAI_* code if the lookup failed.
+ */
+static int resolve_key(const ResolveKey &key, std::string &name) {
+    struct sockaddr_storage address = {};
+    socklen_t length;
+    if (key.family == AF_INET6) {
+        auto *ipv6 = reinterpret_cast<struct sockaddr_in6 *>(&address);
+        ipv6->sin6_family = AF_INET6;
+        memcpy(&ipv6->sin6_addr, key.ip, 16);
+        length = sizeof(*ipv6);
+    } else {
+        auto *ipv4 = reinterpret_cast<struct sockaddr_in *>(&address);
+        ipv4->sin_family = AF_INET;
+        ipv4->sin_port = htons(key.port);
+        memcpy(&ipv4->sin_addr, key.ip, 4);
+        length = sizeof(*ipv4);
+    }
+
+    char text[NI_MAXHOST];
+    int result;
+    if (key.family != 0) {
+        // Addresses without a name fail instead of coming back as numbers
+        result = getnameinfo(reinterpret_cast<struct sockaddr *>(&address), length, text, sizeof(text), nullptr, 0, NI_NAMEREQD);
+    } else {
+        // Ports without a name come back as numbers
+        result = getnameinfo(reinterpret_cast<struct sockaddr *>(&address), length, nullptr, 0, text, NI_MAXSERV,
+                             NI_NUMERICHOST | (key.proto == IPPROTO_UDP ? NI_DGRAM : 0));
+        if (result == 0 && isdigit(static_cast<unsigned char>(text[0]))) result = EAI_NONAME;
+    }
+    if (result == 0) name = text;
+    return result;
+}
+
+/**
+ * @brief Function run by the resolver threads, looks up queued keys until stopped.
+ */
+static void resolver_loop() {
+    std::unique_lock<std::mutex> lock(resolver->lock);
+    while (true) {
+        resolver->ready.wait(lock, [] { return !resolver->running || !resolver->queue.empty(); });
+        if (!resolver->running) return;
+        ResolveKey key = resolver->queue.back();
+        resolver->queue.pop_back();
+        resolver->busy++;
+
+        // The cache stays usable while the lookup blocks
+        lock.unlock();
+        std::string name;
+        int result = resolve_key(key, name);
+        uint64_t now = monotonic_ns() / 1000000;
+        lock.lock();
+        resolver->busy--;
+
+        // The entry may have been dropped meanwhile, a temporary failure keeps the name found before
+        auto found = resolver->index.find(key);
+        if (found == resolver->index.end()) continue;
+        CacheEntry &entry = *found->second;
+        bool changed = entry.name != name && (result == 0 || result == EAI_NONAME);
+        if (result == 0 || result == EAI_NONAME) entry.name = name;
+        entry.expires_ms = now + (result == 0 ? RESOLVER_TTL_MS : RESOLVER_NEGATIVE_TTL_MS);
+        entry.pending = false;
+
+        // A new name is drawn without waiting for the next interval
+        if (changed && resolver->running) request_redraw();
+    }
+}
+
+/**
+ * @brief Function for starting the resolver threads.
+ * @param threads Number of lookups running at once.
+ */
+void start_resolver(unsigned threads) {
+    if (resolver == nullptr) resolver = new Resolver();
+    resolver->running = true;
+    for (unsigned i = 0; i < threads; i++) std::thread(resolver_loop).detach();
+}
+
+/**
+ * @brief Function for stopping the resolver threads, lookups in progress are not waited for.
+ */
+void stop_resolver() {
+    if (resolver == nullptr) return;
+    std::lock_guard<std::mutex> lock(resolver->lock);
+    resolver->running = false;
+    resolver->queue.clear();
+    resolver->ready.notify_all();
+}
+
+/**
+ * @brief Function for getting the cached name of a key, queueing a lookup if requested.
+ * @param key Address or port.
+ * @param request Whether a missing or expired name is queued for a lookup.
+ * @param buffer Buffer for the name.
+ * @param size Size of the buffer.
+ * @return True if a name was copied.
+ */
+static bool lookup(const ResolveKey &key, bool request, char *buffer, size_t size) {
+    if (resolver == nullptr) return false;
+    uint64_t now = monotonic_ns() / 1000000;
+    std::lock_guard<std::mutex> lock(resolver->lock);
+    request = request && resolver->running;
+
+    auto found = resolver->index.find(key);
+    if (found == resolver->index.end()) {
+        // A full queue leaves the key unknown, the next frame asks again
+        if (!request || resolver->queue.size() >= RESOLVER_QUEUE_SIZE) return false;
+        resolver->cache.emplace_front();
+        resolver->cache.front().key = key;
+        resolver->cache.front().pending = true;
+        resolver->index[key] = resolver->cache.begin();
+        resolver->queue.push_back(key);
+        resolver->ready.notify_one();
+
+        // The entry shown the longest time ago makes room
+        if (resolver->cache.size() > RESOLVER_CACHE_SIZE) {
+            resolver->index.erase(resolver->cache.back().key);
+            resolver->cache.pop_back();
+        }
+        return false;
+    }
+
+    // Only rows on the screen count as a use, the filter just peeks
+    auto entry = found->second;
+    if (request) {
+        resolver->cache.splice(resolver->cache.begin(), resolver->cache, entry);
+        if (!entry->pending && now >= entry->expires_ms && resolver->queue.size() < RESOLVER_QUEUE_SIZE) {
+            entry->pending = true;
+            resolver->queue.push_back(key);
+            resolver->ready.notify_one();
+        }
+    }
+    if (entry->name.empty()) return false;
+    snprintf(buffer, size, "%s", entry->name.c_str());
+    return true;
+}
+
+/**
+ * @brief Function for getting the cached host name of an address, never waits for a lookup.
+ * @param ip IP address in binary form.
+ * @param family Address family (AF_INET/AF_INET6).
+ * @param request Whether a missing or expired name is queued for a lookup, only for rows on the screen.
+ * @param buffer Buffer for the name.
+ * @param size Size of the buffer.
+ * @return True if a name was copied, false while it is unknown or has none.
+ */
+bool lookup_host(const uint8_t *ip, uint8_t family, bool request, char *buffer, size_t size) {
+    ResolveKey key;
+    key.family = family;
+    memcpy(key.ip, ip, family == AF_INET6 ? 16 : 4);
+    return lookup(key, request, buffer, size);
+}
+
+/**
+ * @brief Function for getting the cached service name of a port, never waits for a lookup.
+ * @param port Port number.
+ * @param proto IP protocol number, only TCP and UDP ports have names.
+ * @param request Whether a missing or expired name is queued for a lookup, only for rows on the screen.
+ * @param buffer Buffer for the name.
+ * @param size Size of the buffer.
+ * @return True if a name was copied, false while it is unknown or has none.
+ */
+bool lookup_service(uint16_t port, uint8_t proto, bool request, char *buffer, size_t size) {
+    if (proto != IPPROTO_TCP && proto != IPPROTO_UDP) return false;
+    ResolveKey key;
+    key.proto = proto;
+    key.port = port;
+    return lookup(key, request, buffer, size);
+}
+
+/**
+ * @brief Function for counting the lookups queued or in progress.
+ * @return Number of pending lookups.
+ */
+size_t resolver_pending() {
+    if (resolver == nullptr) return 0;
+    std::lock_guard<std::mutex> lock(resolver->lock);
+    return resolver->queue.size() + resolver->busy;
+}
@@ -0,0 +1,278 @@
+// Aurel Strigáč <xstrig00>
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include "ring.h"
+
+/**
+ * @brief Function for filling the error buffer from errno and releasing the partially opened ring.
+ * @param ring Ring to release.
+ * @param errbuf Buffer for the error message.
+ * @param what Failed operation.
+ * @return Always false.
+ */
+static bool ring_fail(Ring &ring, char *errbuf, const char *what) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s", what, strerror(errno));
+    ring_close(ring);
+    return false;
+}
+
+/**
+ * @brief Function for opening the interface and mapping its receive ring.
+ * @param ring Ring to initialize.
+ * @param device Network interface name.
+ * @param block_size Size of one block in bytes, must be a multiple of the page size.
+ * @param block_count Number of blocks in the ring.
+ * @param errbuf Buffer for the error message.
+ * @return True on success, false otherwise.
+ */
+bool ring_open(Ring &ring, const std::string &device, unsigned block_size, unsigned block_count, char *errbuf) {
+    // Index 0 binds the socket to all interfaces, same as the "any" device of libpcap
+    bool any = device == "any";
+    unsigned ifindex = any ? 0 : if_nametoindex(device.c_str());
+    if (!any && ifindex == 0) return ring_fail(ring, errbuf, "if_nametoindex");
+
+    if ((ring.fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) == -1) return ring_fail(ring, errbuf, "socket");
+
+    // Ethernet frames are read whole, interfaces with other or mixed link headers get them stripped
+    // by a datagram socket, so their frames start with the IP header
+    ring.link = LinkType::RAW;
+    if (!any) {
+        struct ifreq ifr = {};
+        strncpy(ifr.ifr_name, device.c_str(), IFNAMSIZ - 1);
+        if (ioctl(ring.fd, SIOCGIFHWADDR, &ifr) == -1) return ring_fail(ring, errbuf, "SIOCGIFHWADDR");
+        if (ifr.ifr_hwaddr.sa_family == ARPHRD_ETHER || ifr.ifr_hwaddr.sa_family == ARPHRD_LOOPBACK) ring.link = LinkType::ETHERNET;
+    }
+    if (ring.link == LinkType::RAW) {
+        close(ring.fd);
+        if ((ring.fd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_ALL))) == -1) return ring_fail(ring, errbuf, "socket");
+    }
+
+    int version = TPACKET_V3;
+    if (setsockopt(ring.fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+        return ring_fail(ring, errbuf, "PACKET_VERSION");
+    }
+
+    // Frame size only matters for the kernel's sanity checks, V3 packs packets of variable size into blocks
+    struct tpacket_req3 req = {};
+    req.tp_block_size = block_size;
+    req.tp_block_nr = block_count;
+    req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+    req.tp_frame_nr = (block_size / req.tp_frame_size) * block_count;
+    req.tp_retire_blk_tov = 50;     // Hand over partially filled blocks after 50 ms
+    if (setsockopt(ring.fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+        return ring_fail(ring, errbuf, "PACKET_RX_RING");
+    }
+
+    ring.block_size = block_size;
+    ring.block_count = block_count;
+    ring.map_size = static_cast<size_t>(block_size) * block_count;
+    void *map = mmap(nullptr, ring.map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, ring.fd, 0);
+    if (map == MAP_FAILED) {
+        // Locking may exceed RLIMIT_MEMLOCK, the ring works without it
+        map = mmap(nullptr, ring.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring.fd, 0);
+        if (map == MAP_FAILED) return ring_fail(ring, errbuf, "mmap");
+    }
+    ring.map = static_cast<uint8_t *>(map);
+
+    struct sockaddr_ll addr = {};
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = ifindex;
+    if (bind(ring.fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1) {
+        return ring_fail(ring, errbuf, "bind");
+    }
+
+    // Promiscuous mode, same as pcap_open_live does, the "any" device has no single interface to switch
+    if (any) {
+        ring.current = 0;
+        return true;
+    }
+    struct packet_mreq mreq = {};
+    mreq.mr_ifindex = ifindex;
+    mreq.mr_type = PACKET_MR_PROMISC;
+    if (setsockopt(ring.fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1) {
+        return ring_fail(ring, errbuf, "PACKET_ADD_MEMBERSHIP");
+    }
+
+    ring.current = 0;
+    return true;
+}
+
+/**
+ * @brief Function for processing blocks the kernel has handed over to user space, at most one pass over the ring.
+ * @param ring Opened ring.
+ * @param callback Function called for each packet, same as with pcap_dispatch.
+ * @param user Argument passed to the callback.
+ * @return Number of processed packets.
+ */
+int ring_dispatch(Ring &ring, pcap_handler callback, u_char *user) {
+    int count = 0;
+
+    // At most one pass over the ring, so the caller regains control under sustained load
+    for (unsigned blocks = 0; blocks < ring.block_count; blocks++) {
+        auto *block = reinterpret_cast<struct tpacket_block_desc *>(ring.map + static_cast<size_t>(ring.current) * ring.block_size);
+        if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) break;
+
+        // Walk the packets of the block in place, they stay valid until the block is returned
+        uint32_t num_pkts = block->hdr.bh1.num_pkts;
+        auto *frame = reinterpret_cast<const uint8_t *>(block) + block->hdr.bh1.offset_to_first_pkt;
+        for (uint32_t i = 0; i < num_pkts; i++) {
+            const auto *tp = reinterpret_cast<const struct tpacket3_hdr *>(frame);
+
+            struct pcap_pkthdr header;
+            header.ts.tv_sec = tp->tp_sec;
+            header.ts.tv_usec = tp->tp_nsec / 1000;
+            header.caplen = tp->tp_snaplen;
+            header.len = tp->tp_len;
+            callback(user, &header, frame + tp->tp_mac);
+
+            frame += tp->tp_next_offset;
+        }
+        count += num_pkts;
+
+        // Return the block to the kernel
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        ring.current = (ring.current + 1) % ring.block_count;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Function for collecting packets of the handed over blocks into batches, at most one pass over the ring.
+ * @param ring Opened ring.
+ * @param batch Batch referencing packets in place, it is flushed before their block is returned to the kernel.
+ * @param flush Function called with user whenever the batch is full or its block is done.
+ * @param user Argument passed to flush.
+ * @return Number of processed packets.
+ */
+int ring_dispatch_batch(Ring &ring, PacketBatch &batch, void (*flush)(u_char *), u_char *user) {
+    int count = 0;
+
+    for (unsigned blocks = 0; blocks < ring.block_count; blocks++) {
+        auto *block = reinterpret_cast<struct tpacket_block_desc *>(ring.map + static_cast<size_t>(ring.current) * ring.block_size);
+        if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) break;
+
+        uint32_t num_pkts = block->hdr.bh1.num_pkts;
+        auto *frame = reinterpret_cast<const uint8_t *>(block) + block->hdr.bh1.offset_to_first_pkt;
+        for (uint32_t i = 0; i < num_pkts; i++) {
+            const auto *tp = reinterpret_cast<const struct tpacket3_hdr *>(frame);
+            if (batch.count == BATCH_SIZE) flush(user);
+
+            struct pcap_pkthdr header;
+            header.ts.tv_sec = tp->tp_sec;
+            header.ts.tv_usec = tp->tp_nsec / 1000;
+            header.caplen = tp->tp_snaplen;
+            header.len = tp->tp_len;
+            batch_push(batch, header, frame + tp->tp_mac);
+
+            frame += tp->tp_next_offset;
+        }
+        count += num_pkts;
+
+        // Packets of the block are referenced by the batch, it has to be processed before the block is returned
+        if (batch.count > 0) flush(user);
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        ring.current = (ring.current + 1) % ring.block_count;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Function for adding the ring's socket to a PACKET_FANOUT group in hash mode.
+ * @param ring Opened ring.
+ * @param group Fanout group identifier shared by all workers.
+ * @param errbuf Buffer for the error message.
+ * @return True on success, false otherwise.
+ */
+bool ring_join_fanout(Ring &ring, int group, char *errbuf) {
+    // Hash mode keeps both directions of a flow on one socket, defragmentation keeps fragments together
+    int fanout = (group & 0xffff) | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+    if (setsockopt(ring.fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) == -1) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "PACKET_FANOUT: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Function for attaching a compiled BPF program to the ring's socket.
+ * @param ring Opened ring.
+ * @param program Compiled filter, its return value also limits the captured length.
+ * @param errbuf Buffer for the error message.
+ * @return True on success, false otherwise.
+ */
+bool ring_set_filter(Ring &ring, const struct bpf_program &program, char *errbuf) {
+    struct sock_fprog fprog;
+    fprog.len = static_cast<unsigned short>(program.bf_len);
+    fprog.filter = reinterpret_cast<struct sock_filter *>(program.bf_insns);
+
+    if (setsockopt(ring.fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) == -1) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "SO_ATTACH_FILTER: %s", strerror(errno));
+        return false;
+    }
+
+    // Packets queued before the filter was attached may not match it, drop them, their drops are not counted either
+    ring_dispatch(ring, [](u_char *, const struct pcap_pkthdr *, const u_char *) {}, nullptr);
+    uint64_t drops = 0;
+    ring_drops(ring, drops);
+    return true;
+}
+
+/**
+ * @brief Function for reading the packets the kernel dropped since the last call, the kernel resets its counter on read.
+ * @param ring Opened ring.
+ * @param drops Increased by the dropped packets.
+ * @return True on success, false otherwise.
+ */
+bool ring_drops(Ring &ring, uint64_t &drops) {
+    struct tpacket_stats_v3 stats = {};
+    socklen_t length = sizeof(stats);
+    if (getsockopt(ring.fd, SOL_PACKET, PACKET_STATISTICS, &stats, &length) == -1) return false;
+    drops += stats.tp_drops;
+    return true;
+}
+
+/**
+ * @brief Function for reading the receive drops the driver reports for an interface.
+ * @param device Network interface name.
+ * @param drops Set to the drops since the interface came up.
+ * @return True on success, false if the interface has no counters (e.g. "any").
+ */
+bool read_interface_drops(const std::string &device, uint64_t &drops) {
+    // Same counter libpcap reports as ps_ifdrop
+    std::string path = "/sys/class/net/" + device + "/statistics/rx_dropped";
+    FILE *file = fopen(path.c_str(), "r");
+    if (file == nullptr) return false;
+
+    unsigned long long value = 0;
+    bool read = fscanf(file, "%llu", &value) == 1;
+    fclose(file);
+    if (read) drops = value;
+    return read;
+}
+
+/**
+ * @brief Function for unmapping the ring and closing the socket.
+ * @param ring Ring to close.
+ */
+void ring_close(Ring &ring) {
+    if (ring.map != nullptr) munmap(ring.map, ring.map_size);
+    if (ring.fd != -1) close(ring.fd);
+    ring.map = nullptr;
+    ring.fd = -1;
+}
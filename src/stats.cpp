@@ -0,0 +1,158 @@
+// Aurel Strigáč <xstrig00>
+
+#include <cstdio>
+#include <cinttypes>
+
+#include "stats.h"
+#include "net-top.h"
+
+static FILE *stats_file = nullptr;
+
+/**
+ * @brief Function for adding one histogram to another.
+ * @param into Histogram to add to.
+ * @param from Added histogram.
+ */
+void merge_latency(LatencyHistogram &into, const LatencyHistogram &from) {
+    for (int i = 0; i < LATENCY_BUCKETS; i++) into.buckets[i] += from.buckets[i];
+    into.count += from.count;
+    into.total_ns += from.total_ns;
+}
+
+/**
+ * @brief Function for estimating a percentile of the recorded durations.
+ * @param histogram Histogram.
+ * @param quantile Quantile between 0 and 1.
+ * @return Upper bound of the bucket holding the percentile in nanoseconds, 0 for an empty histogram.
+ */
+uint64_t latency_percentile(const LatencyHistogram &histogram, double quantile) {
+    if (histogram.count == 0) return 0;
+
+    // Smallest bucket whose cumulative count reaches the rank
+    uint64_t rank = static_cast<uint64_t>(quantile * static_cast<double>(histogram.count - 1)) + 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += histogram.buckets[i];
+        if (seen >= rank) return (2ULL << i) - 1;
+    }
+    return (2ULL << (LATENCY_BUCKETS - 1)) - 1;
+}
+
+/**
+ * @brief Function for adding one set of counters to another.
+ * @param into Counters to add to.
+ * @param from Added counters.
+ */
+void add_counters(CaptureCounters &into, const CaptureCounters &from) {
+    into.received += from.received;
+    into.unsupported += from.unsupported;
+    into.truncated += from.truncated;
+    into.kernel_drops += from.kernel_drops;
+    into.if_drops += from.if_drops;
+}
+
+/**
+ * @brief Function for computing counters of an interval from two totals.
+ * @param now Totals at the end of the interval.
+ * @param before Totals at the start of the interval.
+ * @return Difference of the totals.
+ */
+CaptureCounters counters_delta(const CaptureCounters &now, const CaptureCounters &before) {
+    CaptureCounters delta;
+    delta.received = now.received - before.received;
+    delta.unsupported = now.unsupported - before.unsupported;
+    delta.truncated = now.truncated - before.truncated;
+    delta.kernel_drops = now.kernel_drops - before.kernel_drops;
+    delta.if_drops = now.if_drops - before.if_drops;
+    return delta;
+}
+
+/**
+ * @brief Function for formatting a duration with a unit suffix.
+ * @param ns Duration in nanoseconds.
+ * @param buffer Buffer for the text, 16 bytes fit every duration.
+ * @param size Size of the buffer.
+ * @return The buffer, e.g. "850ns", "12.4us" or "3.1ms".
+ */
+const char *format_duration(double ns, char *buffer, size_t size) {
+    const char *units[] = {"ns", "us", "ms", "s"}; // Available suffixes
+    int index = 0;
+
+    // Number conversion
+    for (index = 0; ns >= 1000 && index < 3; ns /= 1000, index++) {
+    }
+
+    if (index == 0) {
+        snprintf(buffer, size, "%.0f%s", ns, units[index]);
+    } else {
+        snprintf(buffer, size, "%.1f%s", ns, units[index]);
+    }
+    return buffer;
+}
+
+/**
+ * @brief Function for opening the file the stats of every interval are written to.
+ * @param path Path of the file, it is truncated.
+ * @return True on success, false otherwise.
+ */
+bool open_stats_file(const std::string &path) {
+    stats_file = fopen(path.c_str(), "w");
+    return stats_file != nullptr;
+}
+
+/**
+ * @brief Function for writing one set of counters as JSON members.
+ * @param name Name of the object.
+ * @param counters Counters.
+ */
+static void write_counters(const char *name, const CaptureCounters &counters) {
+    fprintf(stats_file, "\"%s\":{\"received\":%" PRIu64 ",\"unsupported\":%" PRIu64 ",\"truncated\":%" PRIu64
+            ",\"kernel_drops\":%" PRIu64 ",\"if_drops\":%" PRIu64 "}",
+            name, counters.received, counters.unsupported, counters.truncated, counters.kernel_drops, counters.if_drops);
+}
+
+/**
+ * @brief Function for writing a latency histogram summary as JSON members.
+ * @param name Name of the object.
+ * @param histogram Histogram.
+ */
+static void write_latency(const char *name, const LatencyHistogram &histogram) {
+    uint64_t mean = histogram.count > 0 ? histogram.total_ns / histogram.count : 0;
+    fprintf(stats_file, ",\"%s\":{\"count\":%" PRIu64 ",\"total_ns\":%" PRIu64 ",\"mean_ns\":%" PRIu64
+            ",\"p50_ns\":%" PRIu64 ",\"p99_ns\":%" PRIu64 "}",
+            name, histogram.count, histogram.total_ns, mean,
+            latency_percentile(histogram, 0.5), latency_percentile(histogram, 0.99));
+}
+
+/**
+ * @brief Function for appending the stats of an interval to the stats file as one JSON line, nothing is done if it isn't open.
+ * @param epoch Interval the stats belong to.
+ * @param stats Instrumentation of the interval.
+ */
+void write_stats_file(uint32_t epoch, const IntervalStats &stats) {
+    if (stats_file == nullptr) return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t time_ms = static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+
+    // One self-contained object per line, so the file can be followed with tail -f
+    fprintf(stats_file, "{\"time_ms\":%" PRIu64 ",\"epoch\":%u,\"interval_ms\":%d,", time_ms, epoch, refresh_ms);
+    write_counters("interval", stats.interval);
+    fputc(',', stats_file);
+    write_counters("total", stats.total);
+    write_latency("parse", stats.parse);
+    write_latency("update", stats.update);
+    write_latency("merge", stats.merge);
+    write_latency("render", stats.render);
+    fputs("}\n", stats_file);
+    fflush(stats_file);
+}
+
+/**
+ * @brief Function for closing the stats file.
+ */
+void close_stats_file() {
+    if (stats_file != nullptr) fclose(stats_file);
+    stats_file = nullptr;
+}
@@ -4,67 +4,113 @@
 #include <iostream>
 #include <getopt.h>
 #include <cstdlib>
+#include <cstdint>
+#include <cmath>
 #include <pcap.h>
 #include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <unistd.h>
 
 #include "utils.h"
+#include "flow.h"
+#include "rate.h"
+#include "resolver.h"
 #include "net-top.h"
 
 /**
- * @brief Function for formatting bit rates.
- * @param bits_per_sec Bit rate to format.
- * @return Formatted string representing the bit rate.
+ * @brief Function for formatting a rate with a unit suffix.
+ * @param rate Rate to format.
+ * @param units Available suffixes, the first one for rates under 1000.
+ * @param buffer Buffer for the text.
+ * @param size Size of the buffer.
+ * @return The buffer.
  */
-std::string format_bits(double bits_per_sec) {
-    const char *units = " KMGTP"; // Available suffixes
+static const char *format_rate(double rate, const char *units, char *buffer, size_t size) {
+    int last = static_cast<int>(strlen(units)) - 1;
     int index = 0;
-    char formatted_number[30];
 
     // Number conversion
-    for (index = 0; bits_per_sec >= 1000 && index < 5; bits_per_sec /= 1000, index++) {
+    for (index = 0; rate >= 1000 && index < last; rate /= 1000, index++) {
     }
 
     // Determine whether the number is a whole number and append suffix
-    if (bits_per_sec == static_cast<int>(bits_per_sec)) {
-        snprintf(formatted_number, sizeof(formatted_number), "%d%c", static_cast<int>(bits_per_sec), units[index]);
+    if (rate == static_cast<int>(rate)) {
+        snprintf(buffer, size, "%d%c", static_cast<int>(rate), units[index]);
     } else {
-        snprintf(formatted_number, sizeof(formatted_number), "%.1f%c", bits_per_sec, units[index]);
+        snprintf(buffer, size, "%.1f%c", rate, units[index]);
     }
+    return buffer;
+}
 
-    return std::string(formatted_number);
+/**
+ * @brief Function for formatting bit rates.
+ * @param bits_per_sec Bit rate to format.
+ * @param buffer Buffer for the text, FORMAT_RATE_SIZE bytes fit every rate.
+ * @param size Size of the buffer.
+ * @return The buffer.
+ */
+const char *format_bits(double bits_per_sec, char *buffer, size_t size) {
+    return format_rate(bits_per_sec, " KMGTP", buffer, size);
 }
 
 /**
  * @brief Function for formatting packet rates.
  * @param packets_per_sec Packet rate to format.
- * @return Formatted string representing the packet rate.
+ * @param buffer Buffer for the text, FORMAT_RATE_SIZE bytes fit every rate.
+ * @param size Size of the buffer.
+ * @return The buffer.
  */
-std::string format_packets(double packets_per_sec) {
-    const char *units = " KMG"; // Available suffixes
-    int index = 0;
-    char formatted_number[30];
+const char *format_packets(double packets_per_sec, char *buffer, size_t size) {
+    return format_rate(packets_per_sec, " KMG", buffer, size);
+}
 
-    // Number conversion
-    for (index = 0; packets_per_sec >= 1000 && index < 3; packets_per_sec /= 1000, index++) {
+/**
+ * @brief Function for formatting IP addresses before printing, IPv6 addresses are put in brackets.
+ * @param ip IP address in binary form.
+ * @param family Address family (AF_INET/AF_INET6).
+ * @param buffer Buffer for the text, FORMAT_IP_SIZE bytes fit every address.
+ * @param size Size of the buffer.
+ * @return The buffer.
+ */
+const char *format_ip(const uint8_t *ip, uint8_t family, char *buffer, size_t size) {
+    if (family != AF_INET6) {
+        if (inet_ntop(family, ip, buffer, static_cast<socklen_t>(size)) == nullptr && size > 0) buffer[0] = '\0';
+        return buffer;
     }
-
-    // Determine whether the number is a whole number and append suffix
-    if (packets_per_sec == static_cast<int>(packets_per_sec)) {
-        snprintf(formatted_number, sizeof(formatted_number), "%d%c", static_cast<int>(packets_per_sec), units[index]);
-    } else {
-        snprintf(formatted_number, sizeof(formatted_number), "%.1f%c", packets_per_sec, units[index]);
+    if (size < 3) {
+        if (size > 0) buffer[0] = '\0';
+        return buffer;
     }
-
-    return std::string(formatted_number);
+    buffer[0] = '[';
+    if (inet_ntop(family, ip, buffer + 1, static_cast<socklen_t>(size - 2)) == nullptr) buffer[1] = '\0';
+    size_t length = strlen(buffer);
+    buffer[length] = ']';
+    buffer[length + 1] = '\0';
+    return buffer;
 }
 
 /**
- * @brief Function for formatting IP addresses before printing.
- * @param ip IP address string.
- * @return Formatted IP address string.
+ * @brief Function for formatting protocol numbers before printing.
+ * @param proto IP protocol number.
+ * @param buffer Buffer for numbers of unnamed protocols, FORMAT_RATE_SIZE bytes are enough.
+ * @param size Size of the buffer.
+ * @return Protocol name.
  */
-std::string format_ip(const std::string &ip) {
-    return ip.find(':') != std::string::npos ? "[" + ip + "]" : ip;
+const char *format_proto(uint8_t proto, char *buffer, size_t size) {
+    switch (proto) {
+        case IPPROTO_TCP:
+            return "tcp";
+        case IPPROTO_UDP:
+            return "udp";
+        case IPPROTO_ICMP:
+            return "icmp";
+        case IPPROTO_ICMPV6:
+            return "icmp6";
+        default:
+            snprintf(buffer, size, "%u", proto);
+            return buffer;
+    }
 }
 
 /**
@@ -72,13 +118,70 @@ std::string format_ip(const std::string &ip) {
  */
 void print_help() {
     std::cout << "\nUSAGE:\n"
-              << "./net-top -i interface-id [-s b|p] [-t seconds]\n\n"
+              << "./net-top -i interface-id[,...]|-r file [--speed max|realtime] [-s b|p] [-t seconds] [--rate window] [--aggregate level] [-n count] [-f filter] [-b ring|pcap] [-w workers] [--block-size bytes] [--block-count n] [--idle-timeout seconds]\n"
+              << "          [--max-flows n] [--max-mem bytes] [--overload evict|drop]\n"
+              << "          [--sketch off|on|auto] [--sketch-size n] [--sketch-threshold n] [--stats-file path]\n"
+              << "          [--headless ndjson|csv] [--output path] [--history path] [--history-size bytes] [--prefix-v4 bits] [--prefix-v6 bits]\n"
+              << "./net-top --playback path [-s b|p] [-n count] [--aggregate level]\n\n"
               << "Options:\n"
-              << "  -i         :  Interface on which the application listens defined by its identifier.\n"
-              << "  -s         :  Sort output by:\n"
+              << "  -i         :  Interfaces on which the application listens defined by their identifiers separated by commas, \"any\" for all interfaces.\n"
+              << "  -r         :  Replay a capture file instead of listening on an interface, intervals follow packet timestamps.\n"
+              << "  --speed    :  Replay speed:\n"
+              << "                  max      - as fast as possible, the throughput is printed on exit (default)\n"
+              << "                  realtime - following packet timestamps\n"
+              << "  -s         :  Sort output by, the s key also cycles through tx, rx and peak while running:\n"
               << "                  b - bytes (default)\n"
               << "                  p - packets\n"
-              << "  -t         :  Refresh interval for statistics in seconds, must be greater than 0 (default: 1).\n"
+              << "  -t         :  Refresh interval for statistics in seconds, fractions from 0.1 are accepted (default: 1).\n"
+              << "  --rate     :  Rate shown in the b/s columns and used for sorting by bytes:\n"
+              << "                  2s       - sliding average of the last 2 seconds in 250 ms buckets (default)\n"
+              << "                  10s, 40s - averages of the last 10 and 40 seconds in 2 second slots\n"
+              << "                  ewma     - exponentially weighted moving average with a 5 second time constant\n"
+              << "                  peak     - highest 2 second average since the flow appeared\n"
+              << "                  interval - traffic of the last refresh interval only\n"
+              << "  --aggregate : Grouping of the rows at start, the a key switches it while running:\n"
+              << "                  flow   - 5-tuple, no grouping (default)\n"
+              << "                  pair   - both hosts, ports and protocols merged\n"
+              << "                  host   - host that transmitted first\n"
+              << "                  prefix - network of the host that transmitted first, see --prefix-v4 and --prefix-v6\n"
+              << "                  port   - protocol and port of the answering side\n"
+              << "                  proto  - protocol\n"
+              << "  --prefix-v4 : Prefix length of IPv4 networks in the prefix grouping (default: 24).\n"
+              << "  --prefix-v6 : Prefix length of IPv6 networks in the prefix grouping (default: 64).\n"
+              << "  --resolve  :  Names shown instead of numbers at start, the n key switches them while running:\n"
+              << "                  off      - numeric addresses and ports (default)\n"
+              << "                  hosts    - host names of addresses, looked up in the background\n"
+              << "                  services - service names of TCP and UDP ports\n"
+              << "                  all      - both\n"
+              << "  --resolve-threads : Number of lookups running at once (default: 2).\n"
+              << "  -n         :  Number of flows displayed at once, PgUp/PgDn page through all of them, must be greater than 0 or \"all\" (default: 10).\n"
+              << "  -f         :  BPF filter expression (pcap-filter syntax) applied on top of the default one.\n"
+              << "  -b         :  Capture backend:\n"
+              << "                  ring - memory-mapped TPACKET_V3 ring (default, falls back to pcap)\n"
+              << "                  pcap - libpcap\n"
+              << "  -w         :  Number of capture threads, each with its own socket and flow shard (default: 1, ring only).\n"
+              << "  --block-size  :  Size of one ring block in bytes, multiple of the page size (default: 1048576).\n"
+              << "  --block-count :  Number of ring blocks (default: 64).\n"
+              << "  --idle-timeout : Seconds without packets after which a flow is forgotten (default: 30).\n"
+              << "  --max-flows :  Maximum number of tracked flows, preallocated at start (default: 262144).\n"
+              << "  --max-mem   :  Memory limit of the flow tables in bytes, lowers --max-flows to fit.\n"
+              << "  --overload  :  Policy for new flows when the flow limit is reached:\n"
+              << "                  evict - replace the least recently seen flow (default)\n"
+              << "                  drop  - ignore packets of new flows and count them\n"
+              << "  --sketch    :  Approximate top flows with a fixed-size Space-Saving sketch:\n"
+              << "                  off  - exact flow table only (default)\n"
+              << "                  on   - sketch only\n"
+              << "                  auto - sketch while flows per interval exceed --sketch-threshold\n"
+              << "  --sketch-size : Number of sketch counters per worker (default: 4096).\n"
+              << "  --sketch-threshold : Flows per interval switching to the sketch (default: half of --max-flows).\n"
+              << "  --stats-file : Write packet counters, kernel drops and latencies of every interval to a file, one JSON object per line.\n"
+              << "  --headless :  Stream the top flows of every interval instead of drawing the screen:\n"
+              << "                  ndjson - one JSON object per flow and line\n"
+              << "                  csv    - one row per flow, with a header line\n"
+              << "  --output   :  File the headless output is written to (default: standard output).\n"
+              << "  --history  :  Log the flows of every interval to a compact binary file, Left/Right scroll back through it.\n"
+              << "  --history-size : Size after which the history is moved to path.1 and started again (default: 67108864).\n"
+              << "  --playback :  Browse a history file written by --history instead of capturing.\n"
               << "  -h, --help :  Display this help message and exit.\n\n";
 }
 
@@ -96,22 +199,296 @@ void check_sort_order(char order) {
 
 /**
  * @brief Function for checking refresh interval parameter.
- * @param interval Refresh interval in seconds.
+ * @param interval Refresh interval in milliseconds.
+ */
+void check_refresh_interval(long interval) {
+    if (interval < 100 || interval > 3600000) {
+        std::cerr << "[ ERROR ] Invalid -t option, the interval must be between 0.1 and 3600 seconds.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for checking rate parameter.
+ * @param mode Rate shown as b/s (interval/2s/10s/40s/ewma/peak).
+ */
+void check_rate_mode(const std::string &mode) {
+    if (mode != "interval" && rate_metric(mode) == RATE_METRICS) {
+        std::cerr << "[ ERROR ] Invalid --rate option.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for checking aggregation parameter.
+ * @param level Initial aggregation level (flow/pair/host/prefix/port/proto).
+ */
+void check_aggregation(const std::string &level) {
+    if (aggregation_level(level) == AGGREGATIONS) {
+        std::cerr << "[ ERROR ] Invalid --aggregate option.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for checking prefix length parameters.
+ * @param bits Prefix length.
+ * @param max_bits Length of the address in bits.
+ * @param option Name of the option for the error message.
+ */
+void check_prefix_length(long bits, long max_bits, const char *option) {
+    if (bits < 0 || bits > max_bits) {
+        std::cerr << "[ ERROR ] Invalid " << option << " option.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for checking resolve parameter.
+ * @param mode Names shown at start (off/hosts/services/all).
+ */
+void check_resolve(const std::string &mode) {
+    if (resolve_mode(mode) == RESOLVE_MODES) {
+        std::cerr << "[ ERROR ] Invalid --resolve option.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for checking resolver thread count parameter.
+ * @param count Number of lookups running at once.
+ */
+void check_resolve_threads(long count) {
+    if (count <= 0 || count > RESOLVER_MAX_THREADS) {
+        std::cerr << "[ ERROR ] Invalid --resolve-threads option.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for checking displayed flow count parameter.
+ * @param count Number of displayed flows.
+ */
+void check_top_count(long count) {
+    if (count <= 0) {
+        std::cerr << "[ ERROR ] Invalid -n option.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for checking idle timeout parameter.
+ * @param timeout Idle timeout in seconds.
+ */
+void check_idle_timeout(long timeout) {
+    if (timeout <= 0 || timeout > 86400) {
+        std::cerr << "[ ERROR ] Invalid --idle-timeout option.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for checking flow limit parameter.
+ * @param count Maximum number of flows.
+ */
+void check_max_flows(long count) {
+    if (count <= 0 || count > (1L << 28)) {
+        std::cerr << "[ ERROR ] Invalid --max-flows option.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for checking memory limit parameter.
+ * @param bytes Memory limit of the flow tables in bytes.
+ */
+void check_max_mem(long bytes) {
+    if (bytes < (1L << 20)) {
+        std::cerr << "[ ERROR ] Invalid --max-mem option, at least 1048576 bytes are needed.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for checking history size parameter.
+ * @param bytes Size after which the history is rotated.
+ */
+void check_history_size(long bytes) {
+    if (bytes < (1L << 20)) {
+        std::cerr << "[ ERROR ] Invalid --history-size option, at least 1048576 bytes are needed.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for checking overload policy parameter.
+ * @param name Policy name (evict/drop).
+ */
+void check_overload_policy(const std::string &name) {
+    if (name != "evict" && name != "drop") {
+        std::cerr << "[ ERROR ] Invalid --overload option.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for checking sketch mode parameter.
+ * @param name Mode name (off/on/auto).
+ */
+void check_sketch_mode(const std::string &name) {
+    if (name != "off" && name != "on" && name != "auto") {
+        std::cerr << "[ ERROR ] Invalid --sketch option.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for checking sketch size parameter.
+ * @param count Number of sketch counters.
+ */
+void check_sketch_size(long count) {
+    if (count < 16 || count > (1L << 24)) {
+        std::cerr << "[ ERROR ] Invalid --sketch-size option.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for checking sketch threshold parameter.
+ * @param count Flows per interval switching to the sketch.
+ */
+void check_sketch_threshold(long count) {
+    if (count <= 0 || count > (1L << 28)) {
+        std::cerr << "[ ERROR ] Invalid --sketch-threshold option.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for checking capture backend parameter.
+ * @param name Backend name (ring/pcap).
  */
-void check_refresh_interval(int interval) {
-    if (interval <= 0) {
-        std::cerr << "[ ERROR ] Invalid -t option.\n";
+void check_backend(const std::string &name) {
+    if (name != "ring" && name != "pcap") {
+        std::cerr << "[ ERROR ] Invalid -b option.\n";
         print_help();
         exit(EXIT_FAILURE);
     }
 }
 
 /**
- * @brief Function for checking if the interface parameter is set.
+ * @brief Function for checking ring geometry parameters.
+ * @param block_size Size of one ring block in bytes.
+ * @param block_count Number of ring blocks.
+ */
+void check_ring_geometry(long block_size, long block_count) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (block_size < page_size || block_size % page_size != 0 || block_size > (1L << 30)) {
+        std::cerr << "[ ERROR ] Invalid --block-size option.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+    if (block_count <= 0 || block_size * block_count > (1L << 32) - 1) {
+        std::cerr << "[ ERROR ] Invalid --block-count option.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for checking worker count parameter.
+ * @param count Number of capture threads.
+ */
+void check_worker_count(long count) {
+    if (count <= 0 || count > 256) {
+        std::cerr << "[ ERROR ] Invalid -w option.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for checking that exactly one of the interface and capture file parameters is set.
  */
 void check_interface_set() {
-    if (interface.empty()) {
-        std::cerr << "[ ERROR ] Network interface is required.\n";
+    // Interfaces of a played back history are those it was recorded on
+    if (!playback_path.empty()) {
+        if (!interface.empty() || !read_file.empty() || !headless_format.empty()) {
+            std::cerr << "[ ERROR ] Option --playback cannot be combined with -i, -r or --headless.\n";
+            print_help();
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    if (interface.empty() && read_file.empty()) {
+        std::cerr << "[ ERROR ] Network interface or capture file is required.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+    if (!interface.empty() && !read_file.empty()) {
+        std::cerr << "[ ERROR ] Options -i and -r cannot be combined.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for splitting the comma separated list of interfaces into interfaces.
+ * @param list Value of the -i parameter.
+ */
+void check_interface_list(const std::string &list) {
+    interfaces.clear();
+    if (list.empty()) return;
+
+    size_t start = 0;
+    while (true) {
+        size_t end = list.find(',', start);
+        std::string name = list.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        if (name.empty()) {
+            std::cerr << "[ ERROR ] Empty interface name in -i " << list << ".\n";
+            print_help();
+            exit(EXIT_FAILURE);
+        }
+        interfaces.push_back(name);
+        if (end == std::string::npos) break;
+        start = end + 1;
+    }
+}
+
+/**
+ * @brief Function for checking headless output format parameter.
+ * @param format Output format (ndjson/csv).
+ */
+void check_headless_format(const std::string &format) {
+    if (format != "ndjson" && format != "csv") {
+        std::cerr << "[ ERROR ] Invalid --headless option.\n";
+        print_help();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Function for checking replay speed parameter.
+ * @param speed Replay speed (max/realtime).
+ */
+void check_replay_speed(const std::string &speed) {
+    if (speed != "max" && speed != "realtime") {
+        std::cerr << "[ ERROR ] Invalid --speed option.\n";
         print_help();
         exit(EXIT_FAILURE);
     }
@@ -133,26 +510,161 @@ void handle_invalid_argument() {
  */
 void parse_args(int argc, char *argv[]) {
     int opt;
+    long block_size = ring_block_size;
+    long block_count = ring_block_count;
+
+    // Identifiers of parameters which only have a long version
+    enum { OPT_BLOCK_SIZE = 256, OPT_BLOCK_COUNT, OPT_IDLE_TIMEOUT, OPT_MAX_FLOWS, OPT_MAX_MEM, OPT_OVERLOAD, OPT_SKETCH, OPT_SKETCH_SIZE, OPT_SKETCH_THRESHOLD, OPT_SPEED, OPT_STATS_FILE, OPT_HEADLESS, OPT_OUTPUT, OPT_HISTORY, OPT_HISTORY_SIZE, OPT_PLAYBACK, OPT_RATE, OPT_AGGREGATE, OPT_PREFIX_V4, OPT_PREFIX_V6, OPT_RESOLVE, OPT_RESOLVE_THREADS };
 
     // Definitions of long versions of parameters
     struct option long_options[] = {
         {"help", no_argument, nullptr, 'h'},
+        {"block-size", required_argument, nullptr, OPT_BLOCK_SIZE},
+        {"block-count", required_argument, nullptr, OPT_BLOCK_COUNT},
+        {"idle-timeout", required_argument, nullptr, OPT_IDLE_TIMEOUT},
+        {"max-flows", required_argument, nullptr, OPT_MAX_FLOWS},
+        {"max-mem", required_argument, nullptr, OPT_MAX_MEM},
+        {"overload", required_argument, nullptr, OPT_OVERLOAD},
+        {"sketch", required_argument, nullptr, OPT_SKETCH},
+        {"sketch-size", required_argument, nullptr, OPT_SKETCH_SIZE},
+        {"sketch-threshold", required_argument, nullptr, OPT_SKETCH_THRESHOLD},
+        {"speed", required_argument, nullptr, OPT_SPEED},
+        {"stats-file", required_argument, nullptr, OPT_STATS_FILE},
+        {"headless", required_argument, nullptr, OPT_HEADLESS},
+        {"output", required_argument, nullptr, OPT_OUTPUT},
+        {"history", required_argument, nullptr, OPT_HISTORY},
+        {"history-size", required_argument, nullptr, OPT_HISTORY_SIZE},
+        {"playback", required_argument, nullptr, OPT_PLAYBACK},
+        {"rate", required_argument, nullptr, OPT_RATE},
+        {"aggregate", required_argument, nullptr, OPT_AGGREGATE},
+        {"prefix-v4", required_argument, nullptr, OPT_PREFIX_V4},
+        {"prefix-v6", required_argument, nullptr, OPT_PREFIX_V6},
+        {"resolve", required_argument, nullptr, OPT_RESOLVE},
+        {"resolve-threads", required_argument, nullptr, OPT_RESOLVE_THREADS},
         {nullptr, 0, nullptr, 0}
     };
 
     // Parsing of arguments
-    while ((opt = getopt_long(argc, argv, "i:s:t:h", long_options, nullptr)) != -1) {
+    while ((opt = getopt_long(argc, argv, "i:r:s:t:n:f:b:w:h", long_options, nullptr)) != -1) {
         switch (opt) {
             case 'i':
                 interface = optarg;
                 break;
+            case 'r':
+                read_file = optarg;
+                break;
             case 's':
                 sort_order = optarg[0];
                 check_sort_order(sort_order);
                 break;
-            case 't':
-                refresh_interval = std::atoi(optarg);
-                check_refresh_interval(refresh_interval);
+            case 't': {
+                // Fractions of a second are accepted, the interval is kept in milliseconds
+                long interval = std::lround(std::atof(optarg) * 1000);
+                check_refresh_interval(interval);
+                refresh_ms = static_cast<int>(interval);
+                break;
+            }
+            case 'n':
+                // Headless output may stream every flow of the interval
+                if (std::string(optarg) == "all") {
+                    top_count = SIZE_MAX;
+                    break;
+                }
+                check_top_count(std::atol(optarg));
+                top_count = static_cast<size_t>(std::atol(optarg));
+                break;
+            case 'f':
+                filter_expr = optarg;
+                break;
+            case 'b':
+                backend = optarg;
+                check_backend(backend);
+                break;
+            case 'w':
+                check_worker_count(std::atol(optarg));
+                worker_count = static_cast<unsigned>(std::atol(optarg));
+                break;
+            case OPT_BLOCK_SIZE:
+                block_size = std::atol(optarg);
+                break;
+            case OPT_BLOCK_COUNT:
+                block_count = std::atol(optarg);
+                break;
+            case OPT_IDLE_TIMEOUT:
+                check_idle_timeout(std::atol(optarg));
+                idle_timeout = static_cast<int>(std::atol(optarg));
+                break;
+            case OPT_MAX_FLOWS:
+                check_max_flows(std::atol(optarg));
+                max_flows = static_cast<size_t>(std::atol(optarg));
+                break;
+            case OPT_MAX_MEM:
+                check_max_mem(std::atol(optarg));
+                max_mem = static_cast<size_t>(std::atol(optarg));
+                break;
+            case OPT_OVERLOAD:
+                overload_policy = optarg;
+                check_overload_policy(overload_policy);
+                break;
+            case OPT_SKETCH:
+                sketch_mode = optarg;
+                check_sketch_mode(sketch_mode);
+                break;
+            case OPT_SKETCH_SIZE:
+                check_sketch_size(std::atol(optarg));
+                sketch_size = static_cast<size_t>(std::atol(optarg));
+                break;
+            case OPT_SKETCH_THRESHOLD:
+                check_sketch_threshold(std::atol(optarg));
+                sketch_threshold = static_cast<size_t>(std::atol(optarg));
+                break;
+            case OPT_SPEED:
+                replay_speed = optarg;
+                check_replay_speed(replay_speed);
+                break;
+            case OPT_STATS_FILE:
+                stats_path = optarg;
+                break;
+            case OPT_HEADLESS:
+                headless_format = optarg;
+                check_headless_format(headless_format);
+                break;
+            case OPT_OUTPUT:
+                output_path = optarg;
+                break;
+            case OPT_HISTORY:
+                history_path = optarg;
+                break;
+            case OPT_HISTORY_SIZE:
+                check_history_size(std::atol(optarg));
+                history_max_size = static_cast<size_t>(std::atol(optarg));
+                break;
+            case OPT_PLAYBACK:
+                playback_path = optarg;
+                break;
+            case OPT_RATE:
+                rate_mode = optarg;
+                check_rate_mode(rate_mode);
+                break;
+            case OPT_AGGREGATE:
+                aggregation = optarg;
+                check_aggregation(aggregation);
+                break;
+            case OPT_PREFIX_V4:
+                check_prefix_length(std::atol(optarg), 32, "--prefix-v4");
+                prefix_v4 = static_cast<int>(std::atol(optarg));
+                break;
+            case OPT_PREFIX_V6:
+                check_prefix_length(std::atol(optarg), 128, "--prefix-v6");
+                prefix_v6 = static_cast<int>(std::atol(optarg));
+                break;
+            case OPT_RESOLVE:
+                resolve = optarg;
+                check_resolve(resolve);
+                break;
+            case OPT_RESOLVE_THREADS:
+                check_resolve_threads(std::atol(optarg));
+                resolve_threads = static_cast<unsigned>(std::atol(optarg));
                 break;
             case 'h':
                 print_help();
@@ -163,14 +675,26 @@ void parse_args(int argc, char *argv[]) {
     }
 
     check_interface_set();
+    check_interface_list(interface);
+
+    check_ring_geometry(block_size, block_count);
+    ring_block_size = static_cast<unsigned>(block_size);
+    ring_block_count = static_cast<unsigned>(block_count);
 }
 
 /**
- * @brief Function for checking if the interface supports Ethernet headers.
+ * @brief Function for checking if the link-layer headers of the interface or file can be decoded.
+ * @param handle Pcap handle of the interface or file.
+ * @return Decoder of the link type.
  */
-void check_ethernet_support() {
-    if (pcap_datalink(handle) != DLT_EN10MB) {
-        std::cerr << "[ ERROR ] Device " << interface << " doesn't provide Ethernet headers.\n";
+LinkType check_link_support(pcap_t *handle) {
+    LinkType link;
+    int dlt = pcap_datalink(handle);
+    if (!link_type_from_dlt(dlt, link)) {
+        const char *name = pcap_datalink_val_to_name(dlt);
+        std::cerr << "[ ERROR ] " << (read_file.empty() ? "Device " + interface : "File " + read_file)
+                  << " provides unsupported link-layer headers " << (name != nullptr ? name : std::to_string(dlt)) << ".\n";
         exit(EXIT_FAILURE);
     }
+    return link;
 }
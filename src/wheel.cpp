@@ -0,0 +1,113 @@
+// Aurel Strigáč <xstrig00>
+
+#include "wheel.h"
+
+/**
+ * @brief Constructor of the wheel.
+ * @param tick_ms Length of one tick of the lowest level in milliseconds.
+ */
+TimerWheel::TimerWheel(uint64_t tick_ms) : tick_ms(tick_ms) {
+    for (auto &level : heads) {
+        for (auto &head : level) head = NONE;
+    }
+}
+
+/**
+ * @brief Function for preallocating storage of timers.
+ * @param count Number of timer identifiers.
+ */
+void TimerWheel::reserve(uint32_t count) {
+    next.reserve(count);
+    prev.reserve(count);
+    expiry.reserve(count);
+    slot_of.reserve(count);
+}
+
+/**
+ * @brief Function for setting the current time of an empty wheel, so the first advance doesn't walk from zero.
+ * @param now Current time in milliseconds.
+ */
+void TimerWheel::start(uint64_t now) {
+    if (pending == 0) current = now / tick_ms;
+}
+
+/**
+ * @brief Function for scheduling a timer.
+ * @param id Identifier, must not be scheduled already.
+ * @param expires Expiry time in milliseconds.
+ */
+void TimerWheel::schedule(uint32_t id, uint64_t expires) {
+    if (id >= next.size()) {
+        next.resize(id + 1, NONE);
+        prev.resize(id + 1, NONE);
+        expiry.resize(id + 1, 0);
+        slot_of.resize(id + 1, UINT16_MAX);
+    }
+
+    // Timers are rounded up to whole ticks and never fire in the current one
+    uint64_t tick = (expires + tick_ms - 1) / tick_ms;
+    expiry[id] = tick > current ? tick : current + 1;
+    pending++;
+    link(id);
+}
+
+/**
+ * @brief Function for cancelling a scheduled timer.
+ * @param id Identifier of the timer.
+ */
+void TimerWheel::cancel(uint32_t id) {
+    if (id >= slot_of.size() || slot_of[id] == UINT16_MAX) return;
+    unlink(id);
+    pending--;
+}
+
+/**
+ * @brief Function for placing the timer into the slot matching its distance from the current tick.
+ * @param id Identifier of the timer.
+ */
+void TimerWheel::link(uint32_t id) {
+    uint64_t delta = expiry[id] - current;
+
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1)))) level++;
+
+    // Timers beyond the range of the wheel wait in the farthest slot and get cascaded again
+    uint64_t tick = expiry[id];
+    uint64_t range = 1ULL << (SLOT_BITS * LEVELS);
+    if (delta >= range) tick = current + range - (1ULL << (SLOT_BITS * level));
+
+    uint32_t slot = (tick >> (SLOT_BITS * level)) & (SLOTS - 1);
+    uint32_t &head = heads[level][slot];
+
+    prev[id] = NONE;
+    next[id] = head;
+    if (head != NONE) prev[head] = id;
+    head = id;
+    slot_of[id] = static_cast<uint16_t>(level * SLOTS + slot);
+}
+
+/**
+ * @brief Function for removing the timer from its slot.
+ * @param id Identifier of the timer.
+ */
+void TimerWheel::unlink(uint32_t id) {
+    uint32_t &head = heads[slot_of[id] / SLOTS][slot_of[id] % SLOTS];
+
+    if (prev[id] != NONE) next[prev[id]] = next[id];
+    else head = next[id];
+    if (next[id] != NONE) prev[next[id]] = prev[id];
+
+    slot_of[id] = UINT16_MAX;
+}
+
+/**
+ * @brief Function for detaching the whole list of a slot.
+ * @param level Level of the slot.
+ * @param slot Index of the slot.
+ * @return First timer of the detached list.
+ */
+uint32_t TimerWheel::take(int level, uint32_t slot) {
+    uint32_t head = heads[level][slot];
+    heads[level][slot] = NONE;
+    return head;
+}
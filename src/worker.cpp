@@ -0,0 +1,441 @@
+// Aurel Strigáč <xstrig00>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <algorithm>
+
+#include "worker.h"
+#include "capture.h"
+#include "stats.h"
+#include "utils.h"
+#include "net-top.h"
+
+std::vector<std::unique_ptr<Worker>> workers;
+std::atomic<uint32_t> capture_epoch{0};
+std::atomic<uint32_t> render_epoch{0};
+std::atomic<uint32_t> rendered_epoch{0};
+std::atomic<bool> capture_finished{false};
+int snapshot_fd = -1;
+
+static std::atomic<bool> capture_running{false};
+
+/**
+ * @brief Function for getting the wall-clock time, the same clock packet timestamps use.
+ * @return Current time in milliseconds.
+ */
+uint64_t current_time_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Function for opening the capture backend of every worker.
+ * @param count Requested number of workers.
+ * @param errbuf Buffer for the error message.
+ * @return True on success, false otherwise.
+ */
+bool open_workers(unsigned count, char *errbuf) {
+    if ((snapshot_fd = eventfd(0, EFD_CLOEXEC)) == -1) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "eventfd: %s", strerror(errno));
+        return false;
+    }
+
+    // Every interface gets its own group of workers
+    size_t sources = std::max<size_t>(interfaces.size(), 1);
+    for (size_t source = 0; source < sources; source++) {
+        for (unsigned i = 0; i < count; i++) {
+            workers.push_back(std::make_unique<Worker>());
+            workers.back()->id = static_cast<unsigned>(workers.size() - 1);
+            workers.back()->ingress = static_cast<uint16_t>(source);
+            workers.back()->batch.ingress = static_cast<uint16_t>(source);
+            if ((workers.back()->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+                snprintf(errbuf, PCAP_ERRBUF_SIZE, "eventfd: %s", strerror(errno));
+                return false;
+            }
+        }
+    }
+
+    // A capture file is read by libpcap on a single worker, there is nothing to fan out
+    if (!read_file.empty()) {
+        if (workers.size() > 1) {
+            std::cerr << "[ WARNING ] Replay uses only one worker\n";
+            for (size_t i = 1; i < workers.size(); i++) close(workers[i]->wake_fd);
+            workers.resize(1);
+        }
+        backend = "replay";
+
+        Worker &worker = *workers.front();
+        if ((worker.handle = pcap_open_offline(read_file.c_str(), errbuf)) == nullptr) return false;
+        worker.link = check_link_support(worker.handle);
+    }
+
+    // Initialization of packet capture on the interface, libpcap is used when the ring cannot be set up
+    if (backend == "ring") {
+        for (auto &worker : workers) {
+            // Workers of one interface share a fanout group, each interface has its own
+            const std::string &device = interfaces[worker->ingress];
+            int group = (getpid() + worker->ingress) & 0xffff;
+            if (!ring_open(worker->ring, device, ring_block_size, ring_block_count, errbuf) ||
+                (count > 1 && !ring_join_fanout(worker->ring, group, errbuf))) {
+                std::cerr << "[ WARNING ] Cannot open ring on device " << device << ": " << errbuf << ", falling back to libpcap\n";
+                for (auto &opened : workers) ring_close(opened->ring);
+                backend = "pcap";
+                break;
+            }
+        }
+    }
+
+    if (backend == "pcap") {
+        // Libpcap has no fanout, all traffic of an interface goes through a single worker
+        if (count > 1) {
+            std::cerr << "[ WARNING ] Backend pcap supports only one worker per interface\n";
+            std::vector<std::unique_ptr<Worker>> kept;
+            for (size_t i = 0; i < workers.size(); i++) {
+                if (i % count == 0) {
+                    workers[i]->id = static_cast<unsigned>(kept.size());
+                    kept.push_back(std::move(workers[i]));
+                } else {
+                    close(workers[i]->wake_fd);
+                }
+            }
+            workers = std::move(kept);
+        }
+
+        for (auto &worker : workers) {
+            const std::string &device = interfaces[worker->ingress];
+            if ((worker->handle = pcap_open_live(device.c_str(), CAPTURE_SNAPLEN, 1, 1000, errbuf)) == nullptr) return false;
+
+            // Set the pcap handle to non-blocking mode
+            if (pcap_setnonblock(worker->handle, 1, errbuf) == -1) return false;
+
+            // Validation that the link-layer headers of the interface can be decoded
+            worker->link = check_link_support(worker->handle);
+        }
+    }
+
+    // The flow limit is split evenly between shards and allocated up front, so memory stays flat under load
+    size_t flow_limit = max_flows;
+    if (max_mem > 0) flow_limit = std::min(flow_limit, max_mem / WORKER_FLOW_SIZE);
+    uint32_t capacity = static_cast<uint32_t>(std::max<size_t>(flow_limit / workers.size(), 1));
+    OverloadPolicy policy = overload_policy == "drop" ? OverloadPolicy::DROP : OverloadPolicy::EVICT;
+
+    // The sketch threshold is split like the flow limit, each shard switches on its own
+    SketchMode mode = sketch_mode == "on" ? SketchMode::ON : sketch_mode == "auto" ? SketchMode::AUTO : SketchMode::OFF;
+    size_t threshold = std::max<size_t>((sketch_threshold > 0 ? sketch_threshold : flow_limit / 2) / workers.size(), 1);
+    uint32_t counters = mode != SketchMode::OFF ? static_cast<uint32_t>(sketch_size) : 0;
+
+    for (auto &worker : workers) {
+        // Drops of the interface are shared by its workers, the first one reports them
+        worker->reports_interface = worker->id == 0 || workers[worker->id - 1]->ingress != worker->ingress;
+        if (worker->handle == nullptr && worker->reports_interface) {
+            read_interface_drops(interfaces[worker->ingress], worker->if_drops_base);
+        }
+
+        if (worker->handle == nullptr) worker->link = worker->ring.link;
+        worker->handlers = link_handlers(worker->link);
+        init_flow_shard(worker->flows, capacity, static_cast<uint64_t>(idle_timeout) * 1000, policy, current_time_ms());
+        init_flow_sketch(worker->flows, mode, counters, threshold, sort_order == 'b');
+        init_flow_rollups(worker->flows, capacity, static_cast<uint8_t>(prefix_v4), static_cast<uint8_t>(prefix_v6));
+        for (auto &snapshot : worker->snapshots) snapshot.flows.reserve(std::max(capacity, counters));
+    }
+
+    // Only supported traffic matching the user's filter is passed to user space
+    for (auto &worker : workers) {
+        if (!apply_filter(worker->handle, worker->ring, build_filter(filter_expr, worker->link), errbuf)) return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Function for starting the capture threads.
+ */
+void start_workers() {
+    capture_running = true;
+    for (auto &worker : workers) {
+        worker->thread = std::thread(read_file.empty() ? worker_loop : replay_loop, std::ref(*worker));
+    }
+}
+
+/**
+ * @brief Function for stopping the capture threads and closing their backends.
+ */
+void stop_workers() {
+    capture_running = false;
+    for (auto &worker : workers) {
+        uint64_t one = 1;
+        if (write(worker->wake_fd, &one, sizeof(one)) != sizeof(one)) continue;
+    }
+    for (auto &worker : workers) {
+        if (worker->thread.joinable()) worker->thread.join();
+        if (worker->handle != nullptr) pcap_close(worker->handle);
+        ring_close(worker->ring);
+        close(worker->wake_fd);
+    }
+}
+
+/**
+ * @brief Function for starting a new interval and waking the workers to close the old one.
+ */
+void advance_epoch() {
+    capture_epoch.fetch_add(1);
+    for (auto &worker : workers) {
+        uint64_t one = 1;
+        if (write(worker->wake_fd, &one, sizeof(one)) != sizeof(one)) continue;
+    }
+}
+
+/**
+ * @brief Function for reading the kernel and interface drop counters of the worker's backend.
+ * @param worker Worker whose counters are updated.
+ */
+static void poll_drops(Worker &worker) {
+    CaptureCounters &counters = worker.counters;
+    if (!read_file.empty()) return;
+
+    if (worker.handle != nullptr) {
+        // Libpcap keeps both counters cumulative
+        struct pcap_stat stats;
+        if (pcap_stats(worker.handle, &stats) == 0) {
+            counters.kernel_drops = stats.ps_drop;
+            counters.if_drops = stats.ps_ifdrop;
+        }
+    } else {
+        ring_drops(worker.ring, counters.kernel_drops);
+        uint64_t drops;
+        if (worker.reports_interface && read_interface_drops(interfaces[worker.ingress], drops)) {
+            counters.if_drops = drops - worker.if_drops_base;
+        }
+    }
+}
+
+/**
+ * @brief Function for closing the worker's interval and publishing its snapshot.
+ * @param worker Worker closing the interval.
+ * @param epoch New epoch.
+ * @param now Current time in milliseconds, packet time when replaying.
+ */
+void close_interval(Worker &worker, uint32_t epoch, uint64_t now) {
+    // The buffer of the same parity may still be read by a slow render thread, this interval is skipped then
+    uint32_t reading = render_epoch.load();
+    poll_drops(worker);
+    if (reading == 0 || (reading & 1) != (epoch & 1)) {
+        Snapshot &snapshot = worker.snapshots[epoch & 1];
+        snapshot.flows.clear();     // Keeps capacity, no allocation in the steady state
+        bool interval_only = rate_metric(rate_mode) == RATE_METRICS;
+        uint32_t bucket = rate_bucket(now);
+        double seconds = static_cast<double>(refresh_ms) / 1000;
+        if (!interval_only) advance_flow_rates(worker.flows, now);
+        start_rollup_rates(worker.flows);
+
+        if (worker.flows.sketching) {
+            // Sketch counters live for one interval only, their rates are those of the interval
+            for (const auto &entry : worker.flows.sketch.entries()) {
+                if (!entry.used) continue;
+                snapshot.flows.emplace_back(oriented_flow(entry), entry.stats);
+                RateSummary &rates = snapshot.flows.back().second.rates;
+                std::fill(rates.tx, rates.tx + RATE_METRICS, static_cast<float>(static_cast<double>(entry.stats.B_tx) / seconds));
+                std::fill(rates.rx, rates.rx + RATE_METRICS, static_cast<float>(static_cast<double>(entry.stats.B_rx) / seconds));
+            }
+        } else if (interval_only) {
+            // Only the interval is shown, quiet flows are left out as they cost a visit each
+            for (uint32_t index : worker.flows.active) {
+                FlowEntry &entry = worker.flows.table.entries()[index];
+                advance_rates(entry.bucket, worker.flows.rates[index], bucket);
+                snapshot.flows.emplace_back(oriented_flow(entry), entry.stats);
+                summarize_rates(worker.flows.rates[index], snapshot.flows.back().second.rates);
+                add_rollup_rates(worker.flows, index, snapshot.flows.back().second.rates);
+            }
+        } else {
+            // Flows quiet in this interval are listed too while their windows still hold traffic
+            for (uint32_t index : worker.flows.recent) {
+                const FlowEntry &entry = worker.flows.table.entries()[index];
+                snapshot.flows.emplace_back(oriented_flow(entry), entry.epoch == worker.flows.epoch ? entry.stats : FlowStats());
+                summarize_rates(worker.flows.rates[index], snapshot.flows.back().second.rates);
+                add_rollup_rates(worker.flows, index, snapshot.flows.back().second.rates);
+            }
+        }
+
+        // Every aggregation level is published, so switching the view redraws without waiting for an interval
+        finish_rollup_rates(worker.flows, seconds);
+        for (int level = 0; level < ROLLUPS; level++) {
+            Rollup &rollup = worker.flows.rollups[level];
+            auto &records = snapshot.rollups[level];
+            records.clear();
+            for (uint32_t index : rollup.listed) {
+                const FlowEntry &entry = rollup.table.entries()[index];
+                records.emplace_back(entry.key, entry.epoch == worker.flows.epoch ? entry.stats : FlowStats());
+                records.back().second.rates = rollup.rates[index];
+            }
+        }
+        snapshot.approximate = worker.flows.sketching;
+        snapshot.closed = now;
+        snapshot.packets = worker.packets;
+        snapshot.tracked = worker.flows.table.size();
+        snapshot.evicted = worker.flows.evicted;
+        snapshot.dropped = worker.flows.dropped;
+
+        // Instrumentation of a skipped interval is carried over to the next published one
+        snapshot.interval = counters_delta(worker.counters, worker.reported);
+        snapshot.total = worker.counters;
+        snapshot.parse = worker.parse_latency;
+        snapshot.update = worker.update_latency;
+        worker.reported = worker.counters;
+        worker.parse_latency = LatencyHistogram();
+        worker.update_latency = LatencyHistogram();
+        worker.published.store(epoch);
+    }
+
+    // Only flows of the closed interval were visited, the rest is reset lazily and aged by the wheel
+    reset_flow_statistics(worker.flows);
+    trim_flows(worker.flows, now);
+    worker.packets = 0;
+    worker.epoch = epoch;
+
+    uint64_t one = 1;
+    if (write(snapshot_fd, &one, sizeof(one)) != sizeof(one)) return;
+}
+
+/**
+ * @brief Function run by each capture thread.
+ * @param worker Worker owning the thread.
+ */
+void worker_loop(Worker &worker) {
+    struct pollfd pfds[2] = {};
+    pfds[0].fd = worker.handle != nullptr ? pcap_get_selectable_fd(worker.handle) : worker.ring.fd;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = worker.wake_fd;
+    pfds[1].events = POLLIN;
+
+    while (capture_running.load(std::memory_order_relaxed)) {
+        uint32_t epoch = capture_epoch.load(std::memory_order_acquire);
+        if (epoch != worker.epoch) close_interval(worker, epoch, current_time_ms());
+
+        // Process incomming and outgoing network traffic, sleep only when nothing is ready
+        int count;
+        // Packets are counted in batches, libpcap reuses its buffer so its packets are parsed on arrival
+        u_char *user = reinterpret_cast<u_char *>(&worker);
+        if (worker.handle != nullptr) {
+            count = pcap_dispatch(worker.handle, -1, worker.handlers.batch, user);
+            if (worker.batch.count > 0) count_batch(user);
+        } else {
+            count = ring_dispatch_batch(worker.ring, worker.batch, worker.handlers.flush, user);
+        }
+
+        if (count > 0) {
+            worker.packets += count;
+            worker.counters.received += count;
+            continue;
+        }
+
+        if (poll(pfds, 2, -1) > 0 && (pfds[1].revents & POLLIN)) {
+            uint64_t value;
+            if (read(worker.wake_fd, &value, sizeof(value)) != sizeof(value)) continue;
+        }
+    }
+}
+
+/**
+ * @brief Function for sleeping until a monotonic deadline, wakes early on a stop request.
+ * @param worker Worker whose wake_fd interrupts the sleep.
+ * @param deadline Monotonic time in nanoseconds.
+ */
+static void sleep_until(Worker &worker, uint64_t deadline) {
+    struct pollfd pfd = {worker.wake_fd, POLLIN, 0};
+
+    while (capture_running.load(std::memory_order_relaxed)) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        uint64_t current = static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+        if (current >= deadline) return;
+
+        struct timespec timeout = {static_cast<time_t>((deadline - current) / 1000000000),
+                                   static_cast<long>((deadline - current) % 1000000000)};
+        if (ppoll(&pfd, 1, &timeout, nullptr) > 0) {
+            uint64_t value;
+            if (read(worker.wake_fd, &value, sizeof(value)) != sizeof(value)) continue;
+        }
+    }
+}
+
+/**
+ * @brief Function for waiting until the render thread has written out the worker's last interval.
+ * @param worker Worker whose wake_fd interrupts the wait.
+ */
+static void wait_rendered(Worker &worker) {
+    struct pollfd pfd = {worker.wake_fd, POLLIN, 0};
+
+    while (capture_running.load(std::memory_order_relaxed) && rendered_epoch.load() < worker.epoch) {
+        if (poll(&pfd, 1, 1) > 0) {
+            uint64_t value;
+            if (read(worker.wake_fd, &value, sizeof(value)) != sizeof(value)) continue;
+        }
+    }
+}
+
+/**
+ * @brief Function run by the replay thread, intervals are closed by packet timestamps instead of the timer.
+ * @param worker Worker owning the thread.
+ */
+void replay_loop(Worker &worker) {
+    const uint64_t interval = static_cast<uint64_t>(refresh_ms);
+    bool realtime = replay_speed == "realtime";
+    uint64_t first = 0, boundary = 0, start = 0;
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    start = static_cast<uint64_t>(begin.tv_sec) * 1000000000 + begin.tv_nsec;
+
+    while (capture_running.load(std::memory_order_relaxed)) {
+        struct pcap_pkthdr *header;
+        const u_char *packet;
+        int result = pcap_next_ex(worker.handle, &header, &packet);
+        if (result != 1) break;     // End of file or a truncated record
+
+        uint64_t now = static_cast<uint64_t>(header->ts.tv_sec) * 1000 + header->ts.tv_usec / 1000;
+        if (boundary == 0) {
+            // Intervals are aligned to the first packet, flows age by packet time as well
+            first = now;
+            boundary = now + interval;
+            worker.flows.wheel.start(now);
+        }
+
+        // Every interval boundary the packet crossed is closed, quiet intervals included
+        if (now >= boundary && worker.batch.count > 0) count_batch(reinterpret_cast<u_char *>(&worker));
+        while (now >= boundary) {
+            // Headless output feeds a pipeline, so no interval of a file is skipped there
+            if (!headless_format.empty()) wait_rendered(worker);
+            close_interval(worker, capture_epoch.fetch_add(1) + 1, boundary);
+            boundary += interval;
+        }
+
+        if (realtime) sleep_until(worker, start + (now - first) * 1000000);
+
+        worker.handlers.batch(reinterpret_cast<u_char *>(&worker), header, packet);
+        worker.packets++;
+        worker.counters.received++;
+        worker.replayed++;
+    }
+
+    if (worker.batch.count > 0) count_batch(reinterpret_cast<u_char *>(&worker));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    worker.replay_ns = static_cast<uint64_t>(end.tv_sec) * 1000000000 + end.tv_nsec - start;
+
+    // The partial last interval is published too, it stays on the screen until the user quits
+    if (boundary != 0) {
+        if (!headless_format.empty()) wait_rendered(worker);
+        close_interval(worker, capture_epoch.fetch_add(1) + 1, boundary);
+    }
+
+    // Wakes the render thread once more, headless output ends after the last interval
+    capture_finished = true;
+    uint64_t one = 1;
+    if (write(snapshot_fd, &one, sizeof(one)) != sizeof(one)) return;
+}